@@ -8,13 +8,17 @@ HMR_ARGS opts;
 
 HMR_ARG_PARSER args_parser = {
     { {"-f", "--fasta"}, "FASTA", "Contig FASTA file (.fasta/.fasta.gz)", LAMBDA_PARSE_ARG {opts.fasta = arg[0]; }},
-    { {"-m", "--mapping"}, "MAPPING 1, MAPPING 2...", "Hi-C reads mapping files (.bam/.hmr_mapping)", LAMBDA_PARSE_ARG { opts.mappings = arg; }},
-    { {"-o", "--output"}, "OUTPUT", "Corrected contig FASTA file (.fasta)", LAMBDA_PARSE_ARG {opts.output = arg[0]; }},
+    { {"-m", "--mapping"}, "MAPPING 1, MAPPING 2...", "Hi-C reads mapping files (.bam/.pairs/.pairs.gz/.hmr_mapping)", LAMBDA_PARSE_ARG { opts.mappings = arg; }},
+    { {"-o", "--output"}, "OUTPUT", "Corrected contig FASTA file (.fasta/.fasta.gz)", LAMBDA_PARSE_ARG {opts.output = arg[0]; }},
     { {"-p", "--percent"}, "PERCENT", "Percent of the map to saturate (default: 0.95)", LAMBDA_PARSE_ARG {opts.percent = atof(arg[0]);}},
     { {"-s", "--sensitive"}, "SENSITIVE", "Sensitivity to depletion score (default: 0.5)", LAMBDA_PARSE_ARG {opts.sensitive = atof(arg[0]); }},
     { {"-q", "--mapq"}, "MAPQ", "MAPQ of mapping lower bound (default: 1)", LAMBDA_PARSE_ARG {opts.mapq = atoi(arg[0]); }},
     { {"-w", "--wide"}, "WIDE", "Resolution for first pass search of mismatches (default: 25000)", LAMBDA_PARSE_ARG {opts.wide = atoi(arg[0]); }},
     { {"-n", "--narrow"}, "NARROW", "Resolution for the precise mismatch localizaton, NARROW < WIDE (default: 1000)", LAMBDA_PARSE_ARG {opts.narrow = atoi(arg[0]); }},
     { {"-d", "--depletion"}, "DEPLETION", "The size of the region to aggregate the depletion score in the wide path, DEPLETION >= 2 * WIDE (default: 100000)", LAMBDA_PARSE_ARG {opts.depletion = atoi(arg[0]); }},
+    { {"-l", "--contigs"}, "CONTIG 1, CONTIG 2...", "Only load the reads of the contigs, using the BAM index when available (default: all)", LAMBDA_PARSE_ARG { opts.contigs = arg; }},
     { {"-t", "--threads"}, "THREAS", "Number of threads (default: 1)", LAMBDA_PARSE_ARG { opts.threads = atoi(arg[0]); }},
+    { {"-i", "--io-depth"}, "IO_DEPTH", "Number of decompressed buffers queued for parsing (default: 3)", LAMBDA_PARSE_ARG { opts.io_depth = atoi(arg[0]); }},
+    { {"-b", "--io-buffer"}, "IO_BUFFER", "Size of a decompressed buffer in MB (default: 4)", LAMBDA_PARSE_ARG { opts.io_buffer = atoi(arg[0]); }},
+    { {"-c", "--line-width"}, "LINE_WIDTH", "Bases per line of the corrected sequences, 0 for no wrapping (default: 0)", LAMBDA_PARSE_ARG { opts.line_width = atoi(arg[0]); }},
 };
@@ -8,8 +8,9 @@ typedef struct HMR_ARGS
     const char *fasta = NULL;
     const char *output = NULL;
     std::vector<char *> mappings;
+    std::vector<char *> contigs;
     double percent = 0.95, sensitive = 0.5;
-    int mapq = 1, wide = 25000, narrow = 1000, depletion = 100000, threads = 1;
+    int mapq = 1, wide = 25000, narrow = 1000, depletion = 100000, threads = 1, io_depth = 3, io_buffer = 4, line_width = 0;
 } HMR_ARGS;
 
 #endif // ARGS_CORRECT_H
@@ -1,24 +1,38 @@
 #include <cstdlib>
 
+#include "hmr_fasta.h"
 #include "hmr_ui.h"
 
 #include "contig_correct_type.h"
 
 #include "contig_correct.h"
 
-void contig_correct_build(int32_t index, char* seq_name, size_t seq_name_size, char* seq, size_t seq_size, void* user)
+void contig_correct_insert(CONTIG_MAP* map, const std::string& contig_name, int32_t index, size_t length)
 {
-    //Recast the user into map.
-    CONTIG_MAP* map = reinterpret_cast<CONTIG_MAP*>(user);
-    //Record the sequence name and length.
-    std::string contig_name(seq_name, seq_name_size);
     auto contig_finder = map->find(contig_name);
     if (contig_finder != map->end())
     {
         time_error(-1, "Corrupted FASTA: contig '%s' already existed.", contig_name.data());
     }
     //Insert the contig into map.
-    map->insert(std::make_pair(contig_name, CONTIG_INFO {index, seq_size} ));
+    map->insert(std::make_pair(contig_name, CONTIG_INFO {index, length} ));
+}
+
+void contig_correct_build(int32_t index, char* seq_name, size_t seq_name_size, char* seq, size_t seq_size, void* user)
+{
+    //Recast the user into map.
+    CONTIG_MAP* map = reinterpret_cast<CONTIG_MAP*>(user);
+    //Record the sequence name before the first space and length, same as the FASTA index.
+    contig_correct_insert(map, std::string(seq_name, hmr_fasta_name_size(seq_name, seq_name_size)), index, seq_size);
     free(seq_name);
     free(seq);
 }
+
+void contig_correct_build_index(const HMR_FASTA_INDEX& index, CONTIG_MAP* map)
+{
+    //The contig id is the record index in the FASTA index.
+    for (size_t i = 0; i < index.size(); ++i)
+    {
+        contig_correct_insert(map, index[i].name, static_cast<int32_t>(i), index[i].length);
+    }
+}
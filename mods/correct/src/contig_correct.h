@@ -3,6 +3,11 @@
 
 #include <cstdint>
 
+#include "hmr_fasta.h"
+
+#include "contig_correct_type.h"
+
 void contig_correct_build(int32_t index, char* seq_name, size_t seq_name_size, char* seq, size_t seq_size, void* user);
+void contig_correct_build_index(const HMR_FASTA_INDEX& index, CONTIG_MAP* map);
 
 #endif // CONTIG_CORRECT_H
\ No newline at end of file
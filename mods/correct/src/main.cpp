@@ -7,6 +7,7 @@
 #include "hmr_path.h"
 #include "hmr_ui.h"
 #include "hmr_parallel.h"
+#include "hmr_bin_queue.h"
 
 #include "args_correct.h"
 #include "contig_correct.h"
@@ -24,41 +25,56 @@ int main(int argc, char* argv[])
     if (!path_can_read(opts.fasta)) { time_error(-1, "Cannot read FASTA file %s", opts.fasta); }
     if (opts.mappings.empty()) { help_exit(-1, "Missing Hi-C mapping file path."); }
     if (!opts.output) { help_exit(-1, "Missing output corrected FASTA file path."); }
+    if (opts.line_width < 0) { help_exit(-1, "Line width should not be negative."); }
     //Try to write to output FASTA file.
     MISMATCH_CORRECTING corrected_file;
-    mismatch_correct_open(opts.output, &corrected_file);
+    mismatch_correct_open(opts.output, &corrected_file, static_cast<size_t>(opts.line_width), opts.threads);
     //Load the FASTA name and length.
     time_print("Execution configuration:");
     time_print("\tMinimum Map Quality: %d", opts.mapq);
     time_print("\tMismatch resolutions: %d, %d, %d", opts.narrow, opts.wide, opts.depletion);
     time_print("\tThreads: %d", opts.threads);
-    //Build the contig map.
-    time_print("Building contig map from FASTA %s", opts.fasta);
-    BAM_CORRECT_MAP correct_map;
-    hmr_fasta_read(opts.fasta, contig_correct_build, &correct_map.contig_map);
-    time_print("Contig map built, %zu contig(s) read.", correct_map.contig_map.size());
+    time_print("\tLine width: %d", opts.line_width);
+    if (!opts.contigs.empty()) { time_print("\tSelected contigs: %zu", opts.contigs.size()); }
+    if (opts.io_depth < 2 || opts.io_buffer < 1) { help_exit(-1, "IO depth should be at least 2, IO buffer should be at least 1 MB."); }
+    time_print("\tIO buffers: %d x %d MB", opts.io_depth, opts.io_buffer);
+    hmr_bin_queue_tuning = HMR_BIN_QUEUE_TUNING{ static_cast<size_t>(opts.io_depth), static_cast<size_t>(opts.io_buffer) << 20 };
+    //Build the contig map, from the FASTA index when the FASTA could be indexed.
+    CONTIG_MAP contig_map;
+    HMR_FASTA_FILE* fasta_file = hmr_fasta_open(opts.fasta, opts.threads);
+    if (fasta_file)
+    {
+        time_print("Building contig map from FASTA index %s.fai", opts.fasta);
+        contig_correct_build_index(fasta_file->index, &contig_map);
+    }
+    else
+    {
+        time_print("Building contig map from FASTA %s", opts.fasta);
+        hmr_fasta_read(opts.fasta, contig_correct_build, &contig_map, opts.threads);
+    }
+    time_print("Contig map built, %zu contig(s) read.", contig_map.size());
     //Prepare the mapping quality and pos lists.
+    BAM_CORRECT_MAP correct_map;
+    correct_map.contig_map = &contig_map;
+    correct_map.bam_id_map = BAM_CONTIG_MAP{ 0, NULL };
     correct_map.narrow = opts.narrow;
     correct_map.wide = opts.wide;
     correct_map.mapq = opts.mapq;
-    correct_map.wide_db = new HIC_DB[correct_map.contig_map.size()];
-    correct_map.narrow_db = new HIC_DB[correct_map.contig_map.size()];
+    correct_map.wide_db = new HIC_DB[contig_map.size()];
+    correct_map.narrow_db = new HIC_DB[contig_map.size()];
     //Loop and parse the mapping information.
     time_print("Constructing Hi-C reads relations...");
-    for (char* mapping_path : opts.mappings)
-    {
-        time_print("Loading reads from %s", mapping_path);
-        //Build the reads mapping.
-        hmr_mapping_read(mapping_path, 
-            MAPPING_PROC {mapping_correct_n_contig, mapping_correct_contig, mapping_correct_read_align}, 
-            &correct_map, opts.threads);
-        //Recover the mapping array.
-        delete[] correct_map.bam_id_map.id;
-    }
+    MAPPING_REF_SET mapping_refs(opts.contigs.begin(), opts.contigs.end());
+    //Build the reads mapping.
+    hmr_mapping_read(opts.mappings,
+        MAPPING_PROC {mapping_correct_n_contig, mapping_correct_contig, mapping_correct_read_align, mapping_correct_shard_create, mapping_correct_shard_merge, mapping_correct_read_batch},
+        &correct_map, opts.threads, opts.contigs.empty() ? NULL : &mapping_refs);
+    //Recover the mapping array.
+    delete[] correct_map.bam_id_map.id;
     time_print("Read(s) positions loaded and filtered.");
     //Calculate all the mismatches.
     time_print("Calculating mismatches...");
-    int32_t contig_size = correct_map.contig_map.size();
+    int32_t contig_size = contig_map.size();
     corrected_file.mismatches = new RANGE_LIST[contig_size];
     hmr_parallel_for(opts.threads, contig_size,
         mismatch_calc, correct_map.wide_db, correct_map.narrow_db, opts.percent, opts.sensitive, opts.depletion, opts.wide, opts.narrow, corrected_file.mismatches);
@@ -68,9 +84,17 @@ int main(int argc, char* argv[])
     time_print("Mismatches found.");
     //Based on the mismatches, render the corrected FASTA.
     time_print("Building the corrected FASTA file...");
-    hmr_fasta_read(opts.fasta, mismatch_corrected, &corrected_file);
+    if (fasta_file)
+    {
+        mismatch_correct_write(&corrected_file, fasta_file);
+        hmr_fasta_close(fasta_file);
+    }
+    else
+    {
+        hmr_fasta_read_packed(opts.fasta, mismatch_corrected, &corrected_file, opts.threads);
+    }
     //Flush the data.
-    fclose(corrected_file.fp);
+    mismatch_correct_close(&corrected_file);
     time_print("Corrected FASTA has been written to %s", opts.output);
     return 0;
 }
\ No newline at end of file
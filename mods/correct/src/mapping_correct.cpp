@@ -1,15 +1,20 @@
 #include <cstdio>
+#include <cstring>
 
+#include "hmr_global.h"
 #include "hmr_ui.h"
 #include "mapping_correct_type.h"
 
 #include "mapping_correct.h"
 
+#define MAPPING_CORRECT_BATCH (1024)
+
 void mapping_correct_n_contig(uint32_t n_ref, void* user)
 {
     BAM_CORRECT_MAP* bam_map = static_cast<BAM_CORRECT_MAP*>(user);
     //Initialize the contig id.
     bam_map->bam_id_map.size = n_ref;
+    delete[] bam_map->bam_id_map.id;
     bam_map->bam_id_map.id = new int32_t[n_ref];
     for (int i = 0; i < n_ref; ++i)
     {
@@ -22,8 +27,8 @@ void mapping_correct_contig(uint32_t name_length, char* name, uint32_t length, v
 {
     BAM_CORRECT_MAP* bam_map = static_cast<BAM_CORRECT_MAP*>(user);
     //Find the name in the contig map.
-    auto contig_finder = bam_map->contig_map.find(std::string(name, name_length));
-    if (contig_finder != bam_map->contig_map.end())
+    auto contig_finder = bam_map->contig_map->find(std::string(name, name_length));
+    if (contig_finder != bam_map->contig_map->end())
     {
         //Assign the contig id.
         bam_map->bam_id_map.id[bam_map->bam_contig_id] = (*contig_finder).second.id;
@@ -50,13 +55,23 @@ inline void count_pair(int32_t a, int32_t b, HIC_DB& db)
     }
 }
 
+inline void mapping_correct_count(BAM_CORRECT_MAP* bam_map, int32_t target_id, int32_t pos, int32_t next_pos)
+{
+    //Count at wide database.
+    count_pair(pos / bam_map->wide * bam_map->wide,
+        next_pos / bam_map->wide * bam_map->wide, bam_map->wide_db[target_id]);
+    count_pair(pos / bam_map->narrow * bam_map->narrow,
+        next_pos / bam_map->narrow * bam_map->narrow, bam_map->narrow_db[target_id]);
+}
+
 void mapping_correct_read_align(size_t id, const MAPPING_INFO& mapping_info, void* user)
 {
     BAM_CORRECT_MAP* bam_map = static_cast<BAM_CORRECT_MAP*>(user);
     //Check the mapq reaches the limitation.
     if (mapping_info.mapq < bam_map->mapq || // Quality filter.
         mapping_info.pos == -1 || mapping_info.next_pos == -1 || // Mapped.
-        mapping_info.refID != mapping_info.next_refID) //In the same contig.
+        mapping_info.refID != mapping_info.next_refID || //In the same contig.
+        static_cast<uint32_t>(mapping_info.refID) >= bam_map->bam_id_map.size)
     {
         return;
     }
@@ -65,9 +80,85 @@ void mapping_correct_read_align(size_t id, const MAPPING_INFO& mapping_info, voi
     {
         return;
     }
-    //Count at wide database.
-    count_pair(mapping_info.pos / bam_map->wide * bam_map->wide,
-        mapping_info.next_pos / bam_map->wide * bam_map->wide, bam_map->wide_db[target_id]);
-    count_pair(mapping_info.pos / bam_map->narrow * bam_map->narrow,
-        mapping_info.next_pos / bam_map->narrow * bam_map->narrow, bam_map->narrow_db[target_id]);
+    mapping_correct_count(bam_map, target_id, mapping_info.pos, mapping_info.next_pos);
+}
+
+void mapping_correct_read_batch(const MAPPING_BATCH& batch, void* user)
+{
+    BAM_CORRECT_MAP* bam_map = static_cast<BAM_CORRECT_MAP*>(user);
+    size_t selected[MAPPING_CORRECT_BATCH];
+    int32_t targets[MAPPING_CORRECT_BATCH];
+    uint32_t n_refs = bam_map->bam_id_map.size;
+    uint8_t mapq = bam_map->mapq;
+    for (size_t start = 0; start < batch.size; start += MAPPING_CORRECT_BATCH)
+    {
+        size_t end = hMin(batch.size, start + MAPPING_CORRECT_BATCH);
+        //Select the mapped reads inside one contig, the index is always written and only kept when passed.
+        size_t kept = 0;
+        for (size_t i = start; i < end; ++i)
+        {
+            selected[kept] = i;
+            kept += (batch.mapq[i] >= mapq) & (batch.pos[i] != -1) & (batch.next_pos[i] != -1) &
+                (batch.refID[i] == batch.next_refID[i]) & (static_cast<uint32_t>(batch.refID[i]) < n_refs);
+        }
+        //Map the references to the contigs.
+        size_t valid = 0;
+        for (size_t k = 0; k < kept; ++k)
+        {
+            size_t i = selected[k];
+            int32_t target_id = bam_map->bam_id_map.id[batch.refID[i]];
+            selected[valid] = i;
+            targets[valid] = target_id;
+            valid += target_id != -1;
+        }
+        for (size_t k = 0; k < valid; ++k)
+        {
+            mapping_correct_count(bam_map, targets[k], batch.pos[selected[k]], batch.next_pos[selected[k]]);
+        }
+    }
+}
+
+void* mapping_correct_shard_create(void* user)
+{
+    BAM_CORRECT_MAP* bam_map = static_cast<BAM_CORRECT_MAP*>(user);
+    //Copy the contig id map, count the pairs in separated databases.
+    size_t contig_size = bam_map->contig_map->size();
+    BAM_CONTIG_MAP bam_id_map{ bam_map->bam_id_map.size, NULL };
+    if (bam_map->bam_id_map.id)
+    {
+        bam_id_map.id = new int32_t[bam_id_map.size];
+        memcpy(bam_id_map.id, bam_map->bam_id_map.id, sizeof(int32_t) * bam_id_map.size);
+    }
+    return new BAM_CORRECT_MAP{ new HIC_DB[contig_size], new HIC_DB[contig_size], bam_map->contig_map,
+        bam_id_map, bam_map->bam_contig_id, bam_map->wide, bam_map->narrow, bam_map->mapq };
+}
+
+inline void merge_db(HIC_DB& shard_db, HIC_DB& db)
+{
+    if (db.empty())
+    {
+        db.swap(shard_db);
+        return;
+    }
+    for (auto& pos_counter : shard_db)
+    {
+        db[pos_counter.first] += pos_counter.second;
+    }
+}
+
+void mapping_correct_shard_merge(void* shard_user, void* user)
+{
+    BAM_CORRECT_MAP* bam_map = static_cast<BAM_CORRECT_MAP*>(user),
+        * shard = static_cast<BAM_CORRECT_MAP*>(shard_user);
+    //Add the counts of the shard to the databases.
+    size_t contig_size = bam_map->contig_map->size();
+    for (size_t i = 0; i < contig_size; ++i)
+    {
+        merge_db(shard->wide_db[i], bam_map->wide_db[i]);
+        merge_db(shard->narrow_db[i], bam_map->narrow_db[i]);
+    }
+    delete[] shard->wide_db;
+    delete[] shard->narrow_db;
+    delete[] shard->bam_id_map.id;
+    delete shard;
 }
@@ -6,5 +6,8 @@
 void mapping_correct_n_contig(uint32_t n_ref, void* user);
 void mapping_correct_contig(uint32_t name_length, char* name, uint32_t length, void* user);
 void mapping_correct_read_align(size_t id, const MAPPING_INFO& mapping_info, void* user);
+void mapping_correct_read_batch(const MAPPING_BATCH& batch, void* user);
+void* mapping_correct_shard_create(void* user);
+void mapping_correct_shard_merge(void* shard_user, void* user);
 
 #endif // MAPPING_CORRECT_H
\ No newline at end of file
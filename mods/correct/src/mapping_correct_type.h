@@ -22,7 +22,7 @@ typedef std::unordered_map<uint64_t, int32_t> HIC_DB;
 typedef struct BAM_CORRECT_MAP
 {
     HIC_DB *wide_db, *narrow_db;
-    CONTIG_MAP contig_map;
+    const CONTIG_MAP* contig_map;
     BAM_CONTIG_MAP bam_id_map;
     int32_t bam_contig_id;
     int32_t wide, narrow;
@@ -3,10 +3,15 @@
 #include <unordered_map>
 
 #include "hmr_bin_file.h"
+#include "hmr_fasta.h"
+#include "hmr_global.h"
 #include "hmr_ui.h"
 
 #include "mismatch_correct.h"
 
+//Bases unpacked at once when writing the sequence.
+#define MISMATCH_CORRECT_CHUNK (65536)
+
 typedef std::unordered_map<int32_t, double> SCORE_DB;
 
 inline double round5(double value)
@@ -299,80 +304,127 @@ HMR_PFOR_FUNC(mismatch_calc, HIC_DB* wide_db, HIC_DB* narrow_db, double percent,
     mismatches[idx] = std::move(narrow_mismatch);
 }
 
-void mismatch_correct_open(const char* filepath, MISMATCH_CORRECTING* correct_file)
+void mismatch_correct_open(const char* filepath, MISMATCH_CORRECTING* correct_file, size_t line_width, int threads)
 {
     //Try to open the file for written, use binary type to open it.
     if (!bin_open(filepath, &correct_file->fp, "wb"))
     {
         time_error(-1, "Failed to open corrected FASTA file: %s", filepath);
     }
+    //Compress the FASTA in BGZF when the path ends with .gz.
+    correct_file->writer = hmr_writer_open(correct_file->fp, line_width, hmr_writer_compressed(filepath) ? threads : 0);
+}
+
+void mismatch_correct_close(MISMATCH_CORRECTING* correct_file)
+{
+    hmr_writer_close(correct_file->writer);
+    fclose(correct_file->fp);
+}
+
+void mismatch_correct_seq(HMR_WRITER* writer, const HMR_PACKED_SEQ* seq, size_t start, size_t end)
+{
+    //Unpack the bases by chunks, then end the line.
+    char seq_buf[MISMATCH_CORRECT_CHUNK];
+    while (start < end)
+    {
+        size_t part = hMin(end - start, static_cast<size_t>(MISMATCH_CORRECT_CHUNK));
+        hmr_seq_unpack(seq, start, part, seq_buf);
+        hmr_writer_seq(writer, seq_buf, part);
+        start += part;
+    }
+    hmr_writer_seq_end(writer);
+}
+
+inline void mismatch_correct_name(HMR_WRITER* writer, const char* seq_name, size_t seq_name_size, int32_t start, int32_t end)
+{
+    //Name: >name_start_end
+    char name_buf[1024];
+    name_buf[0] = '>';
+    hmr_writer_write(writer, name_buf, 1);
+    hmr_writer_write(writer, seq_name, seq_name_size);
+#ifdef _MSC_VER
+    int name_size = sprintf_s(name_buf, 1023, "_%d_%d\n", start, end);
+#else
+    int name_size = sprintf(name_buf, "_%d_%d\n", start, end);
+#endif
+    hmr_writer_write(writer, name_buf, name_size);
+}
+
+void mismatch_correct_split(HMR_WRITER* writer, const char* seq_name, size_t seq_name_size, const HMR_PACKED_SEQ* seq, const RANGE_LIST& idx_range)
+{
+    //Split the sequence based on mismatch information, the ranges are limited in the sequence.
+    int32_t seq_size = static_cast<int32_t>(seq->length);
+    int32_t base = 0;
+    for (const auto& edge : idx_range)
+    {
+        int32_t s = hMin(edge.pos.a - 1, seq_size), e = hMin(edge.pos.b - 1, seq_size);
+        mismatch_correct_name(writer, seq_name, seq_name_size, base + 1, s);
+        mismatch_correct_seq(writer, seq, base, s);
+        mismatch_correct_name(writer, seq_name, seq_name_size, s + 1, e);
+        mismatch_correct_seq(writer, seq, s, e);
+        //Update the base.
+        base = e;
+    }
+    //Check whether the e reaches the end.
+    if (base < seq_size)
+    {
+        mismatch_correct_name(writer, seq_name, seq_name_size, base, seq_size);
+        mismatch_correct_seq(writer, seq, base, seq_size);
+    }
 }
 
-void mismatch_corrected(int32_t index, char* seq_name, size_t seq_name_size, char* seq, size_t seq_size, void* user)
+void mismatch_corrected(int32_t index, char* seq_name, size_t seq_name_size, HMR_PACKED_SEQ* seq, void* user)
 {
     MISMATCH_CORRECTING* correct_file = reinterpret_cast<MISMATCH_CORRECTING*>(user);
     //Check whether the contig is splited.
-    FILE* fp = correct_file->fp;
+    HMR_WRITER* writer = correct_file->writer;
     const RANGE_LIST& idx_range = correct_file->mismatches[index];
     if (idx_range.empty())
     {
         //Just write the name and sequence.
-        fwrite(">", 1, 1, fp);
-        fwrite(seq_name, 1, seq_name_size, fp);
-        fwrite("\n", 1, 1, fp);
-        fwrite(seq, 1, seq_size, fp);
-        fwrite("\n", 1, 1, fp);
+        hmr_writer_write(writer, ">", 1);
+        hmr_writer_write(writer, seq_name, seq_name_size);
+        hmr_writer_write(writer, "\n", 1);
+        mismatch_correct_seq(writer, seq, 0, seq->length);
     }
     else
     {
-        //Split the sequence based on mismatch information.
-        char name_buf[1024];
-        int32_t base = 0;
-        for (const auto& edge : idx_range)
+        mismatch_correct_split(writer, seq_name, hmr_fasta_name_size(seq_name, seq_name_size), seq, idx_range);
+    }
+    //Recover the memory.
+    hmr_seq_pack_free(seq);
+    free(seq_name);
+}
+
+void mismatch_correct_write(MISMATCH_CORRECTING* correct_file, HMR_FASTA_FILE* fasta_file)
+{
+    int32_t record_size = static_cast<int32_t>(fasta_file->index.size());
+    int32_t index = 0;
+    while (index < record_size)
+    {
+        //The record without sequence is skipped.
+        const HMR_FASTA_INDEX_RECORD& record = fasta_file->index[index];
+        if (record.length == 0)
         {
-            int32_t s = edge.pos.a - 1, e = edge.pos.b - 1;
-            //Name: >name_base_s
-            fwrite(">", 1, 1, fp);
-            fwrite(seq_name, 1, seq_name_size, fp);
-#ifdef _MSC_VER
-            sprintf_s(name_buf, 1023, "_%d_%d\n", base + 1, s);
-#else
-            sprintf(name_buf, "_%d_%d\n", base + 1, s);
-#endif
-            fwrite(name_buf, 1, strlen(name_buf), fp);
-            fwrite(seq + base, 1, s - base, fp);
-            fwrite("\n", 1, 1, fp);
-            //Name: >name_s_e
-            fwrite(">", 1, 1, fp);
-            fwrite(seq_name, 1, seq_name_size, fp);
-#ifdef _MSC_VER
-            sprintf_s(name_buf, 1023, "_%d_%d\n", s + 1, e);
-#else
-            sprintf(name_buf, "_%d_%d\n", s + 1, e);
-#endif
-            fwrite(name_buf, 1, strlen(name_buf), fp);
-            fwrite(seq + s, 1, e - s, fp);
-            fwrite("\n", 1, 1, fp);
-            //Update the base.
-            base = e;
+            ++index;
+            continue;
         }
-        //Check whether the e reaches the end.
-        if (base < seq_size)
+        //The records which are not splited are copied as they are in one piece.
+        if (correct_file->mismatches[index].empty())
         {
-            //Name: >name_base_seqsize
-            fwrite(">", 1, 1, fp);
-            fwrite(seq_name, 1, seq_name_size, fp);
-#ifdef _MSC_VER
-            sprintf_s(name_buf, 1023, "_%d_%zu\n", base, seq_size);
-#else
-            sprintf(name_buf, "_%d_%zu\n", base, seq_size);
-#endif
-            fwrite(name_buf, 1, strlen(name_buf), fp);
-            fwrite(seq + base, 1, seq_size - base, fp);
-            fwrite("\n", 1, 1, fp);
+            int32_t last = index;
+            while (last + 1 < record_size && fasta_file->index[last + 1].length > 0 && correct_file->mismatches[last + 1].empty())
+            {
+                ++last;
+            }
+            hmr_fasta_copy(fasta_file, index, last, correct_file->writer);
+            index = last + 1;
+            continue;
         }
+        //Only the splited contigs are fetched.
+        HMR_PACKED_SEQ* seq = hmr_fasta_fetch_packed(fasta_file, index);
+        mismatch_correct_split(correct_file->writer, record.name.data(), record.name.size(), seq, correct_file->mismatches[index]);
+        hmr_seq_pack_free(seq);
+        ++index;
     }
-    //Recover the memory.
-    free(seq);
-    free(seq_name);
 }
@@ -3,6 +3,7 @@
 
 #include <vector>
 #include "hmr_parallel.h"
+#include "hmr_fasta.h"
 
 #include "mapping_correct_type.h"
 
@@ -14,9 +15,12 @@ typedef struct MISMATCH_CORRECTING
 {
     RANGE_LIST* mismatches;
     FILE* fp;
+    HMR_WRITER* writer;
 } MISMATCH_CORRECTING;
 
-void mismatch_correct_open(const char* filepath, MISMATCH_CORRECTING* correct_file);
-void mismatch_corrected(int32_t index, char* seq_name, size_t seq_name_size, char* seq, size_t seq_size, void* user);
+void mismatch_correct_open(const char* filepath, MISMATCH_CORRECTING* correct_file, size_t line_width, int threads);
+void mismatch_correct_close(MISMATCH_CORRECTING* correct_file);
+void mismatch_corrected(int32_t index, char* seq_name, size_t seq_name_size, HMR_PACKED_SEQ* seq, void* user);
+void mismatch_correct_write(MISMATCH_CORRECTING* correct_file, HMR_FASTA_FILE* fasta_file);
 
 #endif // MISMATCH_CORRECT_H
\ No newline at end of file
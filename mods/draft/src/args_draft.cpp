@@ -8,11 +8,17 @@ HMR_ARGS opts;
 
 HMR_ARG_PARSER args_parser = {
     { {"-f", "--fasta"}, "FASTA", "Contig FASTA file (.fasta/.fasta.gz)", LAMBDA_PARSE_ARG {opts.fasta = arg[0]; }},
-    { {"-m", "--mapping"}, "MAPPING 1, MAPPING 2...", "Hi-C reads mapping files (.bam/.hmr_mapping)", LAMBDA_PARSE_ARG { opts.mappings = arg; }},
+    { {"-m", "--mapping"}, "MAPPING 1, MAPPING 2...", "Hi-C reads mapping files (.bam/.pairs/.pairs.gz/.hmr_mapping)", LAMBDA_PARSE_ARG { opts.mappings = arg; }},
     { {"-o", "--output"}, "OUTPUT", "Output graph prefix", LAMBDA_PARSE_ARG {opts.output = arg[0]; }},
-    { {"-e", "--enzyme"}, "ENZYME", "Enzyme to find in the sequence", LAMBDA_PARSE_ARG {opts.enzyme = arg[0];}},
+    { {"-e", "--enzyme"}, "ENZYME", "Enzymes or sites (IUPAC) to find on both strands, separated by comma", LAMBDA_PARSE_ARG {opts.enzyme = arg[0];}},
     { {"-q", "--mapq"}, "MAPQ", "MAPQ of mapping lower bound (default: 1)", LAMBDA_PARSE_ARG {opts.mapq = atoi(arg[0]); }},
     { {"-r", "--range"}, "ENZYME_RANGE", "The enzyme position range size (default: 1000)", LAMBDA_PARSE_ARG {opts.range = atoi(arg[0]) >> 1; }},
     { {"-c", "--count"}, "ENZYME_COUNT", "The minimum enzyme count (default: 0)", LAMBDA_PARSE_ARG {opts.min_enzymes = atoi(arg[0]); }},
+    { {"-l", "--contigs"}, "CONTIG 1, CONTIG 2...", "Only load the reads of the contigs, using the BAM index when available (default: all)", LAMBDA_PARSE_ARG { opts.contigs = arg; }},
     { {"-t", "--threads"}, "THREAS", "Number of threads (default: 1)", LAMBDA_PARSE_ARG { opts.threads = atoi(arg[0]); }},
+    { {"-i", "--io-depth"}, "IO_DEPTH", "Number of decompressed buffers queued for parsing (default: 3)", LAMBDA_PARSE_ARG { opts.io_depth = atoi(arg[0]); }},
+    { {"-b", "--io-buffer"}, "IO_BUFFER", "Size of a decompressed buffer in MB (default: 4)", LAMBDA_PARSE_ARG { opts.io_buffer = atoi(arg[0]); }},
+    { {"-d", "--dump-mapping"}, "DUMP", "Save the mapped reads to a .hmr_mapping file for later runs (default: none)", LAMBDA_PARSE_ARG { opts.dump_mapping = arg[0]; }},
+    { {"-s", "--sort-dump"}, "", "Sort the saved reads by contig and position", LAMBDA_PARSE_ARG { opts.sort_dump = true; }},
+    { {"-z", "--compress"}, "", "Compress the reads and edge files in BGZF (.hmr_reads.gz/.hmr_edge.gz)", LAMBDA_PARSE_ARG { opts.compress = true; }},
 };
@@ -1,16 +1,20 @@
 #ifndef ARGS_DRAFT_H
 #define ARGS_DRAFT_H
 
+#include <string>
 #include <vector>
 
 typedef struct HMR_ARGS
 {
     const char *fasta = NULL;
     const char *output = NULL;
+    const char *dump_mapping = NULL;
     std::vector<char *> mappings;
+    std::vector<char *> contigs;
     char* enzyme = nullptr;
-    const char* enzyme_nuc = nullptr;
-    int enzyme_nuc_length = 0, mapq = 40, threads = 1, range = 500, min_enzymes = 0;
+    std::vector<std::string> enzyme_nucs;
+    int mapq = 40, threads = 1, range = 500, min_enzymes = 0, io_depth = 3, io_buffer = 4;
+    bool sort_dump = false, compress = false;
 } HMR_ARGS;
 
 #endif // ARGS_DRAFT_H
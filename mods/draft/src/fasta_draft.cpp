@@ -1,133 +1,661 @@
 #include <cstring>
 #include <cassert>
-#include <list>
 
+#include <zlib.h>
+
+//The AVX2 search is compiled for x86-64, and used when the CPU supports it.
+#if defined(_MSC_VER) && defined(_M_X64)
+#include <immintrin.h>
+#include <intrin.h>
+#define FASTA_DRAFT_AVX2
+#define FASTA_DRAFT_AVX2_TARGET
+#elif defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define FASTA_DRAFT_AVX2
+#define FASTA_DRAFT_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+#include "hmr_bin_file.h"
+#include "hmr_global.h"
+#include "hmr_read_ahead.h"
 #include "hmr_ui.h"
 
 #include "fasta_draft.h"
 
-void contig_draft_search_start(const char *enzyme, int32_t enzyme_length, ENZYME_SEARCH& search)
+void contig_draft_search_start(const HMR_ENZYME_SEQS& enzymes, ENZYME_SEARCH& search)
 {
-    int* kmpNext = new int32_t[enzyme_length];
-    int i = 0, j = kmpNext[0] = -1;
-    while (i < enzyme_length)
+    search.patterns.clear();
+    search.max_length = 0;
+    for (const std::string& enzyme : enzymes)
     {
-        while (j > -1 && enzyme[i] != enzyme[j]) { j = kmpNext[j]; }
-        ++i;
-        ++j;
-        if (i < enzyme_length && j < enzyme_length)
+        ENZYME_PATTERN pattern;
+        pattern.length = static_cast<int32_t>(enzyme.size());
+        pattern.degenerate = false;
+        for (int32_t k = 0; k < pattern.length; ++k)
         {
-            kmpNext[i] = (enzyme[i] == enzyme[j]) ? kmpNext[j] : j;
+            pattern.codes.push_back(static_cast<uint8_t>(hmr_enzyme_code(enzyme[k])));
+            int code = hmr_seq_base_code(enzyme[k]);
+            if (k < HMR_SEQ_PACK_BASES)
+            {
+                pattern.lanes[k] = code == -1 ? 0 : static_cast<uint64_t>(code) * 0x5555555555555555ULL;
+            }
+            pattern.degenerate = pattern.degenerate || code == -1;
         }
+        search.patterns.push_back(pattern);
+        search.max_length = hMax(search.max_length, pattern.length);
     }
-    //Assign the value to structure.
-    search.enzyme = enzyme;
-    search.enzyme_length = enzyme_length;
-    search.kmpNext = kmpNext;
+    //The site longer than a word is compared with the unpacked sequence.
+    search.packed = search.max_length <= HMR_SEQ_PACK_BASES;
+#if defined(FASTA_DRAFT_AVX2) && defined(_MSC_VER)
+    int cpu_info[4];
+    __cpuidex(cpu_info, 7, 0);
+    search.avx2 = (cpu_info[1] & (1 << 5)) != 0;
+#elif defined(FASTA_DRAFT_AVX2)
+    search.avx2 = __builtin_cpu_supports("avx2");
+#else
+    search.avx2 = false;
+#endif
 }
 
-void contig_draft_search_end(ENZYME_SEARCH& search)
+void contig_draft_search(const char* seq, size_t seq_size, size_t start, size_t end, ENZYME_SEARCH* search, ENZYME_SITES& sites)
 {
-    delete[] search.kmpNext;
+    //Compare all the sites at each position, the N and soft-masked bases never match.
+    for (size_t pos = start; pos < end; ++pos)
+    {
+        int32_t length = 0;
+        for (const ENZYME_PATTERN& pattern : search->patterns)
+        {
+            if (pattern.length <= length || pos + pattern.length > seq_size)
+            {
+                continue;
+            }
+            int32_t k = 0;
+            while (k < pattern.length)
+            {
+                int code = hmr_seq_base_code(seq[pos + k]);
+                if (code == -1 || !((pattern.codes[k] >> code) & 1))
+                {
+                    break;
+                }
+                ++k;
+            }
+            if (k == pattern.length)
+            {
+                length = pattern.length;
+            }
+        }
+        if (length)
+        {
+            sites.push_back(ENZYME_SITE{ static_cast<int32_t>(pos), length });
+        }
+    }
 }
 
-int32_t contig_draft_search(const char* seq, size_t seq_size, ENZYME_SEARCH* search)
+#define PACKED_LANES (0x5555555555555555ULL)
+
+inline void search_packed_word(uint64_t word, uint64_t next, ENZYME_SEARCH* search, uint64_t* matched)
 {
-    const char* x = search->enzyme;
-    const int32_t m = search->enzyme_length;
-    int32_t* kmpNext = search->kmpNext;
+    //Lanes of the positions which the site starts at, stop comparing when no lane is left.
+    for (size_t p = 0; p < search->patterns.size(); ++p)
+    {
+        const ENZYME_PATTERN& pattern = search->patterns[p];
+        const int32_t length = pattern.length;
+        const uint64_t* pattern_lanes = pattern.lanes;
+        uint64_t lanes = PACKED_LANES;
+        if (!pattern.degenerate)
+        {
+            for (int32_t k = 0; k < length && lanes; ++k)
+            {
+                uint64_t bases = k == 0 ? word : (word >> (k << 1)) | (next << (64 - (k << 1)));
+                uint64_t diff = bases ^ pattern_lanes[k];
+                lanes &= ~(diff | (diff >> 1));
+            }
+            matched[p] = lanes;
+            continue;
+        }
+        const uint8_t* codes = pattern.codes.data();
+        for (int32_t k = 0; k < length && lanes; ++k)
+        {
+            uint8_t code = codes[k];
+            if (code == 15)
+            {
+                continue;
+            }
+            uint64_t bases = k == 0 ? word : (word >> (k << 1)) | (next << (64 - (k << 1)));
+            if (pattern_lanes[k] || code == 1)
+            {
+                uint64_t diff = bases ^ pattern_lanes[k];
+                lanes &= ~(diff | (diff >> 1));
+            }
+            else
+            {
+                //Degenerate base, check the bases it allows.
+                uint64_t low = bases & PACKED_LANES, high = (bases >> 1) & PACKED_LANES;
+                lanes &= ((code & 1) ? ~(low | high) : 0) | ((code & 2) ? low & ~high : 0) |
+                    ((code & 4) ? high & ~low : 0) | ((code & 8) ? low & high : 0);
+            }
+        }
+        matched[p] = lanes;
+    }
+}
 
-    /* Searching */
-    int i = 0, j = 0;
-    while (j < seq_size) 
+#ifdef FASTA_DRAFT_AVX2
+FASTA_DRAFT_AVX2_TARGET inline void search_packed_words(const uint64_t* words, ENZYME_SEARCH* search, uint64_t* matched)
+{
+    //Compare 4 words at once, the word after them must be readable.
+    const size_t n = search->patterns.size();
+    const __m256i packed_lanes = _mm256_set1_epi64x(static_cast<long long>(PACKED_LANES));
+    __m256i word = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words)),
+        next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + 1));
+    __m256i equals[HMR_SEQ_PACK_BASES][4];
+    for (int32_t k = 0; k < search->max_length; ++k)
     {
-        while (i > -1 && x[i] != seq[j])
+        //Shifting by 64 bits clears the lane.
+        __m256i bases = _mm256_or_si256(_mm256_srl_epi64(word, _mm_cvtsi32_si128(k << 1)), _mm256_sll_epi64(next, _mm_cvtsi32_si128(64 - (k << 1))));
+        __m256i low = _mm256_and_si256(bases, packed_lanes), high = _mm256_and_si256(_mm256_srli_epi64(bases, 1), packed_lanes);
+        equals[k][0] = _mm256_andnot_si256(_mm256_or_si256(low, high), packed_lanes);
+        equals[k][1] = _mm256_andnot_si256(high, low);
+        equals[k][2] = _mm256_andnot_si256(low, high);
+        equals[k][3] = _mm256_and_si256(low, high);
+    }
+    uint64_t lanes_buf[4];
+    for (size_t p = 0; p < n; ++p)
+    {
+        const ENZYME_PATTERN& pattern = search->patterns[p];
+        __m256i lanes = packed_lanes;
+        for (int32_t k = 0; k < pattern.length; ++k)
         {
-            i = kmpNext[i];
+            uint8_t code = pattern.codes[k];
+            if (code != 15)
+            {
+                __m256i allowed = _mm256_setzero_si256();
+                for (int b = 0; b < 4; ++b)
+                {
+                    if ((code >> b) & 1)
+                    {
+                        allowed = _mm256_or_si256(allowed, equals[k][b]);
+                    }
+                }
+                lanes = _mm256_and_si256(lanes, allowed);
+            }
         }
-        i++; j++;
-        if (i >= m) 
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes_buf), lanes);
+        for (int j = 0; j < 4; ++j)
         {
-            return (j - i);
+            matched[j * n + p] = lanes_buf[j];
         }
     }
-    return -1;
 }
+#endif
 
-void contig_range_search(const ENZYME_RANGE_SEARCH& param)
+inline void search_packed_emit(const HMR_PACKED_SEQ* seq, size_t word_index, const uint64_t* matched, size_t start, size_t end, ENZYME_SEARCH* search, ENZYME_SITES& sites)
 {
-    std::list<ENZYME_RANGE> ranges;
-    //Search all appearance inside sequence.
-    ENZYME_SEARCH* search = param.search;
-    const char* seq = param.seq;
-    int32_t seq_size = param.seq_size, offset = 0;
-    int32_t enzyme_pos = contig_draft_search(seq, seq_size, search);
-    const int32_t half_range = param.range, end_range = param.seq_size - half_range;
-    size_t counter = 0;
-    while (enzyme_pos != -1)
+    uint64_t found = 0;
+    for (size_t p = 0; p < search->patterns.size(); ++p)
+    {
+        found |= matched[p];
+    }
+    if (!found)
+    {
+        return;
+    }
+    //Positions of the word inside the searching window.
+    size_t word_start = word_index * HMR_SEQ_PACK_BASES;
+    if (word_start < start)
+    {
+        found &= ~0ULL << ((start - word_start) << 1);
+    }
+    if (end - word_start < HMR_SEQ_PACK_BASES)
+    {
+        found &= ~0ULL >> ((HMR_SEQ_PACK_BASES - (end - word_start)) << 1);
+    }
+    //The N and soft-masked bases are packed as A, the site on them is dropped.
+    while (found)
     {
-        //Increase the counter.
-        ++counter;
-        //Record the enzyme position.
-        int32_t range_start = offset + enzyme_pos, range_end = range_start;
-        //Calculate the range end.
-        range_start = (range_start < half_range) ? 0 : range_start - half_range;
-        range_end = (range_end > end_range) ? param.seq_size : (range_end + half_range);
-        //Check shall we merged to last ranges.
-        if (!ranges.empty() && range_start <= ranges.back().end)
+        int lane = hmr_seq_ctz(found) >> 1;
+        size_t pos = word_start + lane;
+        int32_t length = 0;
+        for (size_t p = 0; p < search->patterns.size(); ++p)
         {
-            //Update the back result.
-            ranges.back().end = range_end;
+            const ENZYME_PATTERN& pattern = search->patterns[p];
+            if (((matched[p] >> (lane << 1)) & 1) && pattern.length > length && pos + pattern.length <= seq->length &&
+                !hmr_seq_pack_masked(seq, pos, pattern.length))
+            {
+                length = pattern.length;
+            }
         }
-        else
+        if (length)
         {
-            //Append the new range.
-            ranges.push_back(ENZYME_RANGE{range_start, range_end});
+            sites.push_back(ENZYME_SITE{ static_cast<int32_t>(pos), length });
         }
-        //Update the offset.
-        offset += enzyme_pos + search->enzyme_length;
-        //Search the next position.
-        enzyme_pos = contig_draft_search(seq + offset, seq_size - offset, search);
+        found &= found - 1;
+    }
+}
+
+#ifdef FASTA_DRAFT_AVX2
+FASTA_DRAFT_AVX2_TARGET size_t search_packed_avx2(const HMR_PACKED_SEQ* seq, size_t i, size_t last_word, size_t word_size, size_t start, size_t end, ENZYME_SEARCH* search, uint64_t* matched, ENZYME_SITES& sites)
+{
+    //Search the words before the last word, the rest words are searched one by one.
+    const size_t n = search->patterns.size();
+    for (; i + 3 <= last_word && i + 4 < word_size; i += 4)
+    {
+        search_packed_words(seq->words + i, search, matched);
+        for (size_t j = 0; j < 4; ++j)
+        {
+            search_packed_emit(seq, i + j, matched + j * n, start, end, search, sites);
+        }
+    }
+    return i;
+}
+#endif
+
+void contig_draft_search_packed(const HMR_PACKED_SEQ* seq, size_t start, size_t end, ENZYME_SEARCH* search, ENZYME_SITES& sites)
+{
+    //Compare all the sites with the bases starts at all the positions of a word at once.
+    if (start >= end)
+    {
+        return;
+    }
+    const size_t n = search->patterns.size(), word_size = (seq->length + HMR_SEQ_PACK_BASES - 1) / HMR_SEQ_PACK_BASES,
+        last_word = (end - 1) / HMR_SEQ_PACK_BASES;
+    std::vector<uint64_t> matched(n * 4);
+    size_t i = start / HMR_SEQ_PACK_BASES;
+#ifdef FASTA_DRAFT_AVX2
+    if (search->avx2)
+    {
+        i = search_packed_avx2(seq, i, last_word, word_size, start, end, search, matched.data(), sites);
     }
-    //Convert the enzyme range to array.
-    ENZYME_RANGES &chain_ranges = param.chain_node->data;
-    chain_ranges.counter = counter;
-    chain_ranges.length = ranges.size();
-    chain_ranges.ranges = static_cast<ENZYME_RANGE*>(malloc(sizeof(ENZYME_RANGE) * ranges.size()));
-    if (!chain_ranges.ranges)
+#endif
+    for (; i <= last_word; ++i)
     {
-        time_error(-1, "No enough memory for chain range allocation.");
+        search_packed_word(seq->words[i], i + 1 < word_size ? seq->words[i + 1] : 0, search, matched.data());
+        search_packed_emit(seq, i, matched.data(), start, end, search, sites);
     }
-    int32_t range_index = 0;
-    for (auto i = ranges.begin(); i != ranges.end(); ++i)
+}
+
+void contig_range_build(ENZYME_CONTIG_SEARCH* contig)
+{
+    std::vector<ENZYME_RANGE>& ranges = contig->result->ranges;
+    int32_t seq_size = static_cast<int32_t>(contig->seq->length);
+    const int32_t half_range = contig->range, end_range = seq_size - half_range;
+    size_t counter = 0;
+    int32_t site_end = 0;
+    //Stitch the sites of the chunks in order.
+    for (const ENZYME_SITES& sites : contig->chunk_sites)
     {
-        chain_ranges.ranges[range_index] = *i;
-        ++range_index;
+        for (const ENZYME_SITE& site : sites)
+        {
+            //The next site is searched after the enzyme.
+            if (site.pos < site_end)
+            {
+                continue;
+            }
+            site_end = site.pos + site.length;
+            //Increase the counter.
+            ++counter;
+            //Record the enzyme position.
+            int32_t range_start = site.pos, range_end = range_start;
+            //Calculate the range end.
+            range_start = (range_start < half_range) ? 0 : range_start - half_range;
+            range_end = (range_end > end_range) ? seq_size : (range_end + half_range);
+            //Check shall we merged to last ranges.
+            if (!ranges.empty() && range_start <= ranges.back().end)
+            {
+                //Update the back result.
+                ranges.back().end = range_end;
+            }
+            else
+            {
+                //Append the new range.
+                ranges.push_back(ENZYME_RANGE{range_start, range_end});
+            }
+        }
     }
+    contig->result->counter = counter;
     //Free the sequence.
-    free(param.seq);
+    hmr_seq_pack_free(contig->seq);
+    delete contig;
 }
 
-void contig_draft_build(int32_t index, char* seq_name, size_t seq_name_size, char* seq, size_t seq_size, void* user)
+void contig_range_search(const ENZYME_RANGE_SEARCH& param)
+{
+    //Search the sites start inside the chunk, the sites could end in the next chunk.
+    ENZYME_SEARCH* search = param.search;
+    ENZYME_CONTIG_SEARCH* contig = param.contig;
+    const HMR_PACKED_SEQ* seq = contig->seq;
+    size_t start = param.chunk * ENZYME_SEARCH_CHUNK, end = hMin(start + ENZYME_SEARCH_CHUNK, seq->length);
+    ENZYME_SITES& sites = contig->chunk_sites[param.chunk];
+    if (search->packed)
+    {
+        contig_draft_search_packed(seq, start, end, search, sites);
+    }
+    else
+    {
+        //The sites could not be packed, search the unpacked sequence.
+        size_t text_size = hMin(end + search->max_length, seq->length) - start;
+        char* text = static_cast<char*>(malloc(hMax(text_size, static_cast<size_t>(1))));
+        if (!text)
+        {
+            time_error(-1, "No enough memory for sequence unpacking.");
+        }
+        hmr_seq_unpack(seq, start, text_size, text);
+        contig_draft_search(text, text_size, 0, end - start, search, sites);
+        for (ENZYME_SITE& site : sites)
+        {
+            site.pos += static_cast<int32_t>(start);
+        }
+        free(text);
+    }
+    //The last finished chunk builds the ranges of the contig.
+    if (contig->chunk_remains.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        contig_range_build(contig);
+    }
+}
+
+void contig_draft_build(int32_t index, char* seq_name, size_t seq_name_size, HMR_PACKED_SEQ* seq, void* user)
 {
     DRAFT_NODES_USER* node_user = reinterpret_cast<DRAFT_NODES_USER*>(user);
     //Append the sequence information.
-    node_user->nodes->push_back(HMR_CONTIG{static_cast<int32_t>(seq_name_size), seq_name, static_cast<int32_t>(seq_size)});
-    //Create the search chain.
-    ENZYME_RANGE_CHAIN* chain_node = new ENZYME_RANGE_CHAIN();
-    chain_node->next = NULL;
-    //Append the chain node to the chain.
-    if (node_user->chain_head == NULL)
+    node_user->nodes->push_back(HMR_CONTIG{static_cast<int32_t>(seq_name_size), seq_name, static_cast<int32_t>(seq->length)});
+    //Append the result of the contig.
+    node_user->results->push_back(ENZYME_CONTIG_RANGES());
+    ENZYME_CONTIG_RANGES* result = &node_user->results->back();
+    result->counter = 0;
+    //Push the search requests of the chunks into search pool.
+    ENZYME_CONTIG_SEARCH* contig = new ENZYME_CONTIG_SEARCH();
+    size_t chunks = hMax((seq->length + ENZYME_SEARCH_CHUNK - 1) / ENZYME_SEARCH_CHUNK, static_cast<size_t>(1));
+    contig->result = result;
+    contig->seq = seq;
+    contig->range = node_user->range;
+    contig->chunk_sites.resize(chunks);
+    contig->chunk_remains = chunks;
+    for (size_t i = 0; i < chunks; ++i)
+    {
+        node_user->pool->push_task(ENZYME_RANGE_SEARCH{ node_user->search, contig, i });
+    }
+}
+
+std::string contig_draft_index_path(const char* fasta_path)
+{
+    return std::string(fasta_path) + ".hmr_enzyme";
+}
+
+void contig_draft_index_key(const char* fasta_path, const HMR_ENZYME_SEQS& enzymes, int32_t range, ENZYME_INDEX_KEY& key)
+{
+    //Checksum the whole FASTA file.
+    FILE* fasta_file;
+    if (!bin_open(fasta_path, &fasta_file, "rb"))
+    {
+        time_error(-1, "Failed to read FASTA file %s", fasta_path);
+    }
+    char* buffer = static_cast<char*>(malloc(HMR_READ_AHEAD_BLOCK_SIZE));
+    if (!buffer)
+    {
+        time_error(-1, "No enough memory for FASTA checksum.");
+    }
+    uLong checksum = crc32(0L, Z_NULL, 0);
+    size_t fasta_size = 0, size;
+    while ((size = fread(buffer, 1, HMR_READ_AHEAD_BLOCK_SIZE, fasta_file)) > 0)
+    {
+        checksum = crc32(checksum, reinterpret_cast<const Bytef*>(buffer), static_cast<uInt>(size));
+        fasta_size += size;
+    }
+    free(buffer);
+    fclose(fasta_file);
+    key.fasta_size = fasta_size;
+    key.fasta_checksum = static_cast<uint32_t>(checksum);
+    key.range = range;
+    key.enzymes.clear();
+    for (const std::string& enzyme : enzymes)
+    {
+        key.enzymes += (key.enzymes.empty() ? "" : ",") + enzyme;
+    }
+}
+
+inline size_t enzyme_index_align(size_t size)
+{
+    return (size + 7) & ~static_cast<size_t>(7);
+}
+
+typedef struct ENZYME_INDEX_LAYOUT
+{
+    size_t enzymes, offsets, counters, lengths, name_sizes, names, ranges, size;
+} ENZYME_INDEX_LAYOUT;
+
+ENZYME_INDEX_LAYOUT enzyme_index_layout(const ENZYME_INDEX_HEADER& header)
+{
+    //Header, enzymes, offsets, counters, lengths, name sizes, names and ranges, each array starts at 8 bytes.
+    ENZYME_INDEX_LAYOUT layout;
+    layout.enzymes = enzyme_index_align(sizeof(ENZYME_INDEX_HEADER));
+    layout.offsets = layout.enzymes + enzyme_index_align(header.enzyme_size);
+    layout.counters = layout.offsets + sizeof(uint64_t) * (header.contig_size + 1);
+    layout.lengths = layout.counters + sizeof(uint64_t) * header.contig_size;
+    layout.name_sizes = layout.lengths + enzyme_index_align(sizeof(int32_t) * header.contig_size);
+    layout.names = layout.name_sizes + enzyme_index_align(sizeof(int32_t) * header.contig_size);
+    layout.ranges = layout.names + enzyme_index_align(header.name_size);
+    layout.size = layout.ranges + sizeof(ENZYME_RANGE) * header.range_size;
+    return layout;
+}
+
+void enzyme_index_assign(ENZYME_INDEX& index, char* data)
+{
+    index.header = reinterpret_cast<ENZYME_INDEX_HEADER*>(data);
+    ENZYME_INDEX_LAYOUT layout = enzyme_index_layout(*index.header);
+    index.enzymes = data + layout.enzymes;
+    index.offsets = reinterpret_cast<uint64_t*>(data + layout.offsets);
+    index.counters = reinterpret_cast<uint64_t*>(data + layout.counters);
+    index.lengths = reinterpret_cast<int32_t*>(data + layout.lengths);
+    index.name_sizes = reinterpret_cast<int32_t*>(data + layout.name_sizes);
+    index.names = data + layout.names;
+    index.ranges = reinterpret_cast<ENZYME_RANGE*>(data + layout.ranges);
+}
+
+bool enzyme_index_valid(const ENZYME_INDEX& index, const ENZYME_INDEX_KEY& key)
+{
+    //Check the key and the array sizes of the file.
+    const ENZYME_INDEX_HEADER& header = *index.header;
+    if (header.fasta_size != key.fasta_size || header.fasta_checksum != key.fasta_checksum || header.range != key.range ||
+        header.enzyme_size != key.enzymes.size() || memcmp(index.enzymes, key.enzymes.data(), key.enzymes.size()) != 0 ||
+        index.offsets[0] != 0 || index.offsets[header.contig_size] != header.range_size)
+    {
+        return false;
+    }
+    uint64_t name_size = 0;
+    for (uint64_t i = 0; i < header.contig_size; ++i)
+    {
+        if (index.offsets[i] > index.offsets[i + 1] || index.name_sizes[i] < 0)
+        {
+            return false;
+        }
+        name_size += index.name_sizes[i];
+    }
+    return name_size == header.name_size;
+}
+
+bool contig_draft_index_load(const char* filepath, const ENZYME_INDEX_KEY& key, HMR_CONTIGS& contigs, ENZYME_INDEX& index)
+{
+    index.buckets = NULL;
+    //Map the index file, or read it when it could not be mapped.
+    index.mapped = bin_map(filepath, &index.map, false);
+    if (!index.mapped)
+    {
+        FILE* index_file;
+        if (!bin_open(filepath, &index_file, "rb"))
+        {
+            return false;
+        }
+#ifdef _MSC_VER
+        _fseeki64(index_file, 0, SEEK_END);
+        index.map.size = static_cast<size_t>(_ftelli64(index_file));
+        _fseeki64(index_file, 0, SEEK_SET);
+#else
+        fseeko(index_file, 0, SEEK_END);
+        index.map.size = static_cast<size_t>(ftello(index_file));
+        fseeko(index_file, 0, SEEK_SET);
+#endif
+        index.map.data = static_cast<char*>(malloc(hMax(index.map.size, sizeof(ENZYME_INDEX_HEADER))));
+        bool loaded = index.map.data && fread(index.map.data, 1, index.map.size, index_file) == index.map.size;
+        fclose(index_file);
+        if (!loaded)
+        {
+            free(index.map.data);
+            return false;
+        }
+    }
+    if (index.map.size < sizeof(ENZYME_INDEX_HEADER) || enzyme_index_layout(*reinterpret_cast<ENZYME_INDEX_HEADER*>(index.map.data)).size != index.map.size)
+    {
+        contig_draft_index_free(index);
+        return false;
+    }
+    enzyme_index_assign(index, index.map.data);
+    if (!enzyme_index_valid(index, key))
+    {
+        contig_draft_index_free(index);
+        return false;
+    }
+    //Recover the contig information.
+    const char* name = index.names;
+    for (uint64_t i = 0; i < index.header->contig_size; ++i)
+    {
+        char* contig_name = static_cast<char*>(malloc(hMax(index.name_sizes[i], 1)));
+        if (!contig_name)
+        {
+            time_error(-1, "No enough memory for contig names.");
+        }
+        memcpy(contig_name, name, index.name_sizes[i]);
+        contigs.push_back(HMR_CONTIG{ index.name_sizes[i], contig_name, index.lengths[i] });
+        name += index.name_sizes[i];
+    }
+    return true;
+}
+
+void contig_draft_index_build(const ENZYME_INDEX_KEY& key, const HMR_CONTIGS& contigs, const ENZYME_SEARCH_RESULTS& results, ENZYME_INDEX& index)
+{
+    //Allocate all the arrays in the layout of the index file.
+    ENZYME_INDEX_HEADER header;
+    header.fasta_size = key.fasta_size;
+    header.fasta_checksum = key.fasta_checksum;
+    header.range = key.range;
+    header.enzyme_size = key.enzymes.size();
+    header.contig_size = contigs.size();
+    header.range_size = 0;
+    header.name_size = 0;
+    for (size_t i = 0; i < contigs.size(); ++i)
+    {
+        header.range_size += results[i].ranges.size();
+        header.name_size += contigs[i].name_size;
+    }
+    size_t index_size = enzyme_index_layout(header).size;
+    index.buckets = NULL;
+    index.mapped = false;
+    index.map.size = index_size;
+    index.map.data = static_cast<char*>(calloc(index_size, 1));
+    if (!index.map.data)
+    {
+        time_error(-1, "No enough memory for enzyme index.");
+    }
+    memcpy(index.map.data, &header, sizeof(ENZYME_INDEX_HEADER));
+    enzyme_index_assign(index, index.map.data);
+    memcpy(const_cast<char*>(index.enzymes), key.enzymes.data(), key.enzymes.size());
+    //Fill the offsets and ranges of the contigs.
+    char* name = index.names;
+    uint64_t offset = 0;
+    for (size_t i = 0; i < contigs.size(); ++i)
+    {
+        const ENZYME_CONTIG_RANGES& result = results[i];
+        index.offsets[i] = offset;
+        index.counters[i] = result.counter;
+        index.lengths[i] = contigs[i].length;
+        index.name_sizes[i] = contigs[i].name_size;
+        memcpy(name, contigs[i].name, contigs[i].name_size);
+        name += contigs[i].name_size;
+        if (!result.ranges.empty())
+        {
+            memcpy(index.ranges + offset, result.ranges.data(), sizeof(ENZYME_RANGE) * result.ranges.size());
+        }
+        offset += result.ranges.size();
+    }
+    index.offsets[contigs.size()] = offset;
+}
+
+bool contig_draft_index_save(const char* filepath, const ENZYME_INDEX& index)
+{
+    //The index is still usable when it cannot be saved.
+    FILE* index_file;
+    if (!bin_open(filepath, &index_file, "wb"))
+    {
+        return false;
+    }
+    bool saved = fwrite(index.map.data, 1, index.map.size, index_file) == index.map.size;
+    saved = fclose(index_file) == 0 && saved;
+    if (!saved)
+    {
+        remove(filepath);
+    }
+    return saved;
+}
+
+int32_t contig_draft_index_shift(int32_t range)
+{
+    //Use the widest bucket within the half range, a bucket then reaches at most two ranges.
+    int32_t shift = ENZYME_LOOKUP_SHIFT_MIN;
+    while (shift < ENZYME_LOOKUP_SHIFT_MAX && (static_cast<int64_t>(2) << shift) <= range)
+    {
+        ++shift;
+    }
+    return shift;
+}
+
+ENZYME_RANGES* contig_draft_index_ranges(ENZYME_INDEX& index, int32_t shift)
+{
+    //The ranges of each contig in the flat array.
+    size_t contig_size = index.header->contig_size, bucket_total = 0;
+    for (size_t i = 0; i < contig_size; ++i)
+    {
+        bucket_total += (static_cast<size_t>(index.lengths[i]) >> shift) + 1;
+    }
+    ENZYME_RANGES* contig_ranges = static_cast<ENZYME_RANGES*>(malloc(sizeof(ENZYME_RANGES) * hMax(contig_size, static_cast<size_t>(1))));
+    free(index.buckets);
+    index.buckets = static_cast<uint32_t*>(malloc(sizeof(uint32_t) * hMax(bucket_total, static_cast<size_t>(1))));
+    if (!contig_ranges || !index.buckets)
+    {
+        time_error(-1, "No enough memory for contig ranges.");
+    }
+    uint32_t* buckets = index.buckets;
+    for (size_t i = 0; i < contig_size; ++i)
+    {
+        const ENZYME_RANGE* ranges = index.ranges + index.offsets[i];
+        size_t length = index.offsets[i + 1] - index.offsets[i],
+            bucket_size = (static_cast<size_t>(index.lengths[i]) >> shift) + 1;
+        //Find the first range ends inside or after each bucket.
+        size_t range_id = 0;
+        for (size_t j = 0; j < bucket_size; ++j)
+        {
+            int64_t bucket_start = static_cast<int64_t>(j) << shift;
+            while (range_id < length && ranges[range_id].end < bucket_start)
+            {
+                ++range_id;
+            }
+            buckets[j] = static_cast<uint32_t>(range_id);
+        }
+        contig_ranges[i] = ENZYME_RANGES{ index.ranges + index.offsets[i], length, index.counters[i], buckets, bucket_size, shift };
+        buckets += bucket_size;
+    }
+    return contig_ranges;
+}
+
+void contig_draft_index_free(ENZYME_INDEX& index)
+{
+    free(index.buckets);
+    index.buckets = NULL;
+    if (index.mapped)
     {
-        //Then set the head to be the node.
-        node_user->chain_tail = node_user->chain_head = chain_node;
+        bin_unmap(&index.map);
     }
     else
     {
-        //Append the chain node to the chail tail.
-        node_user->chain_tail->next = chain_node;
-        node_user->chain_tail = chain_node;
+        free(index.map.data);
     }
-    //Push the search request into search pool.
-    node_user->pool->push_task(ENZYME_RANGE_SEARCH{ node_user->search, chain_node, seq, static_cast<int32_t>(seq_size), node_user->range });
+    index.map.data = NULL;
 }
@@ -1,30 +1,72 @@
 #ifndef FASTA_DRAFT_H
 #define FASTA_DRAFT_H
 
+#include <atomic>
+#include <deque>
+#include <vector>
+
 #include "hmr_contig_graph_type.h"
+#include "hmr_enzyme.h"
+#include "hmr_seq_pack.h"
 #include "hmr_thread_pool.h"
 
 #include "fasta_draft_type.h"
 
-typedef struct ENZYME_RANGE_CHAIN
+typedef struct ENZYME_CONTIG_RANGES
+{
+    std::vector<ENZYME_RANGE> ranges;
+    size_t counter;
+} ENZYME_CONTIG_RANGES;
+
+//The searching results are appended in the contig order, the address of a result never changes.
+typedef std::deque<ENZYME_CONTIG_RANGES> ENZYME_SEARCH_RESULTS;
+
+typedef struct ENZYME_PATTERN
 {
-    ENZYME_RANGES data;
-    struct ENZYME_RANGE_CHAIN* next;
-} ENZYME_RANGE_CHAIN;
+    int32_t length;
+    //Bases allowed at each position of the site, in the codes of hmr_enzyme_code().
+    std::vector<uint8_t> codes;
+    //Packed base repeated in all the lanes of a word, for the position allows only one base.
+    uint64_t lanes[HMR_SEQ_PACK_BASES];
+    bool degenerate;
+} ENZYME_PATTERN;
 
 typedef struct ENZYME_SEARCH
 {
-    const char* enzyme;
-    int32_t enzyme_length;
-    int32_t* kmpNext;
+    std::vector<ENZYME_PATTERN> patterns;
+    int32_t max_length;
+    //All the sites could be compared with the packed bases of a word, 4 words at once when the CPU supports AVX2.
+    bool packed, avx2;
 } ENZYME_SEARCH;
 
+typedef struct ENZYME_SITE
+{
+    int32_t pos, length;
+} ENZYME_SITE;
+
+typedef std::vector<ENZYME_SITE> ENZYME_SITES;
+
+// Bases of a contig searched by one task.
+#define ENZYME_SEARCH_CHUNK (4194304)
+// Bucket width limits of the range lookup, in bits.
+#define ENZYME_LOOKUP_SHIFT_MIN (4)
+#define ENZYME_LOOKUP_SHIFT_MAX (16)
+
+//The chunks of a long contig are searched in parallel, the last finished chunk builds the ranges.
+typedef struct ENZYME_CONTIG_SEARCH
+{
+    ENZYME_CONTIG_RANGES* result;
+    HMR_PACKED_SEQ* seq;
+    int32_t range;
+    std::vector<ENZYME_SITES> chunk_sites;
+    std::atomic<size_t> chunk_remains;
+} ENZYME_CONTIG_SEARCH;
+
 typedef struct ENZYME_RANGE_SEARCH
 {
     ENZYME_SEARCH* search;
-    ENZYME_RANGE_CHAIN* chain_node;
-    char* seq;
-    int32_t seq_size, range;
+    ENZYME_CONTIG_SEARCH* contig;
+    size_t chunk;
 } ENZYME_RANGE_SEARCH;
 
 void contig_range_search(const ENZYME_RANGE_SEARCH& param);
@@ -37,14 +79,22 @@ typedef struct DRAFT_NODES_USER
     HMR_CONTIGS* nodes;
     ENZYME_SEARCH* search;
     RANGE_SEARCH_POOL* pool;
-    ENZYME_RANGE_CHAIN* chain_head;
-    ENZYME_RANGE_CHAIN* chain_tail;
+    ENZYME_SEARCH_RESULTS* results;
 } DRAFT_NODES_USER;
 
-void contig_draft_search_start(const char* enzyme, int32_t enzyme_length, ENZYME_SEARCH& search);
-void contig_draft_search_end(ENZYME_SEARCH& search);
-int32_t contig_draft_search(const char *seq, size_t seq_size, ENZYME_SEARCH* search);
+void contig_draft_search_start(const HMR_ENZYME_SEQS& enzymes, ENZYME_SEARCH& search);
+void contig_draft_search(const char* seq, size_t seq_size, size_t start, size_t end, ENZYME_SEARCH* search, ENZYME_SITES& sites);
+void contig_draft_search_packed(const HMR_PACKED_SEQ* seq, size_t start, size_t end, ENZYME_SEARCH* search, ENZYME_SITES& sites);
+
+void contig_draft_build(int32_t index, char* seq_name, size_t seq_name_size, HMR_PACKED_SEQ* seq, void* user);
 
-void contig_draft_build(int32_t index, char* seq_name, size_t seq_name_size, char* seq, size_t seq_size, void* user);
+std::string contig_draft_index_path(const char* fasta_path);
+void contig_draft_index_key(const char* fasta_path, const HMR_ENZYME_SEQS& enzymes, int32_t range, ENZYME_INDEX_KEY& key);
+bool contig_draft_index_load(const char* filepath, const ENZYME_INDEX_KEY& key, HMR_CONTIGS& contigs, ENZYME_INDEX& index);
+void contig_draft_index_build(const ENZYME_INDEX_KEY& key, const HMR_CONTIGS& contigs, const ENZYME_SEARCH_RESULTS& results, ENZYME_INDEX& index);
+bool contig_draft_index_save(const char* filepath, const ENZYME_INDEX& index);
+int32_t contig_draft_index_shift(int32_t range);
+ENZYME_RANGES* contig_draft_index_ranges(ENZYME_INDEX& index, int32_t shift);
+void contig_draft_index_free(ENZYME_INDEX& index);
 
 #endif // FASTA_DRAFT_H
\ No newline at end of file
@@ -2,16 +2,58 @@
 #define FASTA_DRAFT_TYPE_H
 
 #include <cstdint>
+#include <string>
+
+#include "hmr_bin_file.h"
 
 typedef struct ENZYME_RANGE
 {
     int32_t start, end;
 } ENZYME_RANGE;
 
+//Bucket b of a contig holds the index of the first range ends at or after (b << shift).
 typedef struct ENZYME_RANGES
 {
     ENZYME_RANGE* ranges;
     size_t length, counter;
+    const uint32_t* buckets;
+    size_t bucket_size;
+    int32_t shift;
 } ENZYME_RANGES;
 
+//The key of an enzyme index, the index is rebuilt when any of them changes.
+typedef struct ENZYME_INDEX_KEY
+{
+    uint64_t fasta_size;
+    uint32_t fasta_checksum;
+    int32_t range;
+    std::string enzymes;
+} ENZYME_INDEX_KEY;
+
+typedef struct ENZYME_INDEX_HEADER
+{
+    uint64_t fasta_size;
+    uint32_t fasta_checksum;
+    int32_t range;
+    uint64_t enzyme_size, contig_size, range_size, name_size;
+} ENZYME_INDEX_HEADER;
+
+//The ranges of contig i are ranges[offsets[i]] to ranges[offsets[i + 1] - 1], the arrays are laid out as the index file.
+typedef struct ENZYME_INDEX
+{
+    ENZYME_INDEX_HEADER* header;
+    const char* enzymes;
+    uint64_t* offsets;
+    uint64_t* counters;
+    int32_t* lengths;
+    int32_t* name_sizes;
+    char* names;
+    ENZYME_RANGE* ranges;
+    //Range lookup buckets of all the contigs.
+    uint32_t* buckets;
+    //The index file is mapped, or the arrays are allocated in one block.
+    HMR_BIN_MAP map;
+    bool mapped;
+} ENZYME_INDEX;
+
 #endif // FASTA_DRAFT_TYPE_H
\ No newline at end of file
@@ -7,8 +7,10 @@
 #include "hmr_enzyme.h"
 #include "hmr_fasta.h"
 #include "hmr_mapping.h"
+#include "hmr_mapping_bin.h"
 #include "hmr_contig_graph.h"
 #include "hmr_bin_file.h"
+#include "hmr_bin_queue.h"
 
 #include "args_draft.h"
 #include "fasta_draft.h"
@@ -27,44 +29,63 @@ int main(int argc, char* argv[])
     if (opts.mappings.empty()) { help_exit(-1, "Missing Hi-C mapping file path."); }
     if (!opts.enzyme) { help_exit(-1, "Missing restriction enzyme cutting site."); }
     if (!opts.output) { help_exit(-1, "Missing output file prefix."); }
-    //Convert the enzyme into sequence.
-    hmr_enzyme_formalize(opts.enzyme, &opts.enzyme_nuc, &opts.enzyme_nuc_length);
+    //Convert the enzymes into sequences.
+    hmr_enzyme_formalize(opts.enzyme, opts.enzyme_nucs);
+    std::string enzyme_list;
+    for (const std::string& enzyme_nuc : opts.enzyme_nucs)
+    {
+        enzyme_list += (enzyme_list.empty() ? "" : ", ") + enzyme_nuc;
+    }
     time_print("Execution configuration:");
     time_print("\tMinimum map quality: %d", opts.mapq);
-    time_print("\tRestriction enzyme: %s", opts.enzyme_nuc);
+    time_print("\tRestriction sites: %s", enzyme_list.data());
     time_print("\tMinimum restriction enzyme count: %d", opts.min_enzymes);
     time_print("\tHalf of enzyme range: %d", opts.range);
     time_print("\tThreads: %d", opts.threads);
+    if (!opts.contigs.empty()) { time_print("\tSelected contigs: %zu", opts.contigs.size()); }
+    if (opts.dump_mapping) { time_print("\tDump mapping: %s%s", opts.dump_mapping, opts.sort_dump ? " (sorted)" : ""); }
+    if (opts.io_depth < 2 || opts.io_buffer < 1) { help_exit(-1, "IO depth should be at least 2, IO buffer should be at least 1 MB."); }
+    time_print("\tIO buffers: %d x %d MB", opts.io_depth, opts.io_buffer);
+    if (opts.compress) { time_print("\tCompressed output: Yes"); }
+    hmr_bin_queue_tuning = HMR_BIN_QUEUE_TUNING{ static_cast<size_t>(opts.io_depth), static_cast<size_t>(opts.io_buffer) << 20 };
     //Load the FASTA sequence and find the enzyme.
     HMR_CONTIGS contigs;
     HMR_CONTIG_INVALID_SET invalid_id_set;
+    ENZYME_INDEX enzyme_index;
     ENZYME_RANGES* contig_ranges;
     {
-        //Prepare the enzyme for searching.
-        ENZYME_SEARCH search;
-        contig_draft_search_start(opts.enzyme_nuc, opts.enzyme_nuc_length, search);
-        //Prepare the search user data.
-        DRAFT_NODES_USER node_user{ opts.range, &contigs, &search, NULL, NULL, NULL };
+        //Load the enzyme index of the FASTA when it matches.
+        ENZYME_INDEX_KEY index_key;
+        contig_draft_index_key(opts.fasta, opts.enzyme_nucs, opts.range, index_key);
+        std::string path_index = contig_draft_index_path(opts.fasta);
+        if (contig_draft_index_load(path_index.data(), index_key, contigs, enzyme_index))
         {
-            //Prepare the thread pool for searching.
-            RANGE_SEARCH_POOL search_pool(contig_range_search, opts.threads * 32, opts.threads);
-            node_user.pool = &search_pool;
-            time_print("Searching enzyme in %s", opts.fasta);
-            hmr_fasta_read(opts.fasta, contig_draft_build, &node_user);
+            time_print("Enzyme index loaded from %s", path_index.data());
         }
-        contig_draft_search_end(search);
-        //Convert the search node information.
-        contig_ranges = static_cast<ENZYME_RANGES*>(malloc(sizeof(ENZYME_RANGES) * contigs.size()));
-        ENZYME_RANGE_CHAIN* chain_node = node_user.chain_head;
-        int32_t range_index = 0;
-        while (chain_node != NULL)
+        else
         {
-            contig_ranges[range_index++] = chain_node->data;
-            //Recover the chain node.
-            ENZYME_RANGE_CHAIN* next = chain_node->next;
-            free(chain_node);
-            chain_node = next;
+            //Prepare the enzyme for searching.
+            ENZYME_SEARCH search;
+            contig_draft_search_start(opts.enzyme_nucs, search);
+            //Prepare the search user data.
+            ENZYME_SEARCH_RESULTS results;
+            DRAFT_NODES_USER node_user{ opts.range, &contigs, &search, NULL, &results };
+            {
+                //Prepare the thread pool for searching.
+                RANGE_SEARCH_POOL search_pool(contig_range_search, opts.threads * 32, opts.threads);
+                node_user.pool = &search_pool;
+                time_print("Searching enzyme in %s", opts.fasta);
+                hmr_fasta_read_packed(opts.fasta, contig_draft_build, &node_user, opts.threads);
+            }
+            //Flatten the search results into index.
+            contig_draft_index_build(index_key, contigs, results, enzyme_index);
+            time_print("Save enzyme index to %s", path_index.data());
+            if (!contig_draft_index_save(path_index.data(), enzyme_index))
+            {
+                time_print("Failed to save enzyme index, skip.");
+            }
         }
+        contig_ranges = contig_draft_index_ranges(enzyme_index, contig_draft_index_shift(opts.range));
         //Search complete.
         time_print("%zu contig(s) indexed.", contigs.size());
         //Dump the node data to target file.
@@ -77,7 +98,7 @@ int main(int argc, char* argv[])
         //Checking which contig is valid, if invalid, generate the invalid list.
         time_print("Checking invalid contig(s)...");
         HMR_CONTIG_INVALID_IDS invalid_ids;
-        for (int32_t i = 0; i < range_index; ++i)
+        for (int32_t i = 0; i < static_cast<int32_t>(contigs.size()); ++i)
         {
             if (contig_ranges[i].counter < opts.min_enzymes)
             {
@@ -109,30 +130,39 @@ int main(int argc, char* argv[])
         }
         time_print("Contig map has been built.");
         //Prepare the read-pair information output.
-        std::string path_reads = hmr_graph_path_reads(opts.output);
+        std::string path_reads = hmr_graph_path_reads(opts.output, opts.compress);
         FILE* reads_file = NULL;
         if (!bin_open(path_reads.data(), &reads_file, "wb"))
         {
             time_error(-1, "Failed to create read information file %s", path_reads.data());
         }
         time_print("Writing reads summary information to %s", path_reads.data());
+        HMR_WRITER* reads_writer = hmr_writer_open(reads_file, 0, hmr_writer_compressed(path_reads.data()) ? opts.threads : 0);
         //Loop and generate edge information.
-        MAPPING_DRAFT_USER mapping_user{ READ_RECORD(), contig_ids, invalid_id_set, contig_ranges, NULL, 0, RAW_EDGE_MAP(), reads_file, static_cast<uint8_t>(opts.mapq), NULL, 0, 0 };
+        MAPPING_DRAFT_USER mapping_user{ READ_RECORD(), contig_ids, invalid_id_set, contig_ranges, NULL, 0, RAW_EDGE_MAP(), reads_writer, static_cast<uint8_t>(opts.mapq), NULL, 0, 0 };
         time_print("Constructing Hi-C reads relations...");
-        for (char* mapping_path : opts.mappings)
+        MAPPING_REF_SET mapping_refs(opts.contigs.begin(), opts.contigs.end());
+        MAPPING_PROC mapping_proc{ mapping_draft_n_contig, mapping_draft_contig, mapping_draft_read_align, mapping_draft_shard_create, mapping_draft_shard_merge, mapping_draft_read_batch };
+        void* mapping_proc_user = &mapping_user;
+        //Save the mapped reads while building when needed.
+        HMR_MAPPING_DUMP* mapping_dump = opts.dump_mapping ? hmr_mapping_dump_open(opts.dump_mapping, mapping_proc, mapping_proc_user) : NULL;
+        //Build the reads mapping.
+        hmr_mapping_read(opts.mappings, mapping_proc, mapping_proc_user, opts.threads, opts.contigs.empty() ? NULL : &mapping_refs);
+        if (mapping_dump)
         {
-            time_print("Loading reads from %s", mapping_path);
-            //Build the reads mapping.
-            hmr_mapping_read(mapping_path, MAPPING_PROC{ mapping_draft_n_contig, mapping_draft_contig, mapping_draft_read_align }, &mapping_user, opts.threads);
-            //Recover the mapping array.
-            delete[] mapping_user.contig_id_map;
+            time_print("Saving mapped reads to %s", opts.dump_mapping);
+            hmr_mapping_dump_close(mapping_dump, opts.sort_dump);
+            time_print("Done");
         }
+        //Recover the mapping array.
+        delete[] mapping_user.contig_id_map;
         time_print("Contig edges built from %zu file(s).", opts.mappings.size());
         //Check reads file buffer is complete.
         if (mapping_user.output_offset)
         {
-            fwrite(mapping_user.output_buffer, mapping_user.output_offset, 1, reads_file);
+            hmr_writer_write(reads_writer, mapping_user.output_buffer, mapping_user.output_offset);
         }
+        hmr_writer_close(reads_writer);
         fclose(reads_file);
         free(mapping_user.output_buffer);
         time_print("Reads summary information saved.");
@@ -140,11 +170,13 @@ int main(int argc, char* argv[])
         time_print("Calculating %zu edge weights...", mapping_user.edges.size());
         edge_weights = mapping_draft_get_edge_weights(mapping_user.edges, contig_ranges);
         time_print("Done");
+        free(contig_ranges);
+        contig_draft_index_free(enzyme_index);
     }
     //Dump the edge information into files.
-    std::string path_edge = hmr_graph_path_edge(opts.output);
+    std::string path_edge = hmr_graph_path_edge(opts.output, opts.compress);
     time_print("Save contig edge information to %s", path_edge.data());
-    hmr_graph_save_edge(path_edge.data(), edge_weights);
+    hmr_graph_save_edge(path_edge.data(), edge_weights, opts.threads);
     time_print("Done");
     return 0;
 }
\ No newline at end of file
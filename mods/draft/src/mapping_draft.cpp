@@ -1,20 +1,30 @@
+#include <cstring>
+
 #include "hmr_contig_graph.h"
+#include "hmr_global.h"
 
 #include "fasta_draft_type.h"
 
 #include "mapping_draft.h"
 
+#define MAPPING_OUTPUT_SIZE (sizeof(HMR_MAPPING) << 20)
+#define MAPPING_DRAFT_BATCH (1024)
+
 void mapping_draft_n_contig(uint32_t n_ref, void* user)
 {
     MAPPING_DRAFT_USER* mapping_user = reinterpret_cast<MAPPING_DRAFT_USER*>(user);
     //Reset the records.
     mapping_user->records = READ_RECORD();
     //Create the mapping user.
+    delete[] mapping_user->contig_id_map;
     mapping_user->contig_id_map = new int32_t[n_ref];
     mapping_user->contig_idx = 0;
-    //Prepare the output buffer. (<< 20) = 1 MiB
-    mapping_user->output_size = sizeof(HMR_MAPPING) << 20;
-    mapping_user->output_buffer = static_cast<char*>(malloc(mapping_user->output_size));
+    //Prepare the output buffer once, it is shared by all the files. (<< 20) = 1 MiB
+    if (mapping_user->output_buffer == NULL)
+    {
+        mapping_user->output_size = MAPPING_OUTPUT_SIZE;
+        mapping_user->output_buffer = static_cast<char*>(malloc(mapping_user->output_size));
+    }
 }
 
 void mapping_draft_contig(uint32_t name_length, char* name, uint32_t length, void* user)
@@ -37,73 +47,40 @@ void mapping_draft_contig(uint32_t name_length, char* name, uint32_t length, voi
     ++mapping_user->contig_idx;
 }
 
-bool position_in_range(int32_t pos, const ENZYME_RANGES& ranges)
+inline bool position_in_range(int32_t pos, const ENZYME_RANGES& ranges)
 {
-    size_t start = 0, end = ranges.length;
-    do
+    //Start from the first range ends inside the bucket of the position.
+    size_t bucket = hMin(static_cast<size_t>(static_cast<uint32_t>(pos)) >> ranges.shift, ranges.bucket_size - 1),
+        range_id = ranges.buckets[bucket];
+    while (range_id < ranges.length && ranges.ranges[range_id].end < pos)
     {
-        size_t range_ptr = (start + end) >> 1;
-        const ENZYME_RANGE& r = ranges.ranges[range_ptr];
-        //If it is in the range.
-        if (r.start <= pos && pos <= r.end)
-        {
-            return true;
-        }
-        //Check whether we only have two ranges.
-        if (end == start + 1)
-        {
-            const ENZYME_RANGE& rn = ranges.ranges[range_ptr];
-            return rn.start <= pos && pos <= rn.end;
-        }
-        //Change the start or end position.
-        if (pos < r.start)
-        {
-            end = range_ptr;
-        }
-        else
-        {
-            start = range_ptr;
-        }
-    } while (start != end);
-    //No position matched.
-    return false;
+        ++range_id;
+    }
+    return pos >= 0 && range_id < ranges.length && ranges.ranges[range_id].start <= pos;
 }
 
-void mapping_draft_read_align(size_t id, const MAPPING_INFO& mapping_info, void* user)
+inline void mapping_draft_pair(MAPPING_DRAFT_USER* mapping_user, int32_t ref_index, int32_t pos, int32_t next_ref_index, int32_t next_pos)
 {
-    MAPPING_DRAFT_USER* mapping_user = reinterpret_cast<MAPPING_DRAFT_USER*>(user);
-    //Check whether the mapping meets the requirements.
-    if (mapping_info.mapq < mapping_user->mapq || mapping_info.mapq == 255) //Map quality is invalid
-    {
-        return;
-    }
-    //Find the ranges.
-    int32_t ref_index = mapping_user->contig_id_map[mapping_info.refID],
-        next_ref_index = mapping_user->contig_id_map[mapping_info.next_refID];
-    if (ref_index == -1 || next_ref_index == -1 || //Reference index invalid.
-        //Position in range check.
-        !position_in_range(mapping_info.pos, mapping_user->contig_ranges[ref_index]))
-    {
-        return;
-    }
     //Check whether the paired read is in the record.
     MAPPING_READ ref_read{}, next_ref_read{};
-    ref_read.read.id = ref_index; ref_read.read.pos = mapping_info.pos;
-    next_ref_read.read.id = next_ref_index; next_ref_read.read.pos = mapping_info.next_pos;
-    //Search the records inside the map.
-    auto next_finder = mapping_user->records.find(next_ref_read.data);
-    if (next_finder == mapping_user->records.end())
+    ref_read.read.id = ref_index; ref_read.read.pos = pos;
+    next_ref_read.read.id = next_ref_index; next_ref_read.read.pos = next_pos;
+    //Search the pair inside the map, so the pairing does not depend on other reads at the same position.
+    MAPPING_PAIR pair{ hMin(ref_read.data, next_ref_read.data), hMax(ref_read.data, next_ref_read.data) };
+    auto pair_finder = mapping_user->records.find(pair);
+    if (pair_finder == mapping_user->records.end())
     {
-        //Insert the current paired information into the records.
-        mapping_user->records.insert(std::make_pair(ref_read.data, next_ref_read));
+        //Insert the current read into the records, wait for its mate.
+        mapping_user->records.insert(std::make_pair(pair, ref_read));
     }
     else
     {
-        //Check whether the records are paired.
-        if (next_finder->second.data == ref_read.data)
+        //Check whether the records are paired, the pair is only counted once.
+        if (pair_finder->second.data != 0xFFFFFFFFFFFFFFFF &&
+            (pair_finder->second.data != ref_read.data || pair.low == pair.high))
         {
-            //Replace the next finder as an invalid data.
-            next_finder->second.data = 0xFFFFFFFFFFFFFFFF;
+            //Replace the pair finder as an invalid data.
+            pair_finder->second.data = 0xFFFFFFFFFFFFFFFF;
             //Paired information are found.
             HMR_EDGE edge = hmr_graph_edge(ref_index, next_ref_index);
             auto edge_finder = mapping_user->edges.find(edge.data);
@@ -122,18 +99,126 @@ void mapping_draft_read_align(size_t id, const MAPPING_INFO& mapping_info, void*
                 //Write to buffer.
                 if (mapping_user->output_offset == mapping_user->output_size)
                 {
-                    fwrite(mapping_user->output_buffer, mapping_user->output_size, 1, mapping_user->reads_file);
+                    hmr_writer_write(mapping_user->reads_writer, mapping_user->output_buffer, mapping_user->output_size);
                     mapping_user->output_offset = 0;
                 }
                 //Construct and write the mapping info to the reads file.
                 HMR_MAPPING* mapping = reinterpret_cast<HMR_MAPPING*>(mapping_user->output_buffer + mapping_user->output_offset);
-                *mapping = HMR_MAPPING{ ref_index, mapping_info.pos, next_ref_index, mapping_info.next_pos };
+                *mapping = HMR_MAPPING{ ref_index, pos, next_ref_index, next_pos };
                 mapping_user->output_offset += sizeof(HMR_MAPPING);
             }
         }
     }
 }
 
+void mapping_draft_read_align(size_t id, const MAPPING_INFO& mapping_info, void* user)
+{
+    MAPPING_DRAFT_USER* mapping_user = reinterpret_cast<MAPPING_DRAFT_USER*>(user);
+    //Check whether the mapping meets the requirements.
+    if (mapping_info.mapq < mapping_user->mapq || mapping_info.mapq == 255 || //Map quality is invalid
+        static_cast<uint32_t>(mapping_info.refID) >= static_cast<uint32_t>(mapping_user->contig_idx) || //Unmapped.
+        static_cast<uint32_t>(mapping_info.next_refID) >= static_cast<uint32_t>(mapping_user->contig_idx))
+    {
+        return;
+    }
+    //Find the ranges.
+    int32_t ref_index = mapping_user->contig_id_map[mapping_info.refID],
+        next_ref_index = mapping_user->contig_id_map[mapping_info.next_refID];
+    if (ref_index == -1 || next_ref_index == -1 || //Reference index invalid.
+        //Position in range check, the pair is never counted when the mate is out of range.
+        !position_in_range(mapping_info.pos, mapping_user->contig_ranges[ref_index]) ||
+        !position_in_range(mapping_info.next_pos, mapping_user->contig_ranges[next_ref_index]))
+    {
+        return;
+    }
+    mapping_draft_pair(mapping_user, ref_index, mapping_info.pos, next_ref_index, mapping_info.next_pos);
+}
+
+void mapping_draft_read_batch(const MAPPING_BATCH& batch, void* user)
+{
+    MAPPING_DRAFT_USER* mapping_user = reinterpret_cast<MAPPING_DRAFT_USER*>(user);
+    size_t selected[MAPPING_DRAFT_BATCH];
+    int32_t ref_indices[MAPPING_DRAFT_BATCH], next_ref_indices[MAPPING_DRAFT_BATCH];
+    uint32_t n_refs = static_cast<uint32_t>(mapping_user->contig_idx);
+    uint8_t mapq = mapping_user->mapq;
+    for (size_t start = 0; start < batch.size; start += MAPPING_DRAFT_BATCH)
+    {
+        size_t end = hMin(batch.size, start + MAPPING_DRAFT_BATCH);
+        //Select the reads by the map quality and references, the index is always written and only kept when passed.
+        size_t kept = 0;
+        for (size_t i = start; i < end; ++i)
+        {
+            selected[kept] = i;
+            kept += (batch.mapq[i] >= mapq) & (batch.mapq[i] != 255) &
+                (static_cast<uint32_t>(batch.refID[i]) < n_refs) & (static_cast<uint32_t>(batch.next_refID[i]) < n_refs);
+        }
+        //Map the references to the contigs, drop the invalid contigs.
+        size_t valid = 0;
+        for (size_t k = 0; k < kept; ++k)
+        {
+            size_t i = selected[k];
+            int32_t ref_index = mapping_user->contig_id_map[batch.refID[i]],
+                next_ref_index = mapping_user->contig_id_map[batch.next_refID[i]];
+            selected[valid] = i;
+            ref_indices[valid] = ref_index;
+            next_ref_indices[valid] = next_ref_index;
+            valid += (ref_index != -1) & (next_ref_index != -1);
+        }
+        //Keep the reads whose both mates are in the enzyme ranges.
+        size_t paired = 0;
+        for (size_t k = 0; k < valid; ++k)
+        {
+            size_t i = selected[k];
+            selected[paired] = i;
+            ref_indices[paired] = ref_indices[k];
+            next_ref_indices[paired] = next_ref_indices[k];
+            paired += position_in_range(batch.pos[i], mapping_user->contig_ranges[ref_indices[k]]) &
+                position_in_range(batch.next_pos[i], mapping_user->contig_ranges[next_ref_indices[k]]);
+        }
+        //Pair the reads.
+        for (size_t k = 0; k < paired; ++k)
+        {
+            size_t i = selected[k];
+            mapping_draft_pair(mapping_user, ref_indices[k], batch.pos[i], next_ref_indices[k], batch.next_pos[i]);
+        }
+    }
+}
+
+void* mapping_draft_shard_create(void* user)
+{
+    MAPPING_DRAFT_USER* mapping_user = reinterpret_cast<MAPPING_DRAFT_USER*>(user);
+    //Share the contig information, but use separated records, contig id map and buffer.
+    int32_t* contig_id_map = NULL;
+    if (mapping_user->contig_id_map)
+    {
+        contig_id_map = new int32_t[mapping_user->contig_idx];
+        memcpy(contig_id_map, mapping_user->contig_id_map, sizeof(int32_t) * mapping_user->contig_idx);
+    }
+    MAPPING_DRAFT_USER* shard_user = new MAPPING_DRAFT_USER{ READ_RECORD(), mapping_user->contig_ids, mapping_user->invalid_ids, mapping_user->contig_ranges,
+        contig_id_map, mapping_user->contig_idx, RAW_EDGE_MAP(), mapping_user->reads_writer, mapping_user->mapq,
+        static_cast<char*>(malloc(MAPPING_OUTPUT_SIZE)), 0, MAPPING_OUTPUT_SIZE };
+    return shard_user;
+}
+
+void mapping_draft_shard_merge(void* shard_user, void* user)
+{
+    MAPPING_DRAFT_USER* mapping_user = reinterpret_cast<MAPPING_DRAFT_USER*>(user),
+        * shard = reinterpret_cast<MAPPING_DRAFT_USER*>(shard_user);
+    //Flush the reads in shard buffer.
+    if (shard->output_offset)
+    {
+        hmr_writer_write(shard->reads_writer, shard->output_buffer, shard->output_offset);
+    }
+    free(shard->output_buffer);
+    delete[] shard->contig_id_map;
+    //Merge the edge counters.
+    for (auto& edge_counter : shard->edges)
+    {
+        mapping_user->edges[edge_counter.first] += edge_counter.second;
+    }
+    delete shard;
+}
+
 std::vector<HMR_EDGE_WEIGHT> mapping_draft_get_edge_weights(const RAW_EDGE_MAP& edge_map, const ENZYME_RANGES* ranges)
 {
     std::vector<HMR_EDGE_WEIGHT> weights;
@@ -7,6 +7,9 @@
 void mapping_draft_n_contig(uint32_t n_ref, void* user);
 void mapping_draft_contig(uint32_t name_length, char* name, uint32_t length, void* user);
 void mapping_draft_read_align(size_t id, const MAPPING_INFO& mapping_info, void* user);
+void mapping_draft_read_batch(const MAPPING_BATCH& batch, void* user);
+void* mapping_draft_shard_create(void* user);
+void mapping_draft_shard_merge(void* shard_user, void* user);
 
 std::vector<HMR_EDGE_WEIGHT> mapping_draft_get_edge_weights(const RAW_EDGE_MAP &edge_map, const ENZYME_RANGES* ranges);
 
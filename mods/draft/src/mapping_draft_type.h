@@ -4,6 +4,7 @@
 #include <unordered_map>
 
 #include "hmr_contig_graph_type.h"
+#include "hmr_writer.h"
 
 typedef std::unordered_map<std::string, int32_t> CONTIG_ID_MAP;
 typedef std::unordered_map<uint64_t, uint64_t> RAW_EDGE_MAP;
@@ -17,7 +18,24 @@ typedef union MAPPING_READ
     uint64_t data;
 } MAPPING_READ;
 
-typedef std::unordered_map<uint64_t, MAPPING_READ> READ_RECORD;
+//The positions of both reads in a pair, ordered by the read data.
+typedef struct MAPPING_PAIR
+{
+    uint64_t low, high;
+    bool operator==(const MAPPING_PAIR& other) const { return low == other.low && high == other.high; }
+} MAPPING_PAIR;
+
+typedef struct MAPPING_PAIR_HASH
+{
+    size_t operator()(const MAPPING_PAIR& pair) const
+    {
+        uint64_t h = (pair.low * 0x9E3779B97F4A7C15ULL) ^ pair.high;
+        return static_cast<size_t>(h ^ (h >> 32));
+    }
+} MAPPING_PAIR_HASH;
+
+//The pair and the position of the read which is waiting for its mate.
+typedef std::unordered_map<MAPPING_PAIR, MAPPING_READ, MAPPING_PAIR_HASH> READ_RECORD;
 
 typedef struct MAPPING_DRAFT_USER
 {
@@ -28,7 +46,7 @@ typedef struct MAPPING_DRAFT_USER
     int32_t *contig_id_map;
     int32_t contig_idx;
     RAW_EDGE_MAP edges;
-    FILE* reads_file;
+    HMR_WRITER* reads_writer;
     uint8_t mapq;
     char* output_buffer;
     size_t output_offset, output_size;
@@ -2,6 +2,8 @@
 #include <queue>
 #include <thread>
 
+#include <zlib.h>
+
 #include "hmr_bin_file.h"
 #include "hmr_contig_graph.h"
 #include "hmr_global.h"
@@ -166,25 +168,28 @@ void get_differ(CONTIG_ID_SET& x, CONTIG_ID_SET& y, const CONTIG_ID_SET& interse
 
 void partition_load_edges(const char* filepath, CONTIG_EDGES& edges)
 {
-    //Load the file.
-    FILE* edge_file;
-    if (!bin_open(filepath, &edge_file, "rb"))
+    //Load the file, zlib reads both the BGZF compressed and the plain file.
+    gzFile edge_file = gzopen(filepath, "rb");
+    if (!edge_file)
     {
         time_error(-1, "Failed to read edge file %s", filepath);
     }
     //Read the number of edges.
     HMR_EDGE_WEIGHT edge_weight{};
-    size_t edge_count;
-    fread(&edge_count, sizeof(size_t), 1, edge_file);
+    size_t edge_count = 0;
+    gzread(edge_file, &edge_count, sizeof(size_t));
     for (size_t i = 0; i < edge_count; ++i)
     {
-        fread(&edge_weight, sizeof(HMR_EDGE_WEIGHT), 1, edge_file);
+        if (gzread(edge_file, &edge_weight, sizeof(HMR_EDGE_WEIGHT)) != sizeof(HMR_EDGE_WEIGHT))
+        {
+            time_error(-1, "Failed to read edge file %s, the file is truncated.", filepath);
+        }
         //Increase the record.
         edges[edge_weight.edge.pos.start].push_back(CONTIG_EDGE{ edge_weight.edge.pos.end, edge_weight.weight });
         edges[edge_weight.edge.pos.end].push_back(CONTIG_EDGE{ edge_weight.edge.pos.start, edge_weight.weight });
     }
     //Read and parse the edges.
-    fclose(edge_file);
+    gzclose(edge_file);
 }
 
 void vote_edge(EDGE_VOTER& voter, int32_t x, int32_t y, int32_t host_node)
@@ -1,7 +1,16 @@
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
 
+#include "hmr_bam_index.h"
 #include "hmr_bgzf.h"
 #include "hmr_bin_queue.h"
+#include "hmr_global.h"
+#include "hmr_mapping_shard.h"
 #include "hmr_ui.h"
 
 #include "hmr_bam.h"
@@ -21,10 +30,41 @@ typedef struct BAM_BLOCK_HEADER
     int32_t tlen;
 } BAM_BLOCK_HEADER;
 
-void hmr_bam_read(const char* filepath, MAPPING_PROC proc, void* user, int threads)
+// Chunks waiting for the parsers, per parser.
+#define BAM_PARSE_QUEUE (2)
+
+typedef struct BAM_CHUNK
+{
+    //Complete records in [begin, end) of the slice, the slice is given back to the queue after parsing.
+    char* slice;
+    size_t begin, end;
+    //Block id of the first record in the slice, and the chunk index.
+    size_t id, index;
+    //The record crossing from the last slice is decoded by the dispatcher.
+    bool has_head;
+    MAPPING_SHARD_RECORD head;
+} BAM_CHUNK;
+
+typedef struct BAM_PARSER
+{
+    HMR_BIN_QUEUE* queue;
+    const MAPPING_REF_SET* refs;
+    const std::vector<bool>* ref_enabled;
+    MAPPING_SHARDS* shards;
+    std::deque<BAM_CHUNK> chunks;
+    size_t chunk_limit;
+    bool finish;
+    std::mutex mutex;
+    std::condition_variable push_cv, pop_cv;
+} BAM_PARSER;
+
+inline bool bam_record_selected(const BAM_BLOCK_HEADER* header, const MAPPING_REF_SET* refs, const std::vector<bool>& ref_enabled)
+{
+    return refs == NULL || (static_cast<uint32_t>(header->refID) < ref_enabled.size() && ref_enabled[header->refID]);
+}
+
+uint32_t bam_read_header(HMR_BGZF_HANDLER* bgzf_handler, MAPPING_PROC proc, void* user, const MAPPING_REF_SET* refs, std::vector<bool>& ref_enabled)
 {
-    //Open the .bam file as BGZF file.
-    HMR_BGZF_HANDLER* bgzf_handler = hmr_bgzf_open(filepath, threads);
     //Fetch and check the magic number.
     auto buf = bgzf_handler->buffer;
     auto queue = bgzf_handler->queue;
@@ -35,12 +75,13 @@ void hmr_bam_read(const char* filepath, MAPPING_PROC proc, void* user, int threa
     }
     //Skip the header text.
     uint32_t l_text = hmr_bin_buf_fetch_uint32(buf, queue);
-    char* text = hmr_bin_buf_fetch(buf, queue, l_text);
+    hmr_bin_buf_fetch(buf, queue, l_text);
     //Fetch the n_ref.
     uint32_t n_ref = hmr_bin_buf_fetch_uint32(buf, queue);
     proc.proc_no_of_contig(n_ref, user);
+    ref_enabled.assign(n_ref, refs == NULL);
     //Loop until all the reference are parsed.
-    while (n_ref--)
+    for (uint32_t i = 0; i < n_ref; ++i)
     {
         //Format:
         // [name length] [name] [seq length]
@@ -48,25 +89,298 @@ void hmr_bam_read(const char* filepath, MAPPING_PROC proc, void* user, int threa
         uint32_t l_name = hmr_bin_buf_fetch_uint32(buf, queue);
         char* name = hmr_bin_buf_fetch(buf, queue, l_name);
         uint32_t l_ref = hmr_bin_buf_fetch_uint32(buf, queue);
+        if (refs)
+        {
+            ref_enabled[i] = refs->find(std::string(name, l_name - 1)) != refs->end();
+        }
         proc.proc_contig(l_name - 1, name, l_ref, user);
     }
-    //Fetch the rest of the data (align data).
-    char* block_size_data = hmr_bin_buf_fetch(buf, queue, 4);
+    return n_ref;
+}
+
+HMR_BGZF_HANDLER* bam_open_indexed(const char* filepath, MAPPING_PROC proc, void* user, int threads, const MAPPING_REF_SET* refs, std::vector<bool>& ref_enabled, HMR_BGZF_WORKERS* workers)
+{
+    //Check whether the reads of the references could be fetched by index.
+    HMR_BAM_INDEX index;
+    if (!hmr_bam_index_load(filepath, index))
+    {
+        return NULL;
+    }
+    //The header is stored before the first chunk of all the references.
+    uint64_t data_start = UINT64_MAX;
+    for (const HMR_BGZF_CHUNKS& chunks : index)
+    {
+        if (!chunks.empty())
+        {
+            data_start = hMin(data_start, chunks.front().begin);
+        }
+    }
+    if (data_start == UINT64_MAX)
+    {
+        return NULL;
+    }
+    HMR_BGZF_CHUNKS header_chunks = { HMR_BGZF_CHUNK{ 0, data_start } };
+    HMR_BGZF_HANDLER* bgzf_handler = hmr_bgzf_open(filepath, 1, &header_chunks, workers);
+    uint32_t n_ref = bam_read_header(bgzf_handler, proc, user, refs, ref_enabled);
+    hmr_bgzf_close(bgzf_handler);
+    if (n_ref != index.size())
+    {
+        time_error(-1, "BAM index does not match the references of %s", filepath);
+    }
+    //Collect the chunks of the selected references.
+    HMR_BGZF_CHUNKS chunks;
+    size_t selected = 0;
+    for (uint32_t i = 0; i < n_ref; ++i)
+    {
+        if (ref_enabled[i])
+        {
+            chunks.insert(chunks.end(), index[i].begin(), index[i].end());
+            ++selected;
+        }
+    }
+    std::sort(chunks.begin(), chunks.end(), [](const HMR_BGZF_CHUNK& a, const HMR_BGZF_CHUNK& b) { return a.begin < b.begin; });
+    time_print("Loading reads of %zu reference(s) by index.", selected);
+    return hmr_bgzf_open(filepath, threads, &chunks, workers);
+}
+
+template <typename T>
+void bam_read_records(HMR_BGZF_HANDLER* bgzf_handler, const MAPPING_REF_SET* refs, const std::vector<bool>& ref_enabled, T proc_read)
+{
+    auto buf = bgzf_handler->buffer;
+    auto queue = bgzf_handler->queue;
     size_t block_id = 0;
-    while (block_size_data)
+    while (true)
     {
+        //Walk the records which are complete inside the current slice.
+        char* data = buf->data + buf->offset;
+        size_t residual = buf->size - buf->offset;
+        while (residual >= 4)
+        {
+            uint32_t block_size = *(reinterpret_cast<uint32_t*>(data));
+            if (residual - 4 < block_size)
+            {
+                break;
+            }
+            BAM_BLOCK_HEADER* header = reinterpret_cast<BAM_BLOCK_HEADER*>(data + 4);
+            //Call the process function when the reference is selected.
+            if (bam_record_selected(header, refs, ref_enabled))
+            {
+                proc_read(block_id, header);
+            }
+            ++block_id;
+            data += 4 + block_size;
+            residual -= 4 + block_size;
+        }
+        buf->offset = buf->size - residual;
+        //Fetch the record crossing the slices.
+        char* block_size_data = hmr_bin_buf_fetch(buf, queue, 4);
+        if (!block_size_data)
+        {
+            break;
+        }
         uint32_t block_size = *(reinterpret_cast<uint32_t*>(block_size_data));
-        //Fetch the data of the fetch.
-        char* block_data = hmr_bin_buf_fetch(buf, queue, block_size);
-        //Recast the block data into header.
-        BAM_BLOCK_HEADER* header = reinterpret_cast<BAM_BLOCK_HEADER*>(block_data);
-        //Call the process function.
-        proc.proc_read_align(block_id, MAPPING_INFO {header->refID, header->pos, header->next_refID, header->next_pos, header->mapq}, user);
-        //Increase the block id.
+        BAM_BLOCK_HEADER* header = reinterpret_cast<BAM_BLOCK_HEADER*>(hmr_bin_buf_fetch(buf, queue, block_size));
+        if (bam_record_selected(header, refs, ref_enabled))
+        {
+            proc_read(block_id, header);
+        }
         ++block_id;
-        //Fetch the next block.
-        block_size_data = hmr_bin_buf_fetch(buf, queue, 4);
     }
+}
+
+void bam_parser_push(BAM_PARSER& parser, const BAM_CHUNK& chunk)
+{
+    std::unique_lock<std::mutex> lock(parser.mutex);
+    parser.push_cv.wait(lock, [&parser] { return parser.chunks.size() < parser.chunk_limit; });
+    parser.chunks.push_back(chunk);
+    parser.pop_cv.notify_one();
+}
+
+bool bam_parser_pop(BAM_PARSER* parser, BAM_CHUNK& chunk)
+{
+    std::unique_lock<std::mutex> lock(parser->mutex);
+    parser->pop_cv.wait(lock, [parser] { return !parser->chunks.empty() || parser->finish; });
+    if (parser->chunks.empty())
+    {
+        return false;
+    }
+    chunk = parser->chunks.front();
+    parser->chunks.pop_front();
+    parser->push_cv.notify_one();
+    return true;
+}
+
+void bam_parse_work(BAM_PARSER* parser)
+{
+    //Decode the records of the chunks, and group them by the shards.
+    MAPPING_SHARDS& shards = *parser->shards;
+    std::vector<MAPPING_SHARD_RECORD_LIST> records(shards.size());
+    BAM_CHUNK chunk;
+    while (bam_parser_pop(parser, chunk))
+    {
+        if (chunk.has_head)
+        {
+            records[hmr_mapping_shard_index(chunk.head.info, shards.size())].push_back(chunk.head);
+        }
+        const char* data = chunk.slice + chunk.begin, * data_end = chunk.slice + chunk.end;
+        size_t block_id = chunk.id;
+        while (data < data_end)
+        {
+            uint32_t block_size = *(reinterpret_cast<const uint32_t*>(data));
+            const BAM_BLOCK_HEADER* header = reinterpret_cast<const BAM_BLOCK_HEADER*>(data + 4);
+            if (bam_record_selected(header, parser->refs, *parser->ref_enabled))
+            {
+                MAPPING_INFO info{ header->refID, header->pos, header->next_refID, header->next_pos, header->mapq };
+                records[hmr_mapping_shard_index(info, shards.size())].push_back(MAPPING_SHARD_RECORD{ block_id, info, header->flag });
+            }
+            ++block_id;
+            data += 4 + block_size;
+        }
+        //Give the slice back before waiting for the shards.
+        hmr_bin_queue_release(parser->queue, chunk.slice);
+        hmr_mapping_shard_deliver(shards, chunk.index, records);
+    }
+}
+
+size_t bam_dispatch_chunks(HMR_BGZF_HANDLER* bgzf_handler, BAM_PARSER& parser)
+{
+    //Start from the rest of the slice which holds the header, the slices are owned by the chunks.
+    auto buf = bgzf_handler->buffer;
+    auto queue = bgzf_handler->queue;
+    char* slice = buf->data;
+    size_t size = buf->size, pos = buf->offset;
+    buf->data = NULL;
+    buf->size = 0;
+    buf->offset = 0;
+    if (slice == NULL)
+    {
+        HMR_BIN_SLICE bin_slice = hmr_bin_queue_pop(queue);
+        slice = bin_slice.data;
+        size = bin_slice.data_size;
+    }
+    //Only the record lengths are walked here, the records are decoded by the parsers.
+    std::vector<char> cross;
+    size_t block_id = 0, chunk_index = 0;
+    while (slice)
+    {
+        BAM_CHUNK chunk;
+        chunk.has_head = false;
+        //Complete the record crossing from the last slice.
+        if (!cross.empty())
+        {
+            size_t part = hMin(4 - hMin(cross.size(), static_cast<size_t>(4)), size - pos);
+            cross.insert(cross.end(), slice + pos, slice + pos + part);
+            pos += part;
+            if (cross.size() >= 4)
+            {
+                size_t record_size = 4 + *(reinterpret_cast<const uint32_t*>(cross.data()));
+                part = hMin(record_size - cross.size(), size - pos);
+                cross.insert(cross.end(), slice + pos, slice + pos + part);
+                pos += part;
+                if (cross.size() == record_size)
+                {
+                    const BAM_BLOCK_HEADER* header = reinterpret_cast<const BAM_BLOCK_HEADER*>(cross.data() + 4);
+                    if (bam_record_selected(header, parser.refs, *parser.ref_enabled))
+                    {
+                        chunk.has_head = true;
+                        chunk.head = MAPPING_SHARD_RECORD{ block_id, MAPPING_INFO{ header->refID, header->pos, header->next_refID, header->next_pos, header->mapq }, header->flag };
+                    }
+                    ++block_id;
+                    cross.clear();
+                }
+            }
+        }
+        //Walk the records which are complete inside the slice.
+        chunk.slice = slice;
+        chunk.begin = pos;
+        chunk.id = block_id;
+        if (cross.empty())
+        {
+            while (size - pos >= 4)
+            {
+                uint32_t block_size = *(reinterpret_cast<const uint32_t*>(slice + pos));
+                if (size - pos - 4 < block_size)
+                {
+                    break;
+                }
+                pos += 4 + block_size;
+                ++block_id;
+            }
+            //Keep the record crossing to the next slice.
+            cross.assign(slice + pos, slice + size);
+        }
+        chunk.end = pos;
+        if (chunk.has_head || chunk.end > chunk.begin)
+        {
+            chunk.index = chunk_index++;
+            bam_parser_push(parser, chunk);
+        }
+        else
+        {
+            hmr_bin_queue_release(queue, slice);
+        }
+        //Move to the next slice.
+        HMR_BIN_SLICE bin_slice = hmr_bin_queue_pop(queue);
+        slice = bin_slice.data;
+        size = bin_slice.data_size;
+        pos = 0;
+    }
+    return chunk_index;
+}
+
+void hmr_bam_read(const char* filepath, MAPPING_PROC proc, void* user, int threads, const MAPPING_REF_SET* refs, HMR_BGZF_WORKERS* workers)
+{
+    //Open the .bam file as BGZF file, only load the selected references when possible.
+    std::vector<bool> ref_enabled;
+    HMR_BGZF_HANDLER* bgzf_handler = refs ? bam_open_indexed(filepath, proc, user, threads, refs, ref_enabled, workers) : NULL;
+    if (bgzf_handler == NULL)
+    {
+        if (refs)
+        {
+            time_print("No BAM index found, scanning the entire file.");
+        }
+        bgzf_handler = hmr_bgzf_open(filepath, threads, NULL, workers);
+        bam_read_header(bgzf_handler, proc, user, refs, ref_enabled);
+    }
+    if (threads > 1 && proc.proc_shard_create && proc.proc_shard_merge)
+    {
+        //Parse the record-aligned chunks in parallel, the shards process the records in the order of the chunks.
+        MAPPING_SHARDS shards;
+        hmr_mapping_shard_start_ordered(shards, proc, user, threads, static_cast<size_t>(threads) * (BAM_PARSE_QUEUE + 2));
+        BAM_PARSER parser;
+        parser.queue = bgzf_handler->queue;
+        parser.refs = refs;
+        parser.ref_enabled = &ref_enabled;
+        parser.shards = &shards;
+        parser.chunk_limit = static_cast<size_t>(threads) * BAM_PARSE_QUEUE;
+        parser.finish = false;
+        std::vector<std::thread> parsers;
+        for (int i = 0; i < threads; ++i)
+        {
+            parsers.push_back(std::thread(bam_parse_work, &parser));
+        }
+        size_t chunk_total = bam_dispatch_chunks(bgzf_handler, parser);
+        {
+            std::unique_lock<std::mutex> lock(parser.mutex);
+            parser.finish = true;
+            parser.pop_cv.notify_all();
+        }
+        for (std::thread& parse_thread : parsers)
+        {
+            parse_thread.join();
+        }
+        hmr_mapping_shard_finish_ordered(shards, proc, user, chunk_total);
+        hmr_bgzf_close(bgzf_handler);
+        return;
+    }
+    //Send the records to the shards, the batch process or the read process.
+    MAPPING_SINK sink;
+    hmr_mapping_sink_start(sink, proc, user, threads);
+    bam_read_records(bgzf_handler, refs, ref_enabled, [&](size_t block_id, const BAM_BLOCK_HEADER* header)
+        {
+            hmr_mapping_sink_push(sink, block_id, MAPPING_INFO{ header->refID, header->pos, header->next_refID, header->next_pos, header->mapq }, header->flag);
+        });
+    hmr_mapping_sink_finish(sink);
     //Close the BGZF file.
     hmr_bgzf_close(bgzf_handler);
 }
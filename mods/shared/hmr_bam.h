@@ -3,6 +3,8 @@
 
 #include "hmr_mapping_type.h"
 
-void hmr_bam_read(const char *filepath, MAPPING_PROC proc, void* user, int threads);
+typedef struct HMR_BGZF_WORKERS HMR_BGZF_WORKERS;
+
+void hmr_bam_read(const char *filepath, MAPPING_PROC proc, void* user, int threads, const MAPPING_REF_SET* refs = NULL, HMR_BGZF_WORKERS* workers = NULL);
 
 #endif // HMR_BAM_H
\ No newline at end of file
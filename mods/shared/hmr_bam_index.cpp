@@ -0,0 +1,185 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#include "hmr_bin_file.h"
+#include "hmr_bin_queue.h"
+#include "hmr_global.h"
+#include "hmr_path.h"
+#include "hmr_ui.h"
+
+#include "hmr_bam_index.h"
+
+typedef struct BAM_INDEX_DATA
+{
+    char* data;
+    size_t size, offset;
+    const char* filepath;
+} BAM_INDEX_DATA;
+
+bool bam_index_load_bai(const char* filepath, BAM_INDEX_DATA& index_data)
+{
+    //The BAI file is not compressed, load the entire file.
+    FILE* bai_file;
+    if (!bin_open(filepath, &bai_file, "rb"))
+    {
+        return false;
+    }
+    size_t reserve = 0;
+    index_data.size = 0;
+    index_data.data = NULL;
+    while (!feof(bai_file))
+    {
+        if (index_data.size == reserve)
+        {
+            reserve = reserve ? (reserve << 1) : (1 << 20);
+            index_data.data = static_cast<char*>(realloc(index_data.data, reserve));
+            if (!index_data.data)
+            {
+                time_error(-1, "No enough memory for loading BAM index %s", filepath);
+            }
+        }
+        index_data.size += fread(index_data.data + index_data.size, 1, reserve - index_data.size, bai_file);
+        if (ferror(bai_file))
+        {
+            time_error(-1, "Failed to read BAM index %s", filepath);
+        }
+    }
+    fclose(bai_file);
+    return true;
+}
+
+bool bam_index_load_csi(const char* filepath, BAM_INDEX_DATA& index_data)
+{
+    //The CSI file is compressed in BGZF, fetch all the decompressed data.
+    if (!path_can_read(filepath))
+    {
+        return false;
+    }
+    HMR_BGZF_HANDLER* bgzf_handler = hmr_bgzf_open(filepath);
+    index_data.size = 0;
+    index_data.data = NULL;
+    HMR_BIN_SLICE slice = hmr_bin_queue_pop(bgzf_handler->queue);
+    while (slice.data)
+    {
+        index_data.data = static_cast<char*>(realloc(index_data.data, index_data.size + slice.data_size));
+        if (!index_data.data)
+        {
+            time_error(-1, "No enough memory for loading BAM index %s", filepath);
+        }
+        memcpy(index_data.data + index_data.size, slice.data, slice.data_size);
+        index_data.size += slice.data_size;
+        hmr_bin_queue_release(bgzf_handler->queue, slice.data);
+        slice = hmr_bin_queue_pop(bgzf_handler->queue);
+    }
+    hmr_bgzf_close(bgzf_handler);
+    return true;
+}
+
+inline char* bam_index_fetch(BAM_INDEX_DATA& index_data, size_t size)
+{
+    if (index_data.size - index_data.offset < size)
+    {
+        time_error(-1, "BAM index %s is truncated.", index_data.filepath);
+    }
+    char* data = index_data.data + index_data.offset;
+    index_data.offset += size;
+    return data;
+}
+
+template <typename T>
+inline T bam_index_fetch_value(BAM_INDEX_DATA& index_data)
+{
+    T value;
+    memcpy(&value, bam_index_fetch(index_data, sizeof(T)), sizeof(T));
+    return value;
+}
+
+void bam_index_parse(BAM_INDEX_DATA& index_data, bool is_csi, HMR_BAM_INDEX& index)
+{
+    //Check the magic number.
+    if (strncmp(bam_index_fetch(index_data, 4), is_csi ? "CSI\1" : "BAI\1", 4))
+    {
+        time_error(-1, "BAM index %s magic string incorrect.", index_data.filepath);
+    }
+    //The pseudo-bin stores the statistics instead of the chunks.
+    uint32_t pseudo_bin = 37450;
+    if (is_csi)
+    {
+        bam_index_fetch_value<int32_t>(index_data);
+        int32_t depth = bam_index_fetch_value<int32_t>(index_data);
+        int32_t l_aux = bam_index_fetch_value<int32_t>(index_data);
+        bam_index_fetch(index_data, l_aux);
+        pseudo_bin = ((1u << ((depth + 1) * 3)) - 1) / 7 + 1;
+    }
+    int32_t n_ref = bam_index_fetch_value<int32_t>(index_data);
+    index.resize(n_ref);
+    for (int32_t i = 0; i < n_ref; ++i)
+    {
+        HMR_BGZF_CHUNKS& chunks = index[i];
+        int32_t n_bin = bam_index_fetch_value<int32_t>(index_data);
+        for (int32_t j = 0; j < n_bin; ++j)
+        {
+            uint32_t bin = bam_index_fetch_value<uint32_t>(index_data);
+            if (is_csi)
+            {
+                //Skip the loffset.
+                bam_index_fetch(index_data, 8);
+            }
+            int32_t n_chunk = bam_index_fetch_value<int32_t>(index_data);
+            for (int32_t k = 0; k < n_chunk; ++k)
+            {
+                uint64_t chunk_beg = bam_index_fetch_value<uint64_t>(index_data);
+                uint64_t chunk_end = bam_index_fetch_value<uint64_t>(index_data);
+                if (bin != pseudo_bin)
+                {
+                    chunks.push_back(HMR_BGZF_CHUNK{ chunk_beg, chunk_end });
+                }
+            }
+        }
+        if (!is_csi)
+        {
+            //Skip the linear index.
+            int32_t n_intv = bam_index_fetch_value<int32_t>(index_data);
+            bam_index_fetch(index_data, static_cast<size_t>(n_intv) << 3);
+        }
+        //Merge the overlapped chunks, so each block is only read once.
+        std::sort(chunks.begin(), chunks.end(), [](const HMR_BGZF_CHUNK& a, const HMR_BGZF_CHUNK& b) { return a.begin < b.begin; });
+        size_t merged = 0;
+        for (size_t j = 0; j < chunks.size(); ++j)
+        {
+            if (merged > 0 && chunks[j].begin <= chunks[merged - 1].end)
+            {
+                chunks[merged - 1].end = hMax(chunks[merged - 1].end, chunks[j].end);
+            }
+            else
+            {
+                chunks[merged++] = chunks[j];
+            }
+        }
+        chunks.resize(merged);
+    }
+}
+
+bool hmr_bam_index_load(const char* bam_path, HMR_BAM_INDEX& index)
+{
+    //Search the index file: <bam>.bai, <bam without suffix>.bai, <bam>.csi
+    std::string bam_file(bam_path);
+    std::string candidates[] = { bam_file + ".bai", path_basename(bam_path) + ".bai", bam_file + ".csi" };
+    for (const std::string& index_path : candidates)
+    {
+        BAM_INDEX_DATA index_data;
+        bool is_csi = path_suffix(index_path.data()) == ".csi";
+        if (!(is_csi ? bam_index_load_csi(index_path.data(), index_data) : bam_index_load_bai(index_path.data(), index_data)))
+        {
+            continue;
+        }
+        time_print("BAM index %s found.", index_path.data());
+        index_data.offset = 0;
+        index_data.filepath = index_path.data();
+        bam_index_parse(index_data, is_csi, index);
+        free(index_data.data);
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,11 @@
+#ifndef HMR_BAM_INDEX_H
+#define HMR_BAM_INDEX_H
+
+#include "hmr_bgzf.h"
+
+//The merged chunks of each reference, indexed by the reference id.
+typedef std::vector<HMR_BGZF_CHUNKS> HMR_BAM_INDEX;
+
+bool hmr_bam_index_load(const char* bam_path, HMR_BAM_INDEX& index);
+
+#endif // HMR_BAM_INDEX_H
\ No newline at end of file
@@ -1,15 +1,22 @@
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+
 #include <zlib.h>
 
 #include "hmr_bin_file.h"
 #include "hmr_bin_queue.h"
+#include "hmr_deflate.h"
+#include "hmr_inflate.h"
+#include "hmr_read_ahead.h"
 #include "hmr_ui.h"
 #include "hmr_thread_pool.h"
 #include "hmr_global.h"
 
 #include "hmr_bgzf.h"
 
-#define WORK_PER_THREAD (512)
+// Blocks claimed by a worker at once.
+#define CLAIM_BLOCKS (4)
 
 typedef struct BGZF_HEADER
 {
@@ -38,223 +45,551 @@ typedef struct BGZF_FOOTER
 
 typedef struct HMR_BGZF_DECOMPRESS
 {
-    char* cdata;
+    const char* cdata;
     uint16_t cdata_size;
     size_t offset;
     size_t raw_size;
+    uint32_t isize, skip;
 } HMR_BGZF_DECOMPRESS;
 
-typedef struct BGZF_UNPACK_PARAM
+typedef struct BGZF_BATCH
 {
-    int id;
-    bool finished;
-    int32_t max_work;
-    HMR_BGZF_DECOMPRESS* pool;
+    HMR_BGZF_DECOMPRESS* blocks;
+    char* cdata_pool;
     char* bgzf_raw;
-    int32_t *worker_completed;
-} BGZF_UNPACK_PARAM;
+    size_t cdata_used, cdata_end, raw_size;
+    int32_t filled, claimed, completed;
+    bool sealed;
+} BGZF_BATCH;
+
+typedef struct BGZF_PIPELINE
+{
+    BGZF_BATCH* batches;
+    //Blocks in one batch, the output slice of a batch is a queue buffer.
+    int32_t window, batch_blocks;
+    //Batch index (not wrapped) of the oldest unsent batch and the next batch.
+    size_t head, tail;
+    bool reader_done;
+    //The mutex and the work condition are shared with the workers.
+    std::mutex* mutex;
+    std::condition_variable* work_cv;
+    std::condition_variable emit_cv, space_cv;
+    HMR_BIN_QUEUE* queue;
+    HMR_BIN_MAP* map;
+    size_t map_released;
+} BGZF_PIPELINE;
+
+typedef struct HMR_BGZF_WORKERS
+{
+    std::mutex mutex;
+    std::condition_variable work_cv;
+    //The pipelines of the opened files, and the pipeline to claim from first.
+    std::vector<BGZF_PIPELINE*> pipelines;
+    size_t next;
+    bool closed;
+    //Batch window of each file, sized by the share of the workers for a file.
+    int threads, window;
+    std::thread* workers;
+} HMR_BGZF_WORKERS;
+
+typedef struct BGZF_INPUT
+{
+    HMR_READ_AHEAD* reader;
+    HMR_BIN_MAP* map;
+    char* subfield_buf;
+    size_t offset, size;
+} BGZF_INPUT;
+
+inline BGZF_BATCH& bgzf_batch_at(BGZF_PIPELINE* pipeline, size_t index)
+{
+    return pipeline->batches[index % pipeline->window];
+}
+
+inline bool bgzf_batch_complete(const BGZF_BATCH& batch)
+{
+    return batch.sealed && batch.completed == batch.filled;
+}
+
+bool bgzf_claim_work(BGZF_PIPELINE* pipeline, size_t& batch_id, int32_t& start, int32_t& end)
+{
+    //Always claim from the oldest batch first, so the emitter could send it sooner.
+    for (size_t i = pipeline->head; i < pipeline->tail; ++i)
+    {
+        BGZF_BATCH& batch = bgzf_batch_at(pipeline, i);
+        if (batch.claimed < batch.filled)
+        {
+            batch_id = i;
+            start = batch.claimed;
+            end = hMin(batch.filled, start + CLAIM_BLOCKS);
+            batch.claimed = end;
+            return true;
+        }
+    }
+    return false;
+}
 
-void hmr_bgzf_decompress(std::mutex &mutex, std::mutex& complete_mutex, std::condition_variable &cv, std::condition_variable &join_cv, BGZF_UNPACK_PARAM *param)
+bool bgzf_workers_claim(HMR_BGZF_WORKERS* workers, BGZF_PIPELINE*& pipeline, size_t& batch_id, int32_t& start, int32_t& end)
 {
-    //The thread id and decompress pool would never changed.
-    const int id = param->id;
-    HMR_BGZF_DECOMPRESS* pool = param->pool;
+    //Take turns between the files, so a file could not hold all the workers.
+    size_t n_pipelines = workers->pipelines.size();
+    for (size_t i = 0; i < n_pipelines; ++i)
+    {
+        size_t pipeline_id = (workers->next + i) % n_pipelines;
+        if (bgzf_claim_work(workers->pipelines[pipeline_id], batch_id, start, end))
+        {
+            pipeline = workers->pipelines[pipeline_id];
+            workers->next = pipeline_id + 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+void hmr_bgzf_decompress(HMR_BGZF_WORKERS* workers)
+{
+    //The decoder state is kept for all the blocks of this worker.
+    HMR_INFLATE* inflater = hmr_inflate_create();
+    char* block_buf = NULL;
+    BGZF_PIPELINE* pipeline = NULL;
+    size_t batch_id;
+    int32_t start, end;
     while (true)
     {
-        //Keep wait.
-        std::unique_lock<std::mutex> lock(mutex);
-        cv.wait(lock);
-        if (param->finished)
+        //Wait until there are blocks to decompress, or nothing more will come.
+        BGZF_BATCH* batch;
         {
-            break;
+            bool claimed = false;
+            std::unique_lock<std::mutex> lock(workers->mutex);
+            workers->work_cv.wait(lock, [&] {
+                claimed = bgzf_workers_claim(workers, pipeline, batch_id, start, end);
+                return claimed || workers->closed;
+            });
+            if (!claimed)
+            {
+                //Workers are closed and no more blocks could be claimed.
+                break;
+            }
+            batch = &bgzf_batch_at(pipeline, batch_id);
         }
-        //Or else, we have to do the work.
-        char* bgzf_raw = param->bgzf_raw;
-        //Loop and decompress the data.
-        for (int i = id * WORK_PER_THREAD, target = hMin(param->max_work, (id + 1) * WORK_PER_THREAD); i < target; ++i)
+        //Decompress the claimed blocks.
+        char* bgzf_raw = batch->bgzf_raw;
+        for (int32_t i = start; i < end; ++i)
         {
-            z_stream strm;
-            strm.zalloc = Z_NULL;
-            strm.zfree = Z_NULL;
-            strm.opaque = Z_NULL;
-            strm.next_in = reinterpret_cast<Bytef*>(pool[i].cdata);
-            strm.avail_in = pool[i].cdata_size;
-            strm.next_out = reinterpret_cast<Bytef*>(bgzf_raw + pool[i].offset);
-            strm.avail_out = pool[i].raw_size;
-            //Add 32 to enable zlib and gzip decoding with header detection.
-            if (Z_OK != inflateInit2(&strm, -15))
+            HMR_BGZF_DECOMPRESS& block = batch->blocks[i];
+            if (block.skip == 0 && block.raw_size == block.isize)
             {
-                time_error(-1, "Failed to initialize decompressor stream.");
+                if (!hmr_inflate_raw(inflater, block.cdata, block.cdata_size, bgzf_raw + block.offset, block.raw_size))
+                {
+                    time_error(-1, "Failed to decompress BGZF block, the file might be corrupted.");
+                }
+                continue;
             }
-            //Decompress the data.
-            int error = inflate(&strm, Z_FULL_FLUSH);
-            //Recover the compress data memory.
-            free(pool[i].cdata);
-            //Close the zlib stream.
-            inflateEnd(&strm);
+            //Only part of the block is needed, decompress the whole block aside.
+            if (block_buf == NULL)
+            {
+                block_buf = static_cast<char*>(malloc(BGZF_MAX_BLOCK));
+                assert(block_buf);
+            }
+            if (!hmr_inflate_raw(inflater, block.cdata, block.cdata_size, block_buf, block.isize))
+            {
+                time_error(-1, "Failed to decompress BGZF block, the file might be corrupted.");
+            }
+            memcpy(bgzf_raw + block.offset, block_buf + block.skip, block.raw_size);
         }
-        //Okay, mission complete, increase the counter.
+        //Report the completion.
         {
-            std::unique_lock<std::mutex> counter_lock(complete_mutex);
-            ++(*param->worker_completed);
-            //Notify the join cv.
-            join_cv.notify_one();
+            std::unique_lock<std::mutex> lock(workers->mutex);
+            batch->completed += end - start;
+            if (batch_id == pipeline->head && bgzf_batch_complete(*batch))
+            {
+                pipeline->emit_cv.notify_one();
+            }
         }
     }
+    free(block_buf);
+    hmr_inflate_free(inflater);
 }
 
-void hmr_bgzf_parse(FILE* bgzf_file, HMR_BIN_QUEUE* queue, int threads)
+void hmr_bgzf_emit(BGZF_PIPELINE* pipeline)
 {
-    //Get the total file size.
-    fseek(bgzf_file, 0L, SEEK_END);
-#ifdef _MSC_VER
-    size_t total_size = _ftelli64(bgzf_file);
-#else
-    size_t total_size = ftello64(bgzf_file);
-#endif
-    fseek(bgzf_file, 0L, SEEK_SET);
-    //For UI output.
-    size_t report_size = (total_size + 9) / 10, report_pos = report_size;
-    //Prepare the decompression buffer.
-    size_t block_offset = 0;
-    BGZF_HEADER header_buf;
-    BGZF_FOOTER footer_buf;
-    int32_t buf_size = WORK_PER_THREAD * threads, buf_used = 0;
-    HMR_BGZF_DECOMPRESS* bgzf_buf = static_cast<HMR_BGZF_DECOMPRESS*>(malloc(sizeof(HMR_BGZF_DECOMPRESS) * buf_size));
-    //Create the working pool.
-    int32_t worker_completed = 0;
-    std::mutex worker_complete_mutex;
-    std::mutex* worker_mutex = new std::mutex[threads], join_mutex;
-    std::condition_variable *worker_cv = new std::condition_variable[threads], join_cv;
-    std::thread* workers = new std::thread[threads];
-    BGZF_UNPACK_PARAM* worker_params = new BGZF_UNPACK_PARAM[threads];
-    for (int32_t i = 0; i < threads; ++i)
-    {
-        worker_params[i] = BGZF_UNPACK_PARAM { i , false, buf_size, bgzf_buf, NULL, &worker_completed };
-        workers[i] = std::thread(hmr_bgzf_decompress, std::ref(worker_mutex[i]), std::ref(worker_complete_mutex), std::ref(worker_cv[i]), std::ref(join_cv), & worker_params[i]);
-    }
-    //hmr::thread_pool<BGZF_UNPACK_PARAM> unpacker(hmr_bgzf_decompress, threads, threads);
-    //Read while to the end of the file.
-    while (!queue->finish && fread(&header_buf, sizeof(BGZF_HEADER), 1, bgzf_file) > 0)
-    {
-        //Read the Xlen data.
-        char* subfield_data = static_cast<char*>(malloc(header_buf.XLEN));
-        //Read the data.
-        fread(subfield_data, header_buf.XLEN, 1, bgzf_file);
-        //Go through the header.
-        uint16_t subfield_left = header_buf.XLEN, bsize = 0;
-        char* subfield_pos = subfield_data;
-        while (subfield_left > 0)
+    HMR_BIN_QUEUE* queue = pipeline->queue;
+    while (true)
+    {
+        //Wait for the oldest batch to be fully decompressed.
+        BGZF_BATCH* batch;
         {
-            BGZF_SUB_HEADER* subfield = reinterpret_cast<BGZF_SUB_HEADER*>(subfield_pos);
-            //Check the ID matches the bsize.
-            if (subfield->SI1 == 66 && subfield->SI2 == 67 && subfield->SLEN == 2)
+            std::unique_lock<std::mutex> lock(*pipeline->mutex);
+            pipeline->emit_cv.wait(lock, [pipeline] {
+                return (pipeline->head < pipeline->tail && bgzf_batch_complete(bgzf_batch_at(pipeline, pipeline->head))) ||
+                    (pipeline->reader_done && pipeline->head == pipeline->tail);
+            });
+            if (pipeline->head == pipeline->tail)
             {
-                bsize = *(reinterpret_cast<uint16_t*>(subfield_pos + sizeof(BGZF_SUB_HEADER)));
+                break;
             }
-            subfield_pos += subfield->SLEN + sizeof(BGZF_SUB_HEADER);
-            subfield_left -= subfield->SLEN + sizeof(BGZF_SUB_HEADER);
+            batch = &bgzf_batch_at(pipeline, pipeline->head);
         }
-        free(subfield_data);
-        uint16_t cdata_size = bsize - header_buf.XLEN - 19;
-        char* cdata = static_cast<char*>(malloc(cdata_size));
-        //Reading the compressed data.
-        assert(cdata);
-        fread(cdata, cdata_size, 1, bgzf_file);
-        //Fetch the footer data.
-        fread(&footer_buf, sizeof(BGZF_FOOTER), 1, bgzf_file);
-        //Buffer until reach the decompress limit.
-        bgzf_buf[buf_used] = HMR_BGZF_DECOMPRESS{ cdata, cdata_size, block_offset, footer_buf.ISIZE };
-        ++buf_used;
-        //Increase the block offset, and keep going.
-        block_offset += footer_buf.ISIZE;
-        //Check whether we are reaching the decompression limitation.
-        if (buf_used == buf_size)
+        //Push the data to the parsing queue, unless the consumer gives up.
+        if (batch->raw_size > 0 && !queue->finish)
         {
-            //Create the pool.
-            char* bgzf_raw = static_cast<char*>(malloc(block_offset));
-            //Decompress the data.
-            worker_completed = 0;
-            for (int i = 0; i < threads; ++i)
-            {
-                //Update the bgzf raw for the parameter.
-                worker_params[i].bgzf_raw = bgzf_raw;
-                worker_cv[i].notify_one();
-            }
-            //Wait for all the threads complete.
-            {
-                std::unique_lock<std::mutex> join_lock(join_mutex);
-                join_cv.wait(join_lock, [&] { return worker_completed == threads; });
-            }
-            //Push the data to the parsing queue.
-            hmr_bin_queue_push(queue, bgzf_raw, block_offset);
-            //Reset the buffer used.
-            buf_used = 0;
-            block_offset = 0;
+            hmr_bin_queue_push(queue, batch->bgzf_raw, batch->raw_size);
+        }
+        else
+        {
+            hmr_bin_queue_release(queue, batch->bgzf_raw);
+        }
+        batch->bgzf_raw = NULL;
+        //All the compressed data before this batch end is consumed.
+        if (pipeline->map)
+        {
+            bin_map_release(pipeline->map, pipeline->map_released, batch->cdata_end);
+            pipeline->map_released = batch->cdata_end;
+        }
+        //Release the batch slot to the reader.
+        {
+            std::unique_lock<std::mutex> lock(*pipeline->mutex);
+            ++pipeline->head;
+            pipeline->space_cv.notify_one();
+        }
+    }
+}
+
+bool bgzf_read_header(BGZF_INPUT& input, uint16_t& cdata_size)
+{
+    //Fetch the header and the Xlen data.
+    const BGZF_HEADER* header;
+    const char* subfield_data;
+    BGZF_HEADER header_buf;
+    if (input.map)
+    {
+        //Parse the header in place.
+        if (input.offset + sizeof(BGZF_HEADER) > input.size)
+        {
+            return false;
+        }
+        header = reinterpret_cast<const BGZF_HEADER*>(input.map->data + input.offset);
+        subfield_data = input.map->data + input.offset + sizeof(BGZF_HEADER);
+        if (input.offset + sizeof(BGZF_HEADER) + header->XLEN > input.size)
+        {
+            time_error(-1, "Truncated BGZF block header found.");
+        }
+    }
+    else
+    {
+        if (hmr_read_ahead_read(input.reader, &header_buf, sizeof(BGZF_HEADER)) < sizeof(BGZF_HEADER))
+        {
+            return false;
+        }
+        header = &header_buf;
+        hmr_read_ahead_read(input.reader, input.subfield_buf, header->XLEN);
+        subfield_data = input.subfield_buf;
+    }
+    input.offset += sizeof(BGZF_HEADER) + header->XLEN;
+    //Go through the header.
+    uint16_t subfield_left = header->XLEN, bsize = 0;
+    const char* subfield_pos = subfield_data;
+    while (subfield_left > 0)
+    {
+        const BGZF_SUB_HEADER* subfield = reinterpret_cast<const BGZF_SUB_HEADER*>(subfield_pos);
+        //Check the ID matches the bsize.
+        if (subfield->SI1 == 66 && subfield->SI2 == 67 && subfield->SLEN == 2)
+        {
+            bsize = *(reinterpret_cast<const uint16_t*>(subfield_pos + sizeof(BGZF_SUB_HEADER)));
+        }
+        subfield_pos += subfield->SLEN + sizeof(BGZF_SUB_HEADER);
+        subfield_left -= subfield->SLEN + sizeof(BGZF_SUB_HEADER);
+    }
+    cdata_size = bsize - header->XLEN - 19;
+    return true;
+}
+
+const char* bgzf_read_cdata(BGZF_INPUT& input, uint16_t cdata_size, char* cdata_buf, BGZF_FOOTER& footer)
+{
+    const char* cdata;
+    if (input.map)
+    {
+        //Use the compressed data from the mapping directly.
+        if (input.offset + cdata_size + sizeof(BGZF_FOOTER) > input.size)
+        {
+            time_error(-1, "Truncated BGZF block data found.");
         }
-        //Check should we report the position.
+        cdata = input.map->data + input.offset;
+        memcpy(&footer, cdata + cdata_size, sizeof(BGZF_FOOTER));
+    }
+    else
+    {
+        hmr_read_ahead_read(input.reader, cdata_buf, cdata_size);
+        hmr_read_ahead_read(input.reader, &footer, sizeof(BGZF_FOOTER));
+        cdata = cdata_buf;
+    }
+    input.offset += cdata_size + sizeof(BGZF_FOOTER);
+    return cdata;
+}
+
+void bgzf_seek(BGZF_INPUT& input, size_t offset)
+{
+    if (!input.map)
+    {
+        hmr_read_ahead_seek(input.reader, offset);
+    }
+    input.offset = offset;
+}
+
+void hmr_bgzf_parse(FILE* bgzf_file, HMR_BIN_MAP* bgzf_map, HMR_BIN_QUEUE* queue, HMR_BGZF_WORKERS* workers, HMR_BGZF_CHUNKS chunks)
+{
+    //Prepare the input, get the total file size.
+    BGZF_INPUT input{ NULL, NULL, NULL, 0, 0 };
+    if (bgzf_map->data)
+    {
+        input.map = bgzf_map;
+        input.size = bgzf_map->size;
+    }
+    else
+    {
+        input.subfield_buf = static_cast<char*>(malloc(UINT16_MAX));
+        assert(input.subfield_buf);
+        fseek(bgzf_file, 0L, SEEK_END);
 #ifdef _MSC_VER
-        size_t bgzf_pos = _ftelli64(bgzf_file);
+        input.size = _ftelli64(bgzf_file);
 #else
-        size_t bgzf_pos = ftello64(bgzf_file);
+        input.size = ftello64(bgzf_file);
 #endif
-        if (bgzf_pos >= report_pos)
+        fseek(bgzf_file, 0L, SEEK_SET);
+        //Keep the reads in flight ahead of the block parsing.
+        input.reader = hmr_read_ahead_open(bgzf_file);
+    }
+    //When no chunk is specified, the whole file is a chunk.
+    size_t total_size = input.size;
+    if (chunks.empty())
+    {
+        chunks.push_back(HMR_BGZF_CHUNK{ 0, UINT64_MAX });
+    }
+    else
+    {
+        total_size = 0;
+        for (const HMR_BGZF_CHUNK& chunk : chunks)
         {
-            float percent = static_cast<float>(bgzf_pos) / static_cast<float>(total_size) * 100.0f;
-            time_print("BGZF parsed %.1f%%", percent);
-            report_pos += report_size;
+            total_size += hMin(static_cast<size_t>(chunk.end >> 16), input.size) - (chunk.begin >> 16);
         }
     }
-    //Check whether we still have data left.
-    if (buf_used > 0)
+    //For UI output.
+    size_t parsed_size = 0, report_size = (total_size + 9) / 10, report_pos = report_size;
+    //Prepare the batch window, keep every worker busy while the emitter waits.
+    BGZF_PIPELINE pipeline;
+    pipeline.window = workers->window;
+    pipeline.batch_blocks = static_cast<int32_t>(queue->buffer_size / BGZF_MAX_BLOCK);
+    pipeline.batches = new BGZF_BATCH[pipeline.window];
+    for (int32_t i = 0; i < pipeline.window; ++i)
     {
-        //Create the pool.
-        char* bgzf_raw = static_cast<char*>(malloc(block_offset));
-        //Decompress the data.
-        worker_completed = 0;
-        for (int i = 0; i < threads; ++i)
+        pipeline.batches[i].blocks = static_cast<HMR_BGZF_DECOMPRESS*>(malloc(sizeof(HMR_BGZF_DECOMPRESS) * pipeline.batch_blocks));
+        //Mapped file is used as the compressed data directly.
+        pipeline.batches[i].cdata_pool = input.map ? NULL : static_cast<char*>(malloc(pipeline.batch_blocks * BGZF_MAX_BLOCK));
+        assert(pipeline.batches[i].blocks && (input.map || pipeline.batches[i].cdata_pool));
+    }
+    pipeline.head = 0;
+    pipeline.tail = 0;
+    pipeline.reader_done = false;
+    pipeline.queue = queue;
+    pipeline.map = input.map;
+    pipeline.map_released = 0;
+    pipeline.mutex = &workers->mutex;
+    pipeline.work_cv = &workers->work_cv;
+    //Attach to the decompress workers, and start the ordered emitter.
+    {
+        std::unique_lock<std::mutex> lock(workers->mutex);
+        workers->pipelines.push_back(&pipeline);
+    }
+    std::thread emitter(hmr_bgzf_emit, &pipeline);
+    //Read all the blocks of the chunks.
+    BGZF_FOOTER footer_buf;
+    BGZF_BATCH* batch = NULL;
+    int32_t batch_used = 0;
+    uint16_t cdata_size;
+    for (const HMR_BGZF_CHUNK& chunk : chunks)
+    {
+        //Virtual offset: compressed block offset << 16 | offset inside the block.
+        size_t block_begin = chunk.begin >> 16, block_end = chunk.end >> 16;
+        uint32_t skip_begin = chunk.begin & 0xFFFF, keep_end = chunk.end & 0xFFFF;
+        if (input.offset != block_begin)
         {
-            //Update the bgzf raw for the parameter.
-            worker_params[i].max_work = buf_used;
-            worker_params[i].bgzf_raw = bgzf_raw;
-            worker_cv[i].notify_one();
+            bgzf_seek(input, block_begin);
         }
-        //Wait for all the threads complete.
+        while (!queue->finish)
         {
-            std::unique_lock<std::mutex> join_lock(join_mutex);
-            join_cv.wait(join_lock, [&] { return worker_completed == threads; });
+            //Check whether the chunk end is reached.
+            size_t block_start = input.offset;
+            if (block_start > block_end || (block_start == block_end && keep_end == 0) || !bgzf_read_header(input, cdata_size))
+            {
+                break;
+            }
+            //Open a new batch when necessary, wait for a free slot in the window.
+            if (batch == NULL)
+            {
+                std::unique_lock<std::mutex> lock(workers->mutex);
+                pipeline.space_cv.wait(lock, [&] { return pipeline.tail - pipeline.head < static_cast<size_t>(pipeline.window); });
+                batch = &bgzf_batch_at(&pipeline, pipeline.tail);
+                batch->bgzf_raw = hmr_bin_queue_alloc(queue);
+                batch->cdata_used = 0;
+                batch->raw_size = 0;
+                batch->filled = 0;
+                batch->claimed = 0;
+                batch->completed = 0;
+                batch->sealed = false;
+                ++pipeline.tail;
+                batch_used = 0;
+            }
+            //Reading the compressed data and the footer.
+            const char* cdata = bgzf_read_cdata(input, cdata_size, batch->cdata_pool + batch->cdata_used, footer_buf);
+            batch->cdata_used += cdata_size;
+            batch->cdata_end = input.offset;
+            //Append the block to the batch, and increase the block offset.
+            //Only keep the part of block inside the chunk.
+            uint32_t skip = (block_start == block_begin) ? hMin(skip_begin, footer_buf.ISIZE) : 0,
+                keep = (block_start == block_end) ? hMin(keep_end, footer_buf.ISIZE) : footer_buf.ISIZE;
+            size_t raw_size = (keep > skip) ? (keep - skip) : 0;
+            batch->blocks[batch_used] = HMR_BGZF_DECOMPRESS{ cdata, cdata_size, batch->raw_size, raw_size, footer_buf.ISIZE, skip };
+            ++batch_used;
+            batch->raw_size += raw_size;
+            //Publish the blocks to the workers once a claim is ready.
+            if (batch_used == pipeline.batch_blocks || batch_used % CLAIM_BLOCKS == 0)
+            {
+                std::unique_lock<std::mutex> lock(workers->mutex);
+                batch->filled = batch_used;
+                if (batch_used == pipeline.batch_blocks)
+                {
+                    batch->sealed = true;
+                    batch = NULL;
+                    //The blocks might be already completed.
+                    pipeline.emit_cv.notify_one();
+                }
+                workers->work_cv.notify_all();
+            }
+            //Check should we report the position.
+            parsed_size += input.offset - block_start;
+            if (parsed_size >= report_pos)
+            {
+                float percent = hMin(static_cast<float>(parsed_size) / static_cast<float>(total_size) * 100.0f, 100.0f);
+                time_print("BGZF parsed %.1f%%", percent);
+                report_pos += report_size;
+            }
         }
-        //Push the data to the parsing queue.
-        hmr_bin_queue_push(queue, bgzf_raw, block_offset);
     }
-    //Let the workers complete their jobs.
-    for (int i = 0; i < threads; ++i)
+    //Seal the last batch, and let the workers complete their jobs.
+    {
+        std::unique_lock<std::mutex> lock(workers->mutex);
+        if (batch != NULL)
+        {
+            batch->filled = batch_used;
+            batch->sealed = true;
+        }
+        pipeline.reader_done = true;
+        workers->work_cv.notify_all();
+        pipeline.emit_cv.notify_one();
+    }
+    //All the blocks are decompressed once the emitter is done, detach from the workers.
+    emitter.join();
+    {
+        std::unique_lock<std::mutex> lock(workers->mutex);
+        workers->pipelines.erase(std::find(workers->pipelines.begin(), workers->pipelines.end(), &pipeline));
+    }
+    //Free the batch window.
+    for (int32_t i = 0; i < pipeline.window; ++i)
     {
-        worker_params[i].finished = true;
-        worker_cv[i].notify_one();
-        workers[i].join();
+        free(pipeline.batches[i].blocks);
+        free(pipeline.batches[i].cdata_pool);
+    }
+    delete[] pipeline.batches;
+    free(input.subfield_buf);
+    if (input.reader)
+    {
+        hmr_read_ahead_close(input.reader);
     }
-    delete[] workers;
     //Mark BGZF parsing complete.
     hmr_bin_queue_finish(queue);
 }
 
-HMR_BGZF_HANDLER* hmr_bgzf_open(const char* filepath, int threads)
+bool hmr_bgzf_detect(const char* filepath)
+{
+    //Check the GZIP header has the BGZF block size extra subfield.
+    FILE* bgzf_file;
+    if (!bin_open(filepath, &bgzf_file, "rb"))
+    {
+        return false;
+    }
+    BGZF_HEADER header;
+    char subfield_data[BGZF_MAX_BLOCK];
+    bool is_bgzf = false;
+    if (fread(&header, sizeof(BGZF_HEADER), 1, bgzf_file) == 1 && header.ID1 == 31 && header.ID2 == 139 && header.CM == 8 && (header.FLG & 4) &&
+        fread(subfield_data, 1, header.XLEN, bgzf_file) == header.XLEN)
+    {
+        uint16_t subfield_pos = 0;
+        while (!is_bgzf && subfield_pos + sizeof(BGZF_SUB_HEADER) <= header.XLEN)
+        {
+            const BGZF_SUB_HEADER* subfield = reinterpret_cast<const BGZF_SUB_HEADER*>(subfield_data + subfield_pos);
+            is_bgzf = subfield->SI1 == 66 && subfield->SI2 == 67 && subfield->SLEN == 2;
+            subfield_pos += sizeof(BGZF_SUB_HEADER) + subfield->SLEN;
+        }
+    }
+    fclose(bgzf_file);
+    return is_bgzf;
+}
+
+HMR_BGZF_WORKERS* hmr_bgzf_workers_create(int threads, int files)
+{
+    HMR_BGZF_WORKERS* workers = new HMR_BGZF_WORKERS();
+    workers->next = 0;
+    workers->closed = false;
+    workers->threads = hMax(threads, 1);
+    workers->window = hMax(workers->threads / hMax(files, 1), 1) + 2;
+    workers->workers = new std::thread[workers->threads];
+    for (int i = 0; i < workers->threads; ++i)
+    {
+        workers->workers[i] = std::thread(hmr_bgzf_decompress, workers);
+    }
+    return workers;
+}
+
+void hmr_bgzf_workers_free(HMR_BGZF_WORKERS* workers)
+{
+    //All the files should be closed before the workers.
+    {
+        std::unique_lock<std::mutex> lock(workers->mutex);
+        workers->closed = true;
+        workers->work_cv.notify_all();
+    }
+    for (int i = 0; i < workers->threads; ++i)
+    {
+        workers->workers[i].join();
+    }
+    delete[] workers->workers;
+    delete workers;
+}
+
+HMR_BGZF_HANDLER* hmr_bgzf_open(const char* filepath, int threads, const HMR_BGZF_CHUNKS* chunks, HMR_BGZF_WORKERS* workers)
 {
-    //Read the BGZF file.
+    //Map the BGZF file, or read it as a stream when it could not be mapped.
     HMR_BGZF_HANDLER* bgzf_handler = new HMR_BGZF_HANDLER();
     FILE* bgzf_file = NULL;
-    if (!bin_open(filepath, &bgzf_file, "rb"))
+    if (!bin_map(filepath, &bgzf_handler->bgzf_map))
     {
-        time_error(-1, "Failed to read BGZF file %s\n", filepath);
+        bgzf_handler->bgzf_map = HMR_BIN_MAP{ NULL, 0 };
+        if (!bin_open(filepath, &bgzf_file, "rb"))
+        {
+            time_error(-1, "Failed to read BGZF file %s\n", filepath);
+        }
     }
     bgzf_handler->bgzf_file = bgzf_file;
-    //Allocate the processing queue, 3 for triple buffer.
-    hmr_bin_queue_create(&(bgzf_handler->queue), 3);
+    //Allocate the processing queue, each buffer holds whole BGZF blocks.
+    size_t batch_blocks = hMax(hmr_bin_queue_tuning.buffer_size / BGZF_MAX_BLOCK, static_cast<size_t>(1));
+    hmr_bin_queue_create(&(bgzf_handler->queue), hmr_bin_queue_tuning.depth, batch_blocks * BGZF_MAX_BLOCK);
     //Prepare the buffer.
     hmr_bin_buf_create(&bgzf_handler->buffer);
+    //Use the private workers when the workers are not shared.
+    bgzf_handler->private_workers = workers ? NULL : hmr_bgzf_workers_create(threads);
     //Start the BGZF parsing thread.
-    bgzf_handler->parse_thread = std::thread(hmr_bgzf_parse, bgzf_file, bgzf_handler->queue, threads);
+    bgzf_handler->parse_thread = std::thread(hmr_bgzf_parse, bgzf_file, &bgzf_handler->bgzf_map, bgzf_handler->queue,
+        workers ? workers : bgzf_handler->private_workers,
+        chunks ? *chunks : HMR_BGZF_CHUNKS());
     //Provide the GZIP handler.
     return bgzf_handler;
 }
@@ -268,9 +603,50 @@ void hmr_bgzf_close(HMR_BGZF_HANDLER* bgzf_handler)
     }
     //Wait for parse thread to complete.
     bgzf_handler->parse_thread.join();
+    if (bgzf_handler->private_workers)
+    {
+        hmr_bgzf_workers_free(bgzf_handler->private_workers);
+    }
     //Free the queue and buffer.
-    hmr_bin_buf_free(bgzf_handler->buffer);
+    hmr_bin_buf_free(bgzf_handler->buffer, bgzf_handler->queue);
     hmr_bin_queue_free(bgzf_handler->queue);
     //Close the file.
-    fclose(bgzf_handler->bgzf_file);
+    if (bgzf_handler->bgzf_map.data)
+    {
+        bin_unmap(&bgzf_handler->bgzf_map);
+    }
+    else
+    {
+        fclose(bgzf_handler->bgzf_file);
+    }
+    delete bgzf_handler;
+}
+
+size_t hmr_bgzf_compress(HMR_DEFLATE* deflater, const char* raw, size_t raw_size, char* bgzf)
+{
+    assert(raw_size <= BGZF_BLOCK_DATA);
+    //Block: GZIP header with the block size subfield, raw deflate data and the footer.
+    const size_t header_size = sizeof(BGZF_HEADER) + sizeof(BGZF_SUB_HEADER) + sizeof(uint16_t);
+    char* cdata = bgzf + header_size;
+    size_t cdata_size = hmr_deflate_raw(deflater, raw, raw_size, cdata, BGZF_MAX_BLOCK - header_size - sizeof(BGZF_FOOTER));
+    if (cdata_size == 0)
+    {
+        //Keep the data in a stored deflate block when it could not be compressed.
+        uint16_t stored_size = static_cast<uint16_t>(raw_size), stored_check = static_cast<uint16_t>(~stored_size);
+        cdata[0] = 1;
+        memcpy(cdata + 1, &stored_size, sizeof(uint16_t));
+        memcpy(cdata + 3, &stored_check, sizeof(uint16_t));
+        memcpy(cdata + 5, raw, raw_size);
+        cdata_size = raw_size + 5;
+    }
+    BGZF_HEADER header = { 31, 139, 8, 4, 0, 0, 255, static_cast<uint16_t>(sizeof(BGZF_SUB_HEADER) + sizeof(uint16_t)) };
+    BGZF_SUB_HEADER subfield = { 66, 67, 2 };
+    size_t block_size = header_size + cdata_size + sizeof(BGZF_FOOTER);
+    uint16_t bsize = static_cast<uint16_t>(block_size - 1);
+    memcpy(bgzf, &header, sizeof(BGZF_HEADER));
+    memcpy(bgzf + sizeof(BGZF_HEADER), &subfield, sizeof(BGZF_SUB_HEADER));
+    memcpy(bgzf + sizeof(BGZF_HEADER) + sizeof(BGZF_SUB_HEADER), &bsize, sizeof(uint16_t));
+    BGZF_FOOTER footer = { static_cast<uint32_t>(crc32(0, reinterpret_cast<const Bytef*>(raw), static_cast<uInt>(raw_size))), static_cast<uint32_t>(raw_size) };
+    memcpy(cdata + cdata_size, &footer, sizeof(BGZF_FOOTER));
+    return block_size;
 }
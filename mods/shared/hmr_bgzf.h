@@ -2,20 +2,45 @@
 #define HMR_BGZF_H
 
 #include <cstdio>
+#include <cstdint>
 #include <thread>
+#include <vector>
+
+#include "hmr_bin_file.h"
 
 typedef struct HMR_BIN_QUEUE HMR_BIN_QUEUE;
 typedef struct HMR_BIN_DATA_BUF HMR_BIN_DATA_BUF;
+typedef struct HMR_DEFLATE HMR_DEFLATE;
+typedef struct HMR_BGZF_WORKERS HMR_BGZF_WORKERS;
+
+// BGZF block compressed and uncompressed size limit, and the data size of a written block.
+#define BGZF_MAX_BLOCK (65536)
+#define BGZF_BLOCK_DATA (65280)
+
+typedef struct HMR_BGZF_CHUNK
+{
+    uint64_t begin, end;
+} HMR_BGZF_CHUNK;
+
+typedef std::vector<HMR_BGZF_CHUNK> HMR_BGZF_CHUNKS;
 
 typedef struct HMR_BGZF_HANDLER
 {
     HMR_BIN_QUEUE* queue;
     HMR_BIN_DATA_BUF* buffer;
     FILE* bgzf_file;
+    HMR_BIN_MAP bgzf_map;
+    HMR_BGZF_WORKERS* private_workers;
     std::thread parse_thread;
 } HMR_BGZF_HANDLER;
 
-HMR_BGZF_HANDLER* hmr_bgzf_open(const char* filepath, int threads = 1);
+bool hmr_bgzf_detect(const char* filepath);
+//The decompress workers could be shared by the files opened at the same time.
+HMR_BGZF_WORKERS* hmr_bgzf_workers_create(int threads, int files = 1);
+void hmr_bgzf_workers_free(HMR_BGZF_WORKERS* workers);
+//When the workers are not provided, the file uses its own workers of the threads.
+HMR_BGZF_HANDLER* hmr_bgzf_open(const char* filepath, int threads = 1, const HMR_BGZF_CHUNKS* chunks = NULL, HMR_BGZF_WORKERS* workers = NULL);
 void hmr_bgzf_close(HMR_BGZF_HANDLER* bgzf_handler);
+size_t hmr_bgzf_compress(HMR_DEFLATE* deflater, const char* raw, size_t raw_size, char* bgzf);
 
 #endif // HMR_BGZF_H
\ No newline at end of file
@@ -1,3 +1,10 @@
+#ifndef _MSC_VER
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #include "hmr_bin_file.h"
 
 bool bin_open(const char* filepath, FILE** file, char const* mode)
@@ -18,3 +25,61 @@ bool bin_open(const char* filepath, FILE** file, char const* mode)
     *file = bin_file;
     return true;
 }
+
+bool bin_map(const char* filepath, HMR_BIN_MAP* map, bool sequential)
+{
+#ifdef _MSC_VER
+    //Mapping is not supported, use the stream reading instead.
+    return false;
+#else
+    int fd = open(filepath, O_RDONLY);
+    if (fd == -1)
+    {
+        return false;
+    }
+    //Only regular and non-empty files could be mapped.
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode) || file_stat.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    void* data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //The mapping holds its own reference to the file.
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+    if (sequential)
+    {
+        madvise(data, file_stat.st_size, MADV_SEQUENTIAL);
+    }
+    map->data = static_cast<char*>(data);
+    map->size = file_stat.st_size;
+    return true;
+#endif
+}
+
+void bin_map_release(HMR_BIN_MAP* map, size_t start, size_t end)
+{
+#ifndef _MSC_VER
+    //Drop the pages from the start until the last whole page before end.
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    start = start / page_size * page_size;
+    end = end / page_size * page_size;
+    if (start < end)
+    {
+        madvise(map->data + start, end - start, MADV_DONTNEED);
+    }
+#endif
+}
+
+void bin_unmap(HMR_BIN_MAP* map)
+{
+#ifndef _MSC_VER
+    munmap(map->data, map->size);
+#endif
+    map->data = NULL;
+    map->size = 0;
+}
\ No newline at end of file
@@ -3,6 +3,16 @@
 
 #include <cstdio>
 
+typedef struct HMR_BIN_MAP
+{
+    char* data;
+    size_t size;
+} HMR_BIN_MAP;
+
 bool bin_open(const char* filepath, FILE** file, char const* mode);
 
+bool bin_map(const char* filepath, HMR_BIN_MAP* map, bool sequential = true);
+void bin_map_release(HMR_BIN_MAP* map, size_t start, size_t end);
+void bin_unmap(HMR_BIN_MAP* map);
+
 #endif // HMR_BIN_FILE_H
\ No newline at end of file
@@ -1,11 +1,63 @@
 #include <cassert>
 #include <cstring>
+#include <cstdlib>
+#include <thread>
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
 
 #include "hmr_ui.h"
+#include "hmr_global.h"
 
 #include "hmr_bin_queue.h"
 
-void hmr_bin_queue_create(HMR_BIN_QUEUE **queue, size_t size)
+#define BIN_QUEUE_PAGE (4096)
+#define BIN_QUEUE_SPIN (256)
+
+HMR_BIN_QUEUE_TUNING hmr_bin_queue_tuning = { 3, 4194304 };
+
+char* bin_queue_buffer_create(size_t size)
+{
+    //Allocate the page aligned buffer.
+#ifdef _MSC_VER
+    char* buffer = static_cast<char*>(_aligned_malloc(size, BIN_QUEUE_PAGE));
+#else
+    void* aligned = NULL;
+    char* buffer = posix_memalign(&aligned, BIN_QUEUE_PAGE, size) == 0 ? static_cast<char*>(aligned) : NULL;
+#endif
+    if (!buffer)
+    {
+        time_error(-1, "Failed to allocate binary queue buffer, no enough memory.");
+    }
+    //Touch every page, so the producer never faults on the buffer.
+    for (size_t i = 0; i < size; i += BIN_QUEUE_PAGE)
+    {
+        buffer[i] = 0;
+    }
+    return buffer;
+}
+
+void bin_queue_buffer_destroy(char* buffer)
+{
+#ifdef _MSC_VER
+    _aligned_free(buffer);
+#else
+    free(buffer);
+#endif
+}
+
+void bin_queue_recycle(HMR_BIN_QUEUE* queue, char* data)
+{
+    //Pool mutex should be locked, slices of the queue without pool are freed.
+    if (queue->buffer_size == 0)
+    {
+        free(data);
+        return;
+    }
+    queue->pool_free.push_back(data);
+}
+
+void hmr_bin_queue_create(HMR_BIN_QUEUE **queue, size_t size, size_t buffer_size)
 {
     //Allocate the queue.
     (*queue) = new HMR_BIN_QUEUE();
@@ -19,61 +71,143 @@ void hmr_bin_queue_create(HMR_BIN_QUEUE **queue, size_t size)
     (*queue)->head = 0;
     (*queue)->tail = 0;
     (*queue)->finish = false;
+    (*queue)->force_end = false;
+    (*queue)->pop_waiting = false;
+    (*queue)->push_waiting = false;
+    (*queue)->buffer_size = buffer_size;
 }
 
 void hmr_bin_queue_free(HMR_BIN_QUEUE *queue)
 {
+    //Release the data which are never popped.
+    for(size_t i=queue->head, tail=queue->tail; i!=tail; i=(i+1==queue->size) ? 0 : (i+1))
+    {
+        bin_queue_recycle(queue, queue->slices[i].data);
+    }
+    //Clear the pool buffers.
+    for (char* buffer : queue->pool_all)
+    {
+        bin_queue_buffer_destroy(buffer);
+    }
     //Clear the slices.
     free(queue->slices);
     //Clear the queue.
     delete queue;
 }
 
+char* hmr_bin_queue_alloc(HMR_BIN_QUEUE* queue)
+{
+    assert(queue->buffer_size > 0);
+    {
+        //Reuse the buffer released by the consumer.
+        std::unique_lock<std::mutex> pool_lock(queue->pool_mutex);
+        if (!queue->pool_free.empty())
+        {
+            char* buffer = queue->pool_free.back();
+            queue->pool_free.pop_back();
+            return buffer;
+        }
+    }
+    //Grow the pool with a new buffer.
+    char* buffer = bin_queue_buffer_create(queue->buffer_size);
+    std::unique_lock<std::mutex> pool_lock(queue->pool_mutex);
+    queue->pool_all.push_back(buffer);
+    return buffer;
+}
+
+void hmr_bin_queue_release(HMR_BIN_QUEUE* queue, char* data)
+{
+    std::unique_lock<std::mutex> pool_lock(queue->pool_mutex);
+    bin_queue_recycle(queue, data);
+}
+
+template <typename T>
+void bin_queue_wait(HMR_BIN_QUEUE* queue, std::atomic<bool>& waiting, std::condition_variable& cv, T ready)
+{
+    //Spin for a while, the other side is usually quick.
+    for (int i = 0; i < BIN_QUEUE_SPIN; ++i)
+    {
+        if (ready())
+        {
+            return;
+        }
+        std::this_thread::yield();
+    }
+    //Sleep until the other side wakes up this side.
+    std::unique_lock<std::mutex> wait_lock(queue->mutex);
+    waiting = true;
+    cv.wait(wait_lock, ready);
+    waiting = false;
+}
+
+inline void bin_queue_wake(HMR_BIN_QUEUE* queue, std::atomic<bool>& waiting, std::condition_variable& cv)
+{
+    //Only take the mutex when the other side is sleeping.
+    if (waiting)
+    {
+        std::unique_lock<std::mutex> wait_lock(queue->mutex);
+        cv.notify_one();
+    }
+}
+
+inline size_t bin_queue_next(HMR_BIN_QUEUE* queue, size_t pos)
+{
+    return (pos + 1 == queue->size) ? 0 : (pos + 1);
+}
+
 void hmr_bin_queue_push(HMR_BIN_QUEUE *queue, char *raw_data, size_t raw_data_size)
 {
+    //Only the producer changes the tail.
+    size_t tail = queue->tail.load(std::memory_order_relaxed), next = bin_queue_next(queue, tail);
     //Check whether the queue is full.
-    std::unique_lock<std::mutex> push_lock(queue->mutex);
-    queue->push_cv.wait(push_lock, [queue]
+    bin_queue_wait(queue, queue->push_waiting, queue->push_cv, [queue, next]
     {
-        return !((queue->tail+1==queue->head) || (queue->head==0&&queue->tail==queue->size - 1));
+        return queue->finish || next != queue->head;
     });
+    //The reader is no longer fetching data, drop the data.
+    if(queue->finish)
+    {
+        std::unique_lock<std::mutex> pool_lock(queue->pool_mutex);
+        bin_queue_recycle(queue, raw_data);
+        return;
+    }
     //Push the data to the queue.
-    queue->slices[queue->tail] = HMR_BIN_SLICE {raw_data, raw_data_size};
-    queue->tail = (queue->tail+1 == queue->size) ? 0 : (queue->tail+1);
-    //Notify the conditional variable.
-    queue->pop_cv.notify_one();
+    queue->slices[tail] = HMR_BIN_SLICE {raw_data, raw_data_size};
+    queue->tail = next;
+    //Wake up the consumer.
+    bin_queue_wake(queue, queue->pop_waiting, queue->pop_cv);
 }
 
 HMR_BIN_SLICE hmr_bin_queue_pop(HMR_BIN_QUEUE *queue)
 {
+    //Only the consumer changes the head.
+    size_t head = queue->head.load(std::memory_order_relaxed);
     //Wait until the queue is not empty.
-    std::unique_lock<std::mutex> pop_lock(queue->mutex);
-    queue->pop_cv.wait(pop_lock, [queue]
+    bin_queue_wait(queue, queue->pop_waiting, queue->pop_cv, [queue, head]
     {
-        return (queue->head != queue->tail) || queue->finish;
+        return head != queue->tail || queue->finish;
     });
-    //Extract the data.
-    HMR_BIN_SLICE slice = queue->slices[queue->head];
-    if(queue->finish && queue->head == queue->tail)
-    {
-        slice.data = NULL;
-        slice.data_size = 0;
-    }
-    else
+    //The queue is finished and all the data are popped.
+    if(head == queue->tail)
     {
-        queue->head = (queue->head+1 == queue->size) ? 0 : (queue->head+1);
+        return HMR_BIN_SLICE {NULL, 0};
     }
-    //Notify the push variable.
-    queue->push_cv.notify_one();
+    //Extract the data.
+    HMR_BIN_SLICE slice = queue->slices[head];
+    queue->head = bin_queue_next(queue, head);
+    //Wake up the producer.
+    bin_queue_wake(queue, queue->push_waiting, queue->push_cv);
     return slice;
 }
 
 void hmr_bin_queue_finish(HMR_BIN_QUEUE* queue)
 {
-    std::unique_lock<std::mutex> finish_lock(queue->mutex);
     //Mark queue is finished using.
     queue->finish = true;
-    queue->pop_cv.notify_one();
+    //Wake up both sides.
+    std::unique_lock<std::mutex> finish_lock(queue->mutex);
+    queue->pop_cv.notify_all();
+    queue->push_cv.notify_all();
 }
 
 void hmr_bin_buf_create(HMR_BIN_DATA_BUF** buf)
@@ -82,11 +216,26 @@ void hmr_bin_buf_create(HMR_BIN_DATA_BUF** buf)
     HMR_BIN_DATA_BUF* buffer = static_cast<HMR_BIN_DATA_BUF*>(malloc(sizeof(HMR_BIN_DATA_BUF)));
     buffer->data = NULL;
     buffer->offset = 0;
-    buffer->reserve = 0;
     buffer->size = 0;
+    buffer->spill = NULL;
+    buffer->spill_reserve = 0;
     *buf = buffer;
 }
 
+bool bin_buf_next(HMR_BIN_DATA_BUF* buf, HMR_BIN_QUEUE* queue)
+{
+    //Give the current slice back, and move to the next slice.
+    if (buf->data)
+    {
+        hmr_bin_queue_release(queue, buf->data);
+    }
+    HMR_BIN_SLICE bin_slice = hmr_bin_queue_pop(queue);
+    buf->data = bin_slice.data;
+    buf->size = bin_slice.data_size;
+    buf->offset = 0;
+    return bin_slice.data != NULL;
+}
+
 char *hmr_bin_buf_fetch(HMR_BIN_DATA_BUF *buf, HMR_BIN_QUEUE *queue, size_t size)
 {
     //Check the left data is enough.
@@ -98,59 +247,43 @@ char *hmr_bin_buf_fetch(HMR_BIN_DATA_BUF *buf, HMR_BIN_QUEUE *queue, size_t size
         buf->offset += size;
         return data;
     }
-    //Well, we have to fill the buffer with the queue data size.
-    while(residual < size)
+    //Nothing left in the current slice, the data might be inside the next slice.
+    if(residual == 0)
     {
-        //Fetch the data from the queue.
-        HMR_BIN_SLICE bin_slice = hmr_bin_queue_pop(queue);
-        if(bin_slice.data == NULL)
+        if(!bin_buf_next(buf, queue))
         {
-            //Reach the end of the data, still cannot fulfill, failed to fetch.
+            //Reach the end of the data, failed to fetch.
             return NULL;
         }
-        //Check whether we can fast swap to the slice memory.
-        if(residual == 0)
+        if(buf->size >= size)
         {
-            //Directly use the slice memory.
-            if(buf->data)
-            {
-                free(buf->data);
-            }
-            //Update the buffer.
-            buf->data = bin_slice.data;
-            buf->size = bin_slice.data_size;
-            buf->reserve = bin_slice.data_size;
+            buf->offset = size;
+            return buf->data;
         }
-        else
+    }
+    //The data crosses the slices, collect it in the spill buffer.
+    if(size > buf->spill_reserve)
+    {
+        char *expected = static_cast<char *>(realloc(buf->spill, size));
+        assert(expected);
+        buf->spill = expected;
+        buf->spill_reserve = size;
+    }
+    size_t filled = 0;
+    while(filled < size)
+    {
+        //Copy the part of the data in the current slice.
+        size_t part = hMin(buf->size - buf->offset, size - filled);
+        memcpy(buf->spill + filled, buf->data + buf->offset, part);
+        buf->offset += part;
+        filled += part;
+        if(filled < size && !bin_buf_next(buf, queue))
         {
-            //Copy the residual data.
-            assert(buf->data + buf->offset);
-            memcpy(buf->data, buf->data + buf->offset, residual);
-            //Calculate the new buffer size.
-            size_t data_size = residual + bin_slice.data_size;
-            //Increase the buffer size when necessary.
-            if(data_size > buf->reserve)
-            {
-                char *expected = static_cast<char *>(realloc(buf->data, data_size));
-                assert(expected);
-                buf->data = expected;
-                buf->reserve = data_size;
-            }
-            //Copy the slice data to buffer.
-            memcpy(buf->data + residual, bin_slice.data, bin_slice.data_size);
-            //Update the data size.
-            buf->size = data_size;
-            //Release the slice data.
-            free(bin_slice.data);
+            //Reach the end of the data, still cannot fulfill, failed to fetch.
+            return NULL;
         }
-        //Update the residual data.
-        buf->offset = 0;
-        residual = buf->size;
     }
-    //Now the data should be enough.
-    char *data = buf->data;
-    buf->offset = size;
-    return data;
+    return buf->spill;
 }
 
 char hmr_bin_buf_getc(HMR_BIN_DATA_BUF* buf, HMR_BIN_QUEUE* queue)
@@ -165,11 +298,12 @@ char hmr_bin_buf_getc(HMR_BIN_DATA_BUF* buf, HMR_BIN_QUEUE* queue)
     return result[0];
 }
 
-void hmr_bin_buf_free(HMR_BIN_DATA_BUF* buf)
+void hmr_bin_buf_free(HMR_BIN_DATA_BUF* buf, HMR_BIN_QUEUE* queue)
 {
     if (buf->data)
     {
-        free(buf->data);
+        hmr_bin_queue_release(queue, buf->data);
     }
+    free(buf->spill);
     free(buf);
 }
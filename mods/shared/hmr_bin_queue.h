@@ -1,7 +1,12 @@
 #ifndef HMR_BIN_QUEUE_H
 #define HMR_BIN_QUEUE_H
 
+#include <atomic>
+#include <mutex>
 #include <condition_variable>
+#include <vector>
+
+#define HMR_BIN_CACHE_LINE (64)
 
 typedef struct HMR_BIN_SLICE
 {
@@ -11,22 +16,49 @@ typedef struct HMR_BIN_SLICE
 
 typedef struct HMR_BIN_QUEUE
 {
-    bool finish, force_end;
+    std::atomic<bool> finish;
+    bool force_end;
     HMR_BIN_SLICE *slices;
-    size_t head, tail, size;
+    size_t size;
+    //Single producer and single consumer ring, the indices are on different cache lines.
+    char head_pad[HMR_BIN_CACHE_LINE];
+    std::atomic<size_t> head;
+    char tail_pad[HMR_BIN_CACHE_LINE];
+    std::atomic<size_t> tail;
+    char wait_pad[HMR_BIN_CACHE_LINE];
+    //The side stops spinning and sleeps on the condition variable.
+    std::atomic<bool> pop_waiting, push_waiting;
     std::mutex mutex;
     std::condition_variable pop_cv, push_cv;
+    //Recycled slice buffers, all of them are buffer_size bytes.
+    size_t buffer_size;
+    std::vector<char*> pool_all, pool_free;
+    std::mutex pool_mutex;
 } HMR_BIN_QUEUE;
 
 typedef struct HMR_BIN_DATA_BUF
 {
+    //Current slice popped from the queue.
     char *data;
-    size_t size, reserve, offset;
+    size_t size, offset;
+    //Data crossing the slices is collected in the spill buffer.
+    char *spill;
+    size_t spill_reserve;
 } HMR_BIN_DATA_BUF;
 
-void hmr_bin_queue_create(HMR_BIN_QUEUE **queue, size_t size);
+typedef struct HMR_BIN_QUEUE_TUNING
+{
+    size_t depth, buffer_size;
+} HMR_BIN_QUEUE_TUNING;
+
+extern HMR_BIN_QUEUE_TUNING hmr_bin_queue_tuning;
+
+void hmr_bin_queue_create(HMR_BIN_QUEUE **queue, size_t size, size_t buffer_size = 0);
 void hmr_bin_queue_free(HMR_BIN_QUEUE *queue);
 
+char* hmr_bin_queue_alloc(HMR_BIN_QUEUE* queue);
+void hmr_bin_queue_release(HMR_BIN_QUEUE* queue, char* data);
+
 void hmr_bin_queue_push(HMR_BIN_QUEUE *queue, char *raw_data, size_t raw_data_size);
 HMR_BIN_SLICE hmr_bin_queue_pop(HMR_BIN_QUEUE *queue);
 void hmr_bin_queue_finish(HMR_BIN_QUEUE* queue);
@@ -38,6 +70,6 @@ inline uint32_t hmr_bin_buf_fetch_uint32(HMR_BIN_DATA_BUF* buf, HMR_BIN_QUEUE* q
     return *(reinterpret_cast<uint32_t*>(hmr_bin_buf_fetch(buf, queue, 4)));
 }
 char hmr_bin_buf_getc(HMR_BIN_DATA_BUF* buf, HMR_BIN_QUEUE* queue);
-void hmr_bin_buf_free(HMR_BIN_DATA_BUF* buf);
+void hmr_bin_buf_free(HMR_BIN_DATA_BUF* buf, HMR_BIN_QUEUE* queue);
 
 #endif // HMR_BIN_QUEUE_H
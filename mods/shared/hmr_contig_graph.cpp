@@ -3,6 +3,7 @@
 #include "hmr_bin_file.h"
 #include "hmr_ui.h"
 #include "hmr_path.h"
+#include "hmr_writer.h"
 
 #include "hmr_contig_graph.h"
 
@@ -80,17 +81,17 @@ bool hmr_graph_save_contig(const char* filepath, const HMR_CONTIGS& contigs)
     return true;
 }
 
-std::string hmr_graph_path_reads(const char* prefix)
+std::string hmr_graph_path_reads(const char* prefix, bool compressed)
 {
-    return std::string(prefix) + ".hmr_reads";
+    return std::string(prefix) + (compressed ? ".hmr_reads.gz" : ".hmr_reads");
 }
 
-std::string hmr_graph_path_edge(const char* prefix)
+std::string hmr_graph_path_edge(const char* prefix, bool compressed)
 {
-    return std::string(prefix) + ".hmr_edge";
+    return std::string(prefix) + (compressed ? ".hmr_edge.gz" : ".hmr_edge");
 }
 
-bool hmr_graph_save_edge(const char* filepath, const HMR_EDGE_WEIGHTS& edges)
+bool hmr_graph_save_edge(const char* filepath, const HMR_EDGE_WEIGHTS& edges, int threads)
 {
     //Open the contig output file to write the data.
     FILE* edge_file;
@@ -99,13 +100,12 @@ bool hmr_graph_save_edge(const char* filepath, const HMR_EDGE_WEIGHTS& edges)
         time_error(-1, "Failed to save edge information from %s", filepath);
         return false;
     }
-    //Write the edge information.
+    //Write the edge information, compressed when the path ends with .gz.
+    HMR_WRITER* edge_writer = hmr_writer_open(edge_file, 0, hmr_writer_compressed(filepath) ? threads : 0);
     size_t contig_sizes = edges.size();
-    fwrite(&contig_sizes, sizeof(size_t), 1, edge_file);
-    for (const auto& edge : edges)
-    {
-        fwrite(&edge, sizeof(HMR_EDGE_WEIGHT), 1, edge_file);
-    }
+    hmr_writer_write(edge_writer, &contig_sizes, sizeof(size_t));
+    hmr_writer_write(edge_writer, edges.data(), sizeof(HMR_EDGE_WEIGHT) * edges.size());
+    hmr_writer_close(edge_writer);
     fclose(edge_file);
     return true;
 }
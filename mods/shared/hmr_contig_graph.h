@@ -11,10 +11,10 @@ std::string hmr_graph_path_contig(const char* prefix);
 bool hmr_graph_load_contig(const char* filepath, HMR_CONTIGS& contigs);
 bool hmr_graph_save_contig(const char* filepath, const HMR_CONTIGS& contigs);
 
-std::string hmr_graph_path_reads(const char* prefix);
+std::string hmr_graph_path_reads(const char* prefix, bool compressed = false);
 
-std::string hmr_graph_path_edge(const char* prefix);
-bool hmr_graph_save_edge(const char* filepath, const HMR_EDGE_WEIGHTS& edges);
+std::string hmr_graph_path_edge(const char* prefix, bool compressed = false);
+bool hmr_graph_save_edge(const char* filepath, const HMR_EDGE_WEIGHTS& edges, int threads = 1);
 
 std::string hmr_graph_path_invalid(const char* prefix);
 bool hmr_graph_save_invalid(const char* filepath, const HMR_CONTIG_INVALID_IDS& ids);
@@ -0,0 +1,118 @@
+#include <cstdlib>
+
+#if defined(HMR_INFLATE_LIBDEFLATE)
+#include <libdeflate.h>
+#elif defined(HMR_INFLATE_ZLIB_NG)
+#include <zlib-ng.h>
+#else
+#include <zlib.h>
+#endif
+
+#include "hmr_ui.h"
+
+#include "hmr_deflate.h"
+
+//The compressor uses the same backend as the decompressor.
+#if defined(HMR_INFLATE_LIBDEFLATE)
+typedef struct HMR_DEFLATE
+{
+    libdeflate_compressor* compressor;
+} HMR_DEFLATE;
+
+HMR_DEFLATE* hmr_deflate_create(int level)
+{
+    HMR_DEFLATE* deflater = new HMR_DEFLATE();
+    deflater->compressor = libdeflate_alloc_compressor(level);
+    if (NULL == deflater->compressor)
+    {
+        time_error(-1, "Failed to initialize compressor.");
+    }
+    return deflater;
+}
+
+size_t hmr_deflate_raw(HMR_DEFLATE* deflater, const char* raw, size_t raw_size, char* cdata, size_t cdata_size)
+{
+    //Zero when the compressed data cannot fit in the output.
+    return libdeflate_deflate_compress(deflater->compressor, raw, raw_size, cdata, cdata_size);
+}
+
+void hmr_deflate_free(HMR_DEFLATE* deflater)
+{
+    libdeflate_free_compressor(deflater->compressor);
+    delete deflater;
+}
+#elif defined(HMR_INFLATE_ZLIB_NG)
+typedef struct HMR_DEFLATE
+{
+    zng_stream strm;
+} HMR_DEFLATE;
+
+HMR_DEFLATE* hmr_deflate_create(int level)
+{
+    HMR_DEFLATE* deflater = new HMR_DEFLATE();
+    deflater->strm.zalloc = NULL;
+    deflater->strm.zfree = NULL;
+    deflater->strm.opaque = NULL;
+    //Raw deflate data, no header.
+    if (Z_OK != zng_deflateInit2(&deflater->strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY))
+    {
+        time_error(-1, "Failed to initialize compressor stream.");
+    }
+    return deflater;
+}
+
+size_t hmr_deflate_raw(HMR_DEFLATE* deflater, const char* raw, size_t raw_size, char* cdata, size_t cdata_size)
+{
+    zng_stream& strm = deflater->strm;
+    //Reuse the stream state of the last block.
+    zng_deflateReset(&strm);
+    strm.next_in = reinterpret_cast<const uint8_t*>(raw);
+    strm.avail_in = static_cast<uint32_t>(raw_size);
+    strm.next_out = reinterpret_cast<uint8_t*>(cdata);
+    strm.avail_out = static_cast<uint32_t>(cdata_size);
+    return Z_STREAM_END == zng_deflate(&strm, Z_FINISH) ? cdata_size - strm.avail_out : 0;
+}
+
+void hmr_deflate_free(HMR_DEFLATE* deflater)
+{
+    zng_deflateEnd(&deflater->strm);
+    delete deflater;
+}
+#else
+typedef struct HMR_DEFLATE
+{
+    z_stream strm;
+} HMR_DEFLATE;
+
+HMR_DEFLATE* hmr_deflate_create(int level)
+{
+    HMR_DEFLATE* deflater = new HMR_DEFLATE();
+    deflater->strm.zalloc = Z_NULL;
+    deflater->strm.zfree = Z_NULL;
+    deflater->strm.opaque = Z_NULL;
+    //Raw deflate data, no header.
+    if (Z_OK != deflateInit2(&deflater->strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY))
+    {
+        time_error(-1, "Failed to initialize compressor stream.");
+    }
+    return deflater;
+}
+
+size_t hmr_deflate_raw(HMR_DEFLATE* deflater, const char* raw, size_t raw_size, char* cdata, size_t cdata_size)
+{
+    z_stream& strm = deflater->strm;
+    //Reuse the stream state of the last block.
+    deflateReset(&strm);
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(raw));
+    strm.avail_in = static_cast<uInt>(raw_size);
+    strm.next_out = reinterpret_cast<Bytef*>(cdata);
+    strm.avail_out = static_cast<uInt>(cdata_size);
+    return Z_STREAM_END == deflate(&strm, Z_FINISH) ? cdata_size - strm.avail_out : 0;
+}
+
+void hmr_deflate_free(HMR_DEFLATE* deflater)
+{
+    deflateEnd(&deflater->strm);
+    delete deflater;
+}
+#endif
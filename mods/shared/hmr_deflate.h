@@ -0,0 +1,15 @@
+#ifndef HMR_DEFLATE_H
+#define HMR_DEFLATE_H
+
+#include <cstddef>
+
+// Default compression level of the BGZF blocks.
+#define HMR_DEFLATE_LEVEL (6)
+
+typedef struct HMR_DEFLATE HMR_DEFLATE;
+
+HMR_DEFLATE* hmr_deflate_create(int level = HMR_DEFLATE_LEVEL);
+size_t hmr_deflate_raw(HMR_DEFLATE* deflater, const char* raw, size_t raw_size, char* cdata, size_t cdata_size);
+void hmr_deflate_free(HMR_DEFLATE* deflater);
+
+#endif // HMR_DEFLATE_H
@@ -12,6 +12,7 @@
 typedef struct ENZYME_SEQ
 {
     std::vector<std::string> names;
+    //Sites of an enzyme cocktail are separated by comma.
     std::string sequence;
 } ENZYME_SEQ;
 
@@ -44,11 +45,73 @@ static std::vector<ENZYME_SEQ> known_enzymes = {
     { {"StuI", "Stu1"}, "AGGCCT"},
     { {"NdeI", "Nde1"}, "CATATG"},
     { {"NotI", "Not1"}, "GCGGCCGC"},
+    { {"HinfI", "Hinf1"}, "GANTC"},
+    { {"DdeI", "Dde1"}, "CTNAG"},
+    { {"MseI", "Mse1"}, "TTAA"},
+    { {"Arima"}, "GATC,GANTC"},
 };
 
 static std::unordered_map<std::string, std::string> known_enzyme_alias;
 
-void hmr_enzyme_formalize(char* enzyme, const char** nuc_seq, int* nuc_seq_size)
+int hmr_enzyme_code(char base)
+{
+    switch (base)
+    {
+    case 'A': return 1;
+    case 'C': return 2;
+    case 'G': return 4;
+    case 'T': return 8;
+    case 'R': return 1 | 4;
+    case 'Y': return 2 | 8;
+    case 'S': return 2 | 4;
+    case 'W': return 1 | 8;
+    case 'K': return 4 | 8;
+    case 'M': return 1 | 2;
+    case 'B': return 2 | 4 | 8;
+    case 'D': return 1 | 4 | 8;
+    case 'H': return 1 | 2 | 8;
+    case 'V': return 1 | 2 | 4;
+    case 'N': return 1 | 2 | 4 | 8;
+    default: return 0;
+    }
+}
+
+std::string hmr_enzyme_reverse_complement(const std::string& seq)
+{
+    //The complement of an IUPAC code allows the complement bases.
+    std::string reversed(seq.rbegin(), seq.rend());
+    for (char& base : reversed)
+    {
+        switch (base)
+        {
+        case 'A': base = 'T'; break;
+        case 'C': base = 'G'; break;
+        case 'G': base = 'C'; break;
+        case 'T': base = 'A'; break;
+        case 'R': base = 'Y'; break;
+        case 'Y': base = 'R'; break;
+        case 'K': base = 'M'; break;
+        case 'M': base = 'K'; break;
+        case 'B': base = 'V'; break;
+        case 'V': base = 'B'; break;
+        case 'D': base = 'H'; break;
+        case 'H': base = 'D'; break;
+        default: break;
+        }
+    }
+    return reversed;
+}
+
+void enzyme_append(HMR_ENZYME_SEQS& nuc_seqs, const std::string& seq)
+{
+    //Skip the duplicated sites.
+    if (std::find(nuc_seqs.begin(), nuc_seqs.end(), seq) == nuc_seqs.end())
+    {
+        nuc_seqs.push_back(seq);
+    }
+}
+
+void hmr_enzyme_formalize(char* enzyme, HMR_ENZYME_SEQS& nuc_seqs)
 {
     size_t length = strlen(enzyme);
     //Convert the original char in upper case letter.
@@ -74,23 +137,46 @@ void hmr_enzyme_formalize(char* enzyme, const char** nuc_seq, int* nuc_seq_size)
             }
         }
     }
-    //Check whether it is an known alias name.
-    auto known_finder = known_enzyme_alias.find(std::string(enzyme));
-    if (known_finder != known_enzyme_alias.end())
+    //Multiple enzymes are separated by comma, each could be an known alias name or a site sequence.
+    std::string enzymes;
+    std::string enzyme_list(enzyme);
+    size_t item_start = 0;
+    while (item_start <= enzyme_list.size())
     {
-        (*nuc_seq) = known_finder->second.data();
-        (*nuc_seq_size) = static_cast<int>(strlen(*nuc_seq));
-        return;
+        size_t item_end = enzyme_list.find(',', item_start);
+        if (item_end == std::string::npos)
+        {
+            item_end = enzyme_list.size();
+        }
+        std::string item = enzyme_list.substr(item_start, item_end - item_start);
+        auto known_finder = known_enzyme_alias.find(item);
+        enzymes += (enzymes.empty() ? "" : ",") + (known_finder == known_enzyme_alias.end() ? item : known_finder->second);
+        item_start = item_end + 1;
     }
-    //Or else we have to check the enzyme is valid or not.
-    for (char* s = enzyme, *e = enzyme + length; s < e; ++s)
+    //Check the sites are valid, the reverse complement of a non-palindromic site is also searched.
+    item_start = 0;
+    while (item_start <= enzymes.size())
     {
-        //Check invalid nuc.
-        if ((*s) != 'A' && (*s) != 'C' && (*s) != 'T' && (*s) != 'G')
+        size_t item_end = enzymes.find(',', item_start);
+        if (item_end == std::string::npos)
         {
-            time_error(-1, "Invalid nucleotide base '%c' found in enzyme '%s'.", *s, enzyme);
+            item_end = enzymes.size();
+        }
+        std::string site = enzymes.substr(item_start, item_end - item_start);
+        if (site.empty())
+        {
+            time_error(-1, "Empty restriction site found in enzyme '%s'.", enzyme);
+        }
+        for (char base : site)
+        {
+            //Check invalid nuc.
+            if (!hmr_enzyme_code(base))
+            {
+                time_error(-1, "Invalid nucleotide base '%c' found in enzyme '%s'.", base, enzyme);
+            }
         }
+        enzyme_append(nuc_seqs, site);
+        enzyme_append(nuc_seqs, hmr_enzyme_reverse_complement(site));
+        item_start = item_end + 1;
     }
-    *nuc_seq = enzyme;
-    *nuc_seq_size = static_cast<int>(length);
 }
@@ -1,8 +1,14 @@
 #ifndef HMR_BIN_ENZYME_H
 #define HMR_BIN_ENZYME_H
 
+#include <string>
 #include <vector>
 
-void hmr_enzyme_formalize(char* enzyme, const char** nuc_seq, int* nuc_seq_size);
+typedef std::vector<std::string> HMR_ENZYME_SEQS;
 
-#endif // HMR_BIN_ENZYME
\ No newline at end of file
+//Bases allowed by an IUPAC code (bit 0: A, bit 1: C, bit 2: G, bit 3: T), 0 for invalid code.
+int hmr_enzyme_code(char base);
+std::string hmr_enzyme_reverse_complement(const std::string& seq);
+void hmr_enzyme_formalize(char* enzyme, HMR_ENZYME_SEQS& nuc_seqs);
+
+#endif // HMR_BIN_ENZYME
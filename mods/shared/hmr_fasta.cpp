@@ -3,97 +3,794 @@
 #include <cstdio>
 #include <cstdint>
 #include <cstring>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+
+#ifdef __linux__
+#include <cerrno>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define FASTA_COPY_FILE_RANGE
+#endif
+#endif
 
 #include "hmr_text_file.h"
-#include "hmr_bin_file.h"
+#include "hmr_path.h"
+#include "hmr_read_ahead.h"
+#include "hmr_global.h"
 #include "hmr_ui.h"
 
 #include "hmr_fasta.h"
 
-typedef struct FASTA_PARSE
+//Bytes copied by the kernel in one call.
+#define FASTA_COPY_CHUNK (1073741824)
+
+typedef struct FASTA_RECORD
 {
+    //Text of the record after '>', the owned text is freed after parsing.
+    const char* text;
+    size_t text_size;
+    char* owned;
+    //Parsed name and sequence without line breaks, the sequence is packed when required.
     char *seq_name, *seq_data;
+    HMR_PACKED_SEQ* seq_packed;
     size_t seq_name_len, seq_data_len;
-    FASTA_PROC user_parser;
-    void *user;
-} FASTA_PARSE;
+    bool parsed;
+} FASTA_RECORD;
+
+typedef struct FASTA_PIPELINE
+{
+    FASTA_RECORD* records;
+    size_t window;
+    //Record index (not wrapped) of the oldest unsent record, the next record to parse and the next record to fill.
+    size_t head, claimed, tail;
+    bool reader_done;
+    std::mutex mutex;
+    std::condition_variable work_cv, emit_cv;
+    FASTA_PROC parser;
+    FASTA_PACKED_PROC packed_parser;
+    void* user;
+    int32_t index;
+} FASTA_PIPELINE;
 
-inline void fasta_yield_line(char *line, size_t line_size, FASTA_PARSE &args, int32_t &index)
+inline size_t fasta_trimmed_size(const char* line, size_t size)
 {
-    if(line_size == 0 || line == NULL)
+    while (size > 0 && is_space(line[size - 1]))
     {
-        return;
+        --size;
+    }
+    return size;
+}
+
+void fasta_parse_record(FASTA_RECORD& record, bool packed)
+{
+    const char* text = record.text;
+    const char* end = text + record.text_size;
+    //The first line is the sequence name.
+    const char* name_end = record.text_size > 0 ? static_cast<const char*>(memchr(text, '\n', record.text_size)) : NULL;
+    if (!name_end)
+    {
+        name_end = end;
+    }
+    record.seq_name_len = fasta_trimmed_size(text, name_end - text);
+    record.seq_name = static_cast<char*>(malloc(record.seq_name_len + 1));
+    assert(record.seq_name);
+    memcpy(record.seq_name, text, record.seq_name_len);
+    record.seq_name[record.seq_name_len] = '\0';
+    //Copy the sequence lines without the line breaks, then fit the buffer to the sequence.
+    const char* line = name_end == end ? end : name_end + 1;
+    record.seq_data = static_cast<char*>(malloc(end - line + 1));
+    assert(record.seq_data);
+    size_t seq_size = 0;
+    while (line < end)
+    {
+        const char* line_end = static_cast<const char*>(memchr(line, '\n', end - line));
+        if (!line_end)
+        {
+            line_end = end;
+        }
+        size_t line_size = fasta_trimmed_size(line, line_end - line);
+        memcpy(record.seq_data + seq_size, line, line_size);
+        seq_size += line_size;
+        line = line_end + 1;
+    }
+    record.seq_data_len = seq_size;
+    record.seq_data = static_cast<char*>(realloc(record.seq_data, seq_size + 1));
+    assert(record.seq_data);
+    record.seq_data[seq_size] = '\0';
+    free(record.owned);
+    record.owned = NULL;
+    record.seq_packed = NULL;
+    if (packed)
+    {
+        record.seq_packed = hmr_seq_pack(record.seq_data, seq_size);
+        free(record.seq_data);
+        record.seq_data = NULL;
+    }
+}
+
+void fasta_parse_work(FASTA_PIPELINE* pipeline)
+{
+    std::unique_lock<std::mutex> lock(pipeline->mutex);
+    while (true)
+    {
+        //Wait for a filled record.
+        pipeline->work_cv.wait(lock, [pipeline] { return pipeline->claimed < pipeline->tail || pipeline->reader_done; });
+        if (pipeline->claimed == pipeline->tail)
+        {
+            break;
+        }
+        FASTA_RECORD& record = pipeline->records[pipeline->claimed % pipeline->window];
+        ++pipeline->claimed;
+        lock.unlock();
+        fasta_parse_record(record, pipeline->packed_parser != NULL);
+        lock.lock();
+        record.parsed = true;
+        pipeline->emit_cv.notify_all();
+    }
+}
+
+void fasta_emit_head(FASTA_PIPELINE& pipeline)
+{
+    //Wait for the oldest record, yield it in the order of the file.
+    FASTA_RECORD* record = pipeline.records + (pipeline.head % pipeline.window);
+    {
+        std::unique_lock<std::mutex> lock(pipeline.mutex);
+        pipeline.emit_cv.wait(lock, [record] { return record->parsed; });
+    }
+    if (record->seq_data_len > 0)
+    {
+        if (pipeline.packed_parser)
+        {
+            pipeline.packed_parser(pipeline.index, record->seq_name, record->seq_name_len, record->seq_packed, pipeline.user);
+        }
+        else
+        {
+            pipeline.parser(pipeline.index, record->seq_name, record->seq_name_len, record->seq_data, record->seq_data_len, pipeline.user);
+        }
+        ++pipeline.index;
+    }
+    else
+    {
+        //The record without sequence is skipped.
+        free(record->seq_name);
+        free(record->seq_data);
+        hmr_seq_pack_free(record->seq_packed);
+    }
+    std::unique_lock<std::mutex> lock(pipeline.mutex);
+    record->parsed = false;
+    ++pipeline.head;
+}
+
+void fasta_submit(FASTA_PIPELINE& pipeline, const char* text, size_t text_size, char* owned)
+{
+    //Yield the oldest record when the window is full.
+    if (pipeline.tail - pipeline.head == pipeline.window)
+    {
+        fasta_emit_head(pipeline);
     }
-    //Check whether the line start is with '>'.
-    if(line[0] == '>')
+    FASTA_RECORD& record = pipeline.records[pipeline.tail % pipeline.window];
+    record.text = text;
+    record.text_size = text_size;
+    record.owned = owned;
+    std::unique_lock<std::mutex> lock(pipeline.mutex);
+    ++pipeline.tail;
+    pipeline.work_cv.notify_one();
+}
+
+inline size_t fasta_find_record(const char* data, size_t size, size_t from, char prev)
+{
+    //Find the '>' at the start of a line, prev is the char before the data.
+    while (from < size)
     {
-        //Check the last is empty or not.
-        if(args.seq_name != NULL)
+        const char* mark = static_cast<const char*>(memchr(data + from, '>', size - from));
+        if (!mark)
+        {
+            return size;
+        }
+        size_t offset = mark - data;
+        if ((offset == 0 ? prev : data[offset - 1]) == '\n')
         {
-            if(args.seq_data != NULL)
+            return offset;
+        }
+        from = offset + 1;
+    }
+    return size;
+}
+
+inline void fasta_carry_append(char*& carry, size_t& carry_size, size_t& carry_reserve, const char* data, size_t size)
+{
+    if (carry_size + size > carry_reserve)
+    {
+        carry_reserve = hMax(carry_size + size, carry_reserve << 1);
+        carry = static_cast<char*>(realloc(carry, carry_reserve));
+        assert(carry);
+    }
+    memcpy(carry + carry_size, data, size);
+    carry_size += size;
+}
+
+void fasta_read(const char *filepath, FASTA_PROC parser, FASTA_PACKED_PROC packed_parser, void *user, int threads)
+{
+    TEXT_BLOCK_HANDLE block_handle;
+    if (!text_open_read_block(filepath, &block_handle, threads))
+    {
+        time_error(-1, "Failed to read FASTA file %s", filepath);
+    }
+    //The records are split by the reader, parsed by the workers and yielded in order.
+    int workers_size = hMax(threads, 1);
+    FASTA_PIPELINE pipeline;
+    pipeline.window = static_cast<size_t>(workers_size) << 1;
+    pipeline.records = new FASTA_RECORD[pipeline.window];
+    pipeline.head = 0;
+    pipeline.claimed = 0;
+    pipeline.tail = 0;
+    pipeline.reader_done = false;
+    pipeline.parser = parser;
+    pipeline.packed_parser = packed_parser;
+    pipeline.user = user;
+    pipeline.index = 0;
+    for (size_t i = 0; i < pipeline.window; ++i)
+    {
+        pipeline.records[i].parsed = false;
+    }
+    std::vector<std::thread> workers;
+    for (int i = 0; i < workers_size; ++i)
+    {
+        workers.push_back(std::thread(fasta_parse_work, &pipeline));
+    }
+    //The mapped file stays valid, its records are parsed in place.
+    bool in_place = block_handle.mode == "map";
+    //Record which crosses the blocks is collected in the carry buffer.
+    char* carry = NULL;
+    size_t carry_size = 0, carry_reserve = 0;
+    bool in_record = false;
+    char prev = '\n';
+    char* data;
+    size_t size;
+    while ((size = text_read_block(&block_handle, &data)) > 0)
+    {
+        size_t start = fasta_find_record(data, size, 0, prev);
+        if (in_record)
+        {
+            //Complete the record from the last block.
+            fasta_carry_append(carry, carry_size, carry_reserve, data, start);
+            if (start < size)
+            {
+                fasta_submit(pipeline, carry, carry_size, carry);
+                carry = NULL;
+                carry_size = 0;
+                carry_reserve = 0;
+                in_record = false;
+            }
+        }
+        //The data before the first record is ignored.
+        while (start < size)
+        {
+            size_t next = fasta_find_record(data, size, start + 1, '>');
+            if (next < size || in_place)
             {
-                //Yield the line parser.
-                args.user_parser(index, args.seq_name, args.seq_name_len, args.seq_data, args.seq_data_len, args.user);
-                ++index;
+                //The record is complete inside the block.
+                const char* text = data + start + 1;
+                size_t text_size = next - start - 1;
+                if (in_place)
+                {
+                    fasta_submit(pipeline, text, text_size, NULL);
+                }
+                else
+                {
+                    char* owned = static_cast<char*>(malloc(hMax(text_size, static_cast<size_t>(1))));
+                    assert(owned);
+                    memcpy(owned, text, text_size);
+                    fasta_submit(pipeline, owned, text_size, owned);
+                }
             }
             else
             {
-                //Clear the sequence name.
-                free(args.seq_name);
+                fasta_carry_append(carry, carry_size, carry_reserve, data + start + 1, size - start - 1);
+                in_record = true;
             }
+            start = next;
         }
-        //Set the sequence name.
-        args.seq_name = static_cast<char *>(malloc(line_size));
-        assert(NULL != args.seq_name);
-        args.seq_name_len = line_size-1;
-        memcpy(args.seq_name, line+1, args.seq_name_len);
-        args.seq_name[args.seq_name_len] = '\0';
-        //Reset the sequence.
-        args.seq_data = NULL;
-        args.seq_data_len = 0;
+        prev = data[size - 1];
+    }
+    if (in_record)
+    {
+        fasta_submit(pipeline, carry, carry_size, carry);
     }
     else
     {
-        //Check the sequence.
-        size_t seq_extend_len = args.seq_data_len + line_size;
-        args.seq_data = static_cast<char *>(realloc(args.seq_data, seq_extend_len + 1));
-        //Copy the data.
-        assert(args.seq_data + args.seq_data_len);
-        memcpy(args.seq_data + args.seq_data_len, line, line_size);
-        args.seq_data_len = seq_extend_len;
-        args.seq_data[args.seq_data_len] = '\0';
+        free(carry);
+    }
+    {
+        std::unique_lock<std::mutex> lock(pipeline.mutex);
+        pipeline.reader_done = true;
+        pipeline.work_cv.notify_all();
+    }
+    while (pipeline.head < pipeline.tail)
+    {
+        fasta_emit_head(pipeline);
+    }
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    delete[] pipeline.records;
+    //Close the file.
+    text_close_read_block(&block_handle);
+}
+
+void hmr_fasta_read(const char *filepath, FASTA_PROC parser, void *user, int threads)
+{
+    fasta_read(filepath, parser, NULL, user, threads);
+}
+
+void hmr_fasta_read_packed(const char *filepath, FASTA_PACKED_PROC parser, void *user, int threads)
+{
+    //The sequences are packed by the parsing workers.
+    fasta_read(filepath, NULL, parser, user, threads);
+}
+
+typedef struct FASTA_INDEX_SCAN
+{
+    HMR_FASTA_INDEX* index;
+    //Header line text, kept until the line is complete.
+    std::string header;
+    bool in_header;
+    //Bytes of the current line, the last char before the current block, and whether a short line ends the sequence.
+    size_t line_size;
+    char line_last;
+    bool short_line;
+} FASTA_INDEX_SCAN;
+
+size_t hmr_fasta_name_size(const char* seq_name, size_t seq_name_size)
+{
+    //The name in the index ends at the first space.
+    size_t size = 0;
+    while (size < seq_name_size && !is_space(seq_name[size]))
+    {
+        ++size;
+    }
+    return size;
+}
+
+inline size_t fasta_index_span(const HMR_FASTA_INDEX_RECORD& record, size_t length)
+{
+    //Bytes from the sequence offset until the last base.
+    return length == 0 ? 0 : (length - 1) / record.line_bases * record.line_width + (length - 1) % record.line_bases + 1;
+}
+
+void fasta_index_line(FASTA_INDEX_SCAN& scan, size_t line_bases, size_t line_width, size_t line_end)
+{
+    HMR_FASTA_INDEX& index = *scan.index;
+    if (scan.in_header)
+    {
+        //Start the record, the sequence starts after the header line.
+        const char* name = scan.header.data() + 1;
+        index.push_back(HMR_FASTA_INDEX_RECORD{ std::string(name, hmr_fasta_name_size(name, scan.header.size() - 1)), 0, line_end, 0, 0 });
+        scan.in_header = false;
+        scan.short_line = false;
+        return;
+    }
+    //Ignore the text before the first record.
+    if (index.empty())
+    {
+        return;
+    }
+    HMR_FASTA_INDEX_RECORD& record = index.back();
+    if (line_bases == 0)
+    {
+        scan.short_line = true;
+        return;
+    }
+    if (record.line_bases == 0)
+    {
+        record.line_bases = line_bases;
+        record.line_width = line_width;
+    }
+    else if (scan.short_line || line_bases > record.line_bases || (line_bases == record.line_bases && line_width != record.line_width))
+    {
+        time_error(-1, "Corrupted FASTA: different line length in sequence '%s'.", record.name.data());
+    }
+    if (line_bases < record.line_bases)
+    {
+        scan.short_line = true;
+    }
+    record.length += line_bases;
+}
+
+void fasta_index_scan(FASTA_INDEX_SCAN& scan, const char* data, size_t size, size_t position)
+{
+    size_t pos = 0;
+    while (pos < size)
+    {
+        if (scan.line_size == 0 && data[pos] == '>')
+        {
+            scan.in_header = true;
+            scan.header.clear();
+        }
+        const char* line_end = static_cast<const char*>(memchr(data + pos, '\n', size - pos));
+        size_t part = (line_end ? static_cast<size_t>(line_end - data) + 1 : size) - pos;
+        if (scan.in_header)
+        {
+            scan.header.append(data + pos, part);
+        }
+        scan.line_size += part;
+        if (line_end)
+        {
+            //Line ends with '\n' or "\r\n".
+            char before = part > 1 ? line_end[-1] : scan.line_last;
+            size_t line_bases = scan.line_size - (before == '\r' ? 2 : 1);
+            fasta_index_line(scan, line_bases, scan.line_size, position + pos + part);
+            scan.line_size = 0;
+        }
+        scan.line_last = data[pos + part - 1];
+        pos += part;
+    }
+}
+
+bool fasta_index_fresh(const char* filepath, const char* index_path)
+{
+    //The index should not be older than the FASTA file.
+#ifdef _MSC_VER
+    struct _stat64 fasta_stat, index_stat;
+    if (_stat64(filepath, &fasta_stat) != 0 || _stat64(index_path, &index_stat) != 0)
+#else
+    struct stat fasta_stat, index_stat;
+    if (stat(filepath, &fasta_stat) != 0 || stat(index_path, &index_stat) != 0)
+#endif
+    {
+        return false;
+    }
+    return index_stat.st_mtime >= fasta_stat.st_mtime;
+}
+
+bool fasta_index_load(const char* index_path, HMR_FASTA_INDEX& index)
+{
+    TEXT_LINE_HANDLE handle;
+    if (!text_open_read_line(index_path, &handle))
+    {
+        return false;
+    }
+    char* line = NULL;
+    size_t line_size = 0;
+    ssize_t line_len;
+    bool valid = true;
+    while (valid && (line_len = handle.parser(&line, &line_size, &handle.buf, handle.file_handle)) != -1)
+    {
+        //The line is not always ended with '\0', parse a copy of the line.
+        std::string record_line(line, line_len);
+        while (!record_line.empty() && is_space(record_line.back()))
+        {
+            record_line.pop_back();
+        }
+        if (record_line.empty())
+        {
+            continue;
+        }
+        //Columns: name, length, offset, line bases, line width.
+        size_t name_size = record_line.find('\t');
+        if (name_size == std::string::npos)
+        {
+            valid = false;
+            break;
+        }
+        HMR_FASTA_INDEX_RECORD record;
+        record.name = record_line.substr(0, name_size);
+        size_t* fields[4] = { &record.length, &record.offset, &record.line_bases, &record.line_width };
+        const char* field = record_line.data() + name_size, * line_end = record_line.data() + record_line.size();
+        for (int i = 0; valid && i < 4; ++i)
+        {
+            char* field_end;
+            *fields[i] = static_cast<size_t>(strtoull(field + 1, &field_end, 10));
+            //Only the last column ends the line.
+            valid = field_end != field + 1 && (i < 3 ? *field_end == '\t' : field_end == line_end);
+            field = field_end;
+        }
+        //The bases should be fit in the lines.
+        valid = valid && (record.length == 0 || (record.line_bases > 0 && record.line_width >= record.line_bases));
+        index.push_back(record);
+    }
+    text_close_read_line(&handle);
+    if (!valid)
+    {
+        index.clear();
+    }
+    return valid;
+}
+
+void fasta_index_save(const char* index_path, const HMR_FASTA_INDEX& index)
+{
+    //The index is still usable when it cannot be saved.
+    FILE* index_file;
+    if (!bin_open(index_path, &index_file, "wb"))
+    {
+        return;
+    }
+    for (const HMR_FASTA_INDEX_RECORD& record : index)
+    {
+        fprintf(index_file, "%s\t%zu\t%zu\t%zu\t%zu\n", record.name.data(), record.length, record.offset, record.line_bases, record.line_width);
+    }
+    fclose(index_file);
+}
+
+bool hmr_fasta_index_read(const char* filepath, HMR_FASTA_INDEX& index, int threads)
+{
+    //Only the plain text FASTA could be fetched by offsets.
+    std::string suffix = path_suffix(filepath);
+    if (suffix == ".gz" || suffix == ".bgz")
+    {
+        return false;
+    }
+    //Use the existing index next to the FASTA file.
+    std::string index_path = std::string(filepath) + ".fai";
+    if (fasta_index_fresh(filepath, index_path.data()) && fasta_index_load(index_path.data(), index))
+    {
+        return true;
+    }
+    TEXT_BLOCK_HANDLE block_handle;
+    if (!text_open_read_block(filepath, &block_handle, threads))
+    {
+        time_error(-1, "Failed to read FASTA file %s", filepath);
+    }
+    FASTA_INDEX_SCAN scan;
+    scan.index = &index;
+    scan.in_header = false;
+    scan.line_size = 0;
+    scan.line_last = '\n';
+    scan.short_line = false;
+    char* data;
+    size_t size, position = 0;
+    while ((size = text_read_block(&block_handle, &data)) > 0)
+    {
+        fasta_index_scan(scan, data, size, position);
+        position += size;
     }
+    text_close_read_block(&block_handle);
+    //Complete the last line without a line break, its width follows the previous lines of the record.
+    if (scan.line_size > 0)
+    {
+        size_t line_bases = scan.line_size - (scan.line_last == '\r' ? 1 : 0);
+        size_t line_width = (index.empty() || index.back().line_bases == 0) ? line_bases + 1 : index.back().line_width;
+        fasta_index_line(scan, line_bases, line_width, position);
+    }
+    fasta_index_save(index_path.data(), index);
+    return true;
 }
 
-void hmr_fasta_read(const char *filepath, FASTA_PROC parser, void *user)
+HMR_FASTA_FILE* hmr_fasta_open(const char* filepath, int threads)
 {
-    FASTA_PARSE args;
-    TEXT_LINE_HANDLE line_handle;
-    if(!text_open_read_line(filepath, &line_handle))
+    HMR_FASTA_FILE* fasta_file = new HMR_FASTA_FILE();
+    if (!hmr_fasta_index_read(filepath, fasta_file->index, threads))
+    {
+        delete fasta_file;
+        return NULL;
+    }
+    //The file is kept open for copying the records.
+    if (!bin_open(filepath, &fasta_file->file, "rb"))
     {
         time_error(-1, "Failed to read FASTA file %s", filepath);
     }
-    //Loop and detect line.
-    char *line = NULL;
-    size_t len = 0, line_length = 0;
-    int32_t index = 0;
-    ssize_t line_size = 0;
-    args.seq_name = NULL;
-    args.seq_data = NULL;
-    args.seq_name_len = 0;
-    args.seq_data_len = 0;
-    args.user_parser = parser;
-    args.user = user;
-    while((line_size = (line_handle.parser(&line, &len, &line_handle.buf, line_handle.file_handle))) != -1)
-    {
-        //Trimmed line.
-        line_length = static_cast<size_t>(line_size);
-        trimmed_right(line, line_length);
-        //Yield the line, call the function.
-        fasta_yield_line(line, line_length, args, index);
-    }
-    //At the end of the line, yield the last result.
-    parser(index, args.seq_name, args.seq_name_len, args.seq_data, args.seq_data_len, user);
-    //Close the file.
-    text_close_read_line(&line_handle);
+    if (!bin_map(filepath, &fasta_file->map, false))
+    {
+        fasta_file->map = HMR_BIN_MAP{ NULL, 0 };
+    }
+    for (size_t i = 0; i < fasta_file->index.size(); ++i)
+    {
+        fasta_file->name_ids.insert(std::make_pair(fasta_file->index[i].name, static_cast<int32_t>(i)));
+    }
+    return fasta_file;
+}
+
+void fasta_file_read(HMR_FASTA_FILE* fasta_file, size_t offset, char* data, size_t size)
+{
+    //Read the bytes of the file without mapping.
+    std::unique_lock<std::mutex> lock(fasta_file->file_mutex);
+#ifdef _MSC_VER
+    bool seeked = _fseeki64(fasta_file->file, offset, SEEK_SET) == 0;
+#else
+    bool seeked = fseeko(fasta_file->file, offset, SEEK_SET) == 0;
+#endif
+    if (!seeked || fread(data, 1, size, fasta_file->file) != size)
+    {
+        time_error(-1, "Failed to read FASTA sequence, the index may be outdated.");
+    }
+}
+
+char* hmr_fasta_fetch(HMR_FASTA_FILE* fasta_file, int32_t id, size_t* seq_size)
+{
+    const HMR_FASTA_INDEX_RECORD& record = fasta_file->index[id];
+    size_t span = fasta_index_span(record, record.length);
+    if (fasta_file->map.data && record.offset + span > fasta_file->map.size)
+    {
+        time_error(-1, "Failed to read FASTA sequence, the index may be outdated.");
+    }
+    char* seq = static_cast<char*>(malloc((fasta_file->map.data ? record.length : span) + 1));
+    assert(seq);
+    if (fasta_file->map.data)
+    {
+        //Copy the bases line by line from the mapping.
+        const char* line = fasta_file->map.data + record.offset;
+        for (size_t filled = 0; filled < record.length; filled += record.line_bases, line += record.line_width)
+        {
+            memcpy(seq + filled, line, hMin(record.line_bases, record.length - filled));
+        }
+    }
+    else
+    {
+        //Read the lines, then remove the line breaks in place.
+        fasta_file_read(fasta_file, record.offset, seq, span);
+        for (size_t filled = record.line_bases, line = record.line_width; filled < record.length; filled += record.line_bases, line += record.line_width)
+        {
+            memmove(seq + filled, seq + line, hMin(record.line_bases, record.length - filled));
+        }
+        seq = static_cast<char*>(realloc(seq, record.length + 1));
+        assert(seq);
+    }
+    seq[record.length] = '\0';
+    *seq_size = record.length;
+    return seq;
+}
+
+HMR_PACKED_SEQ* hmr_fasta_fetch_packed(HMR_FASTA_FILE* fasta_file, int32_t id)
+{
+    const HMR_FASTA_INDEX_RECORD& record = fasta_file->index[id];
+    size_t span = fasta_index_span(record, record.length);
+    if (fasta_file->map.data)
+    {
+        //Pack the lines from the mapping directly.
+        if (record.offset + span > fasta_file->map.size)
+        {
+            time_error(-1, "Failed to read FASTA sequence, the index may be outdated.");
+        }
+        return hmr_seq_pack_lines(fasta_file->map.data + record.offset, record.length, hMax(record.line_bases, static_cast<size_t>(1)), record.line_width);
+    }
+    char* text = static_cast<char*>(malloc(hMax(span, static_cast<size_t>(1))));
+    assert(text);
+    fasta_file_read(fasta_file, record.offset, text, span);
+    HMR_PACKED_SEQ* packed = hmr_seq_pack_lines(text, record.length, hMax(record.line_bases, static_cast<size_t>(1)), record.line_width);
+    free(text);
+    return packed;
+}
+
+char* hmr_fasta_fetch(HMR_FASTA_FILE* fasta_file, const char* name, size_t* seq_size)
+{
+    auto id_finder = fasta_file->name_ids.find(name);
+    if (id_finder == fasta_file->name_ids.end())
+    {
+        return NULL;
+    }
+    return hmr_fasta_fetch(fasta_file, id_finder->second, seq_size);
+}
+
+size_t fasta_record_start(HMR_FASTA_FILE* fasta_file, int32_t id)
+{
+    //The header is the line before the sequence, search it after the last record.
+    const HMR_FASTA_INDEX_RECORD& record = fasta_file->index[id];
+    const HMR_FASTA_INDEX_RECORD* previous = id == 0 ? NULL : &fasta_file->index[id - 1];
+    size_t begin = previous ? previous->offset + fasta_index_span(*previous, previous->length) : 0;
+    size_t start = record.offset - 1;
+    if (fasta_file->map.data)
+    {
+        const char* data = fasta_file->map.data;
+        while (start > begin && data[start - 1] != '\n')
+        {
+            --start;
+        }
+        return start;
+    }
+    size_t gap_size = record.offset - begin;
+    char* gap = static_cast<char*>(malloc(gap_size));
+    assert(gap);
+    fasta_file_read(fasta_file, begin, gap, gap_size);
+    while (start > begin && gap[start - begin - 1] != '\n')
+    {
+        --start;
+    }
+    free(gap);
+    return start;
+}
+
+size_t fasta_copy_kernel(HMR_FASTA_FILE* fasta_file, size_t start, size_t end, FILE* fp)
+{
+    //Let the kernel copy the bytes between the files, the rest is copied by the caller.
+    size_t copied = 0;
+#ifdef __linux__
+    if (fflush(fp) != 0)
+    {
+        return 0;
+    }
+    int in_fd = fileno(fasta_file->file), out_fd = fileno(fp);
+#ifdef FASTA_COPY_FILE_RANGE
+    bool file_range = true;
+#endif
+    while (start + copied < end)
+    {
+        size_t part = hMin(end - start - copied, static_cast<size_t>(FASTA_COPY_CHUNK));
+        ssize_t bytes;
+#ifdef FASTA_COPY_FILE_RANGE
+        if (file_range)
+        {
+            //The files on different file systems are copied by sendfile.
+            loff_t in_offset = start + copied;
+            bytes = copy_file_range(in_fd, &in_offset, out_fd, NULL, part, 0);
+            if (bytes < 0 && errno != EINTR)
+            {
+                file_range = false;
+                continue;
+            }
+        }
+        else
+#endif
+        {
+            off_t in_offset = start + copied;
+            bytes = sendfile(out_fd, in_fd, &in_offset, part);
+        }
+        if (bytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (bytes <= 0)
+        {
+            break;
+        }
+        copied += bytes;
+    }
+    //Move the stream to the end of the copied bytes.
+    if (copied > 0)
+    {
+        fseeko(fp, 0, SEEK_END);
+    }
+#endif
+    return copied;
+}
+
+void hmr_fasta_copy(HMR_FASTA_FILE* fasta_file, int32_t first, int32_t last, HMR_WRITER* writer)
+{
+    //Copy the text from the header line of the first record to the last base of the last record, and end the line.
+    const HMR_FASTA_INDEX_RECORD& record = fasta_file->index[last];
+    size_t start = fasta_record_start(fasta_file, first), end = record.offset + fasta_index_span(record, record.length);
+    if (fasta_file->map.data && end > fasta_file->map.size)
+    {
+        time_error(-1, "Failed to read FASTA sequence, the index may be outdated.");
+    }
+    //The buffered data is written before the kernel copying, the compressed output is copied through the writer.
+    if (!writer->compress)
+    {
+        hmr_writer_flush(writer);
+        start += fasta_copy_kernel(fasta_file, start, end, writer->file);
+    }
+    if (fasta_file->map.data)
+    {
+        hmr_writer_write(writer, fasta_file->map.data + start, end - start);
+    }
+    else
+    {
+        char* buffer = static_cast<char*>(malloc(HMR_READ_AHEAD_BLOCK_SIZE));
+        assert(buffer);
+        while (start < end)
+        {
+            size_t part = hMin(end - start, static_cast<size_t>(HMR_READ_AHEAD_BLOCK_SIZE));
+            fasta_file_read(fasta_file, start, buffer, part);
+            hmr_writer_write(writer, buffer, part);
+            start += part;
+        }
+        free(buffer);
+    }
+    hmr_writer_write(writer, "\n", 1);
+}
+
+void hmr_fasta_close(HMR_FASTA_FILE* fasta_file)
+{
+    if (fasta_file->map.data)
+    {
+        bin_unmap(&fasta_file->map);
+    }
+    fclose(fasta_file->file);
+    delete fasta_file;
 }
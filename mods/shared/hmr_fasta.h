@@ -1,8 +1,51 @@
 #ifndef HMR_FASTA_H
 #define HMR_FASTA_H
 
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hmr_bin_file.h"
+#include "hmr_seq_pack.h"
+#include "hmr_writer.h"
+
 typedef void (*FASTA_PROC)(int32_t, char *, size_t , char *, size_t , void *);
 
-void hmr_fasta_read(const char *filepath, FASTA_PROC parser, void *user);
+typedef void (*FASTA_PACKED_PROC)(int32_t, char *, size_t , HMR_PACKED_SEQ *, void *);
+
+void hmr_fasta_read(const char *filepath, FASTA_PROC parser, void *user, int threads = 1);
+void hmr_fasta_read_packed(const char *filepath, FASTA_PACKED_PROC parser, void *user, int threads = 1);
+
+//Record of the samtools FASTA index (.fai), the name is the header before the first space.
+typedef struct HMR_FASTA_INDEX_RECORD
+{
+    std::string name;
+    size_t length, offset, line_bases, line_width;
+} HMR_FASTA_INDEX_RECORD;
+
+typedef std::vector<HMR_FASTA_INDEX_RECORD> HMR_FASTA_INDEX;
+
+typedef struct HMR_FASTA_FILE
+{
+    HMR_FASTA_INDEX index;
+    std::unordered_map<std::string, int32_t> name_ids;
+    //The sequences are fetched from the mapping, or from the file when mapping is not supported.
+    //The records are copied from the file by the kernel when possible.
+    HMR_BIN_MAP map;
+    FILE* file;
+    std::mutex file_mutex;
+} HMR_FASTA_FILE;
+
+size_t hmr_fasta_name_size(const char* seq_name, size_t seq_name_size);
+bool hmr_fasta_index_read(const char* filepath, HMR_FASTA_INDEX& index, int threads = 1);
+HMR_FASTA_FILE* hmr_fasta_open(const char* filepath, int threads = 1);
+char* hmr_fasta_fetch(HMR_FASTA_FILE* fasta_file, int32_t id, size_t* seq_size);
+char* hmr_fasta_fetch(HMR_FASTA_FILE* fasta_file, const char* name, size_t* seq_size);
+HMR_PACKED_SEQ* hmr_fasta_fetch_packed(HMR_FASTA_FILE* fasta_file, int32_t id);
+void hmr_fasta_copy(HMR_FASTA_FILE* fasta_file, int32_t first, int32_t last, HMR_WRITER* writer);
+void hmr_fasta_close(HMR_FASTA_FILE* fasta_file);
 
 #endif // HMR_FASTA_H
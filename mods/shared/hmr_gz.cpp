@@ -1,16 +1,24 @@
 #include <cstdlib>
 #include <cassert>
 #include <cstring>
+#include <climits>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
 #include <zlib.h>
 
 #include "hmr_ui.h"
 #include "hmr_global.h"
 #include "hmr_bin_queue.h"
+#include "hmr_bin_file.h"
+#include "hmr_read_ahead.h"
 
 #include "hmr_gz.h"
 
-// 4MB Data chunk
-#define DATA_CHUNK (4194304)
+// Size of the deflate window, needed to resume at a checkpoint.
+#define GZIP_WINDOW (32768)
+// 32MB of decompressed data between checkpoints.
+#define GZIP_INDEX_SPAN (33554432)
 
 typedef struct GZIP_HEADER
 {
@@ -22,7 +30,77 @@ typedef struct GZIP_HEADER
     uint8_t os;
 } GZIP_HEADER;
 
-void hmr_gzip_parse(FILE *gz_file, HMR_BIN_QUEUE *queue)
+typedef struct GZIP_INDEX_POINT
+{
+    size_t in_offset, out_offset;
+    int32_t bits;
+} GZIP_INDEX_POINT;
+
+typedef struct GZIP_INDEX
+{
+    //Identity of the GZIP file: size and the trailer (CRC32 and ISIZE).
+    size_t gz_size;
+    char gz_trailer[8];
+    size_t raw_size;
+    std::vector<GZIP_INDEX_POINT> points;
+    //The 32KB window before each checkpoint.
+    std::vector<char> windows;
+} GZIP_INDEX;
+
+std::string hmr_gz_path_index(const char* filepath)
+{
+    return std::string(filepath) + ".hmr_gzi";
+}
+
+bool gzip_index_save(const char* filepath, const GZIP_INDEX& index)
+{
+    FILE* index_file;
+    if (!bin_open(filepath, &index_file, "wb"))
+    {
+        return false;
+    }
+    size_t point_size = index.points.size();
+    fwrite(&index.gz_size, sizeof(size_t), 1, index_file);
+    fwrite(index.gz_trailer, 1, 8, index_file);
+    fwrite(&index.raw_size, sizeof(size_t), 1, index_file);
+    fwrite(&point_size, sizeof(size_t), 1, index_file);
+    fwrite(index.points.data(), sizeof(GZIP_INDEX_POINT), point_size, index_file);
+    fwrite(index.windows.data(), 1, index.windows.size(), index_file);
+    fclose(index_file);
+    return true;
+}
+
+bool gzip_index_load(const char* filepath, GZIP_INDEX& index)
+{
+    FILE* index_file;
+    if (!bin_open(filepath, &index_file, "rb"))
+    {
+        return false;
+    }
+    size_t point_size = 0;
+    bool loaded = fread(&index.gz_size, sizeof(size_t), 1, index_file) == 1 &&
+        fread(index.gz_trailer, 1, 8, index_file) == 8 &&
+        fread(&index.raw_size, sizeof(size_t), 1, index_file) == 1 &&
+        fread(&point_size, sizeof(size_t), 1, index_file) == 1 &&
+        point_size > 0 && point_size < (index.raw_size / GZIP_WINDOW) + 2;
+    if (loaded)
+    {
+        index.points.resize(point_size);
+        index.windows.resize(point_size * GZIP_WINDOW);
+        loaded = fread(index.points.data(), sizeof(GZIP_INDEX_POINT), point_size, index_file) == point_size &&
+            fread(index.windows.data(), 1, index.windows.size(), index_file) == index.windows.size();
+    }
+    fclose(index_file);
+    return loaded;
+}
+
+bool gzip_index_match(const GZIP_INDEX& index, const HMR_BIN_MAP& map)
+{
+    return map.size == index.gz_size && map.size >= 8 &&
+        memcmp(map.data + map.size - 8, index.gz_trailer, 8) == 0;
+}
+
+void hmr_gzip_parse(FILE *gz_file, HMR_BIN_QUEUE *queue, std::string index_path)
 {
     //Prepare the zstream.
     z_stream strm;
@@ -43,71 +121,258 @@ void hmr_gzip_parse(FILE *gz_file, HMR_BIN_QUEUE *queue)
 #else
     size_t total_size = ftello64(gz_file);
 #endif
+    //Build the checkpoint index while decompressing when requested.
+    bool build_index = !index_path.empty() && total_size >= 8;
+    GZIP_INDEX index;
+    if (build_index)
+    {
+        fseek(gz_file, -8L, SEEK_END);
+        build_index = fread(index.gz_trailer, 1, 8, gz_file) == 8;
+        index.gz_size = total_size;
+    }
     fseek(gz_file, 0L, SEEK_SET);
-    //Allocate the memory for binary reading.
-    char *gz_buffer = static_cast<char *>(malloc(DATA_CHUNK));
-    if (NULL == gz_buffer)
-    {
-        time_error(-1, "Failed to allocate GZIP reading buffer.");
-    }
-    //Read the file to buffer.
-    assert(NULL != gz_buffer);
-    size_t gz_file_offset = 0;
-    assert(gz_buffer != NULL);
-    size_t gz_buffer_size = gz_file_offset = fread(gz_buffer, 1, DATA_CHUNK, gz_file);
-    //Configure the stream.
-    strm.next_in = reinterpret_cast<Bytef *>(gz_buffer);
-    strm.avail_in = gz_buffer_size;
+    //Keep the reads in flight ahead of the decompression.
+    HMR_READ_AHEAD* reader = hmr_read_ahead_open(gz_file);
+    bool input_end = false;
     int error = Z_OK;
-    while (Z_STREAM_END != error && !queue->finish)
-    {
-        //Assume all the compression ratio to be 2x.
-        size_t slice_reserved = DATA_CHUNK << 2;
-        char* slice_data = static_cast<char*>(malloc(slice_reserved));
-        strm.next_out = reinterpret_cast<Bytef*>(slice_data);
-        strm.avail_out = slice_reserved;
-        //Decompress the stream.
-        error = inflate(&strm, Z_NO_FLUSH);
-        //While the data is valid, push the output data to data slice.
-        if (Z_OK == error || Z_STREAM_END == error)
+    //Output slices are recycled by the queue.
+    size_t slice_reserved = queue->buffer_size;
+    char* slice_data = NULL;
+    while (!queue->finish)
+    {
+        //Fill the buffer when all the input is used.
+        if (strm.avail_in == 0 && !input_end)
         {
-            //Send the data.
-            hmr_bin_queue_push(queue, slice_data, slice_reserved - strm.avail_out);
+            char* gz_data = NULL;
+            size_t bytes_read = hmr_read_ahead_next(reader, &gz_data);
+            input_end = bytes_read == 0;
+            strm.next_in = reinterpret_cast<Bytef*>(gz_data);
+            strm.avail_in = static_cast<uInt>(bytes_read);
         }
-        else
+        //Prepare the output slice.
+        if (slice_data == NULL)
+        {
+            slice_data = hmr_bin_queue_alloc(queue);
+            strm.next_out = reinterpret_cast<Bytef*>(slice_data);
+            strm.avail_out = static_cast<uInt>(slice_reserved);
+        }
+        //Decompress the stream, stop at the block boundaries for indexing.
+        error = inflate(&strm, build_index ? Z_BLOCK : Z_NO_FLUSH);
+        if ((Z_OK != error && Z_STREAM_END != error) || (strm.avail_in == 0 && input_end && Z_STREAM_END != error && strm.avail_out > 0))
         {
             time_error(-1, "Error happens when reading GZIP file.");
         }
-        //Check whether we reach the end of the buffer.
-        if (strm.avail_in > 0)
+        //At a block boundary, record a checkpoint when the window is inside the slice.
+        size_t slice_used = slice_reserved - strm.avail_out;
+        if (build_index && (strm.data_type & 128) && !(strm.data_type & 64) &&
+            (index.points.empty() || (strm.total_out - index.points.back().out_offset >= GZIP_INDEX_SPAN && slice_used >= GZIP_WINDOW)))
+        {
+            index.points.push_back(GZIP_INDEX_POINT{ static_cast<size_t>(strm.total_in), static_cast<size_t>(strm.total_out), strm.data_type & 7 });
+            size_t window_offset = index.windows.size();
+            index.windows.resize(window_offset + GZIP_WINDOW);
+            if (strm.total_out > 0)
+            {
+                memcpy(index.windows.data() + window_offset, slice_data + slice_used - GZIP_WINDOW, GZIP_WINDOW);
+            }
+        }
+        //Send the data when the slice is full or the stream is complete.
+        if (strm.avail_out == 0 || Z_STREAM_END == error)
         {
-            //Move the data to the beginning of the header.
-            size_t gz_buffer_used = DATA_CHUNK - strm.avail_in;
-            memcpy(gz_buffer, gz_buffer + gz_buffer_used, strm.avail_in);
+            hmr_bin_queue_push(queue, slice_data, slice_used);
+            slice_data = NULL;
         }
-        //Reset the next input at the start of the buffer.
-        strm.next_in = reinterpret_cast<Bytef*>(gz_buffer);
-        //Check whether we can still fill the buffer.
-        if (gz_file_offset < total_size)
+        if (Z_STREAM_END == error)
         {
-            size_t bytes_expected = hMin(total_size - gz_file_offset, static_cast<size_t>(DATA_CHUNK - strm.avail_in));
-            //Fill the buffer.
-            fread(gz_buffer + strm.avail_in, 1, bytes_expected, gz_file);
-            strm.avail_in += bytes_expected;
+            break;
+        }
+    }
+    if (slice_data)
+    {
+        hmr_bin_queue_release(queue, slice_data);
+    }
+    //Save the index, only when the entire stream is parsed.
+    if (build_index && Z_STREAM_END == error && index.points.size() > 1)
+    {
+        index.raw_size = strm.total_out;
+        if (gzip_index_save(index_path.data(), index))
+        {
+            time_print("GZIP index saved to %s", index_path.data());
         }
     }
     //Mark GZIP parsing complete.
     hmr_bin_queue_finish(queue);
-    // The parsing is completed, free the buffer.
-    free(gz_buffer);
+    // The parsing is completed, stop reading.
+    hmr_read_ahead_close(reader);
     //Close the zlib stream.
     inflateEnd(&strm);
 }
 
-HMR_GZ_HANDLER *hmr_gz_open_read(const char *filepath)
+bool gzip_inflate_chunk(const HMR_BIN_MAP* map, const GZIP_INDEX_POINT& point, const char* window, char* raw, size_t raw_size)
+{
+    //Prepare the raw deflate stream.
+    z_stream strm;
+    strm.zalloc = Z_NULL;
+    strm.zfree = Z_NULL;
+    strm.opaque = Z_NULL;
+    strm.avail_in = 0;
+    strm.next_in = Z_NULL;
+    if (Z_OK != inflateInit2(&strm, -MAX_WBITS))
+    {
+        return false;
+    }
+    //Resume at the checkpoint: the rest bits of the previous byte and the window.
+    if (point.bits)
+    {
+        inflatePrime(&strm, point.bits, static_cast<uint8_t>(map->data[point.in_offset - 1]) >> (8 - point.bits));
+    }
+    if (point.out_offset)
+    {
+        inflateSetDictionary(&strm, reinterpret_cast<const Bytef*>(window), GZIP_WINDOW);
+    }
+    size_t in_offset = point.in_offset;
+    strm.next_out = reinterpret_cast<Bytef*>(raw);
+    strm.avail_out = static_cast<uInt>(raw_size);
+    int error = Z_OK;
+    while (strm.avail_out > 0 && Z_OK == error)
+    {
+        if (strm.avail_in == 0)
+        {
+            if (in_offset == map->size)
+            {
+                break;
+            }
+            strm.next_in = reinterpret_cast<Bytef*>(map->data + in_offset);
+            strm.avail_in = static_cast<uInt>(hMin(map->size - in_offset, static_cast<size_t>(UINT_MAX)));
+            in_offset += strm.avail_in;
+        }
+        error = inflate(&strm, Z_NO_FLUSH);
+    }
+    inflateEnd(&strm);
+    return strm.avail_out == 0;
+}
+
+typedef struct GZIP_PIPELINE
+{
+    std::vector<char*> chunks;
+    std::vector<bool> completed;
+    size_t claimed, emitted, window;
+    bool stop;
+    std::mutex mutex;
+    std::condition_variable work_cv, emit_cv;
+} GZIP_PIPELINE;
+
+inline size_t gzip_chunk_size(const GZIP_INDEX* index, size_t i)
+{
+    return ((i + 1 < index->points.size()) ? index->points[i + 1].out_offset : index->raw_size) - index->points[i].out_offset;
+}
+
+void hmr_gzip_decompress(const HMR_BIN_MAP* map, const GZIP_INDEX* index, GZIP_PIPELINE* pipeline)
+{
+    for (;;)
+    {
+        //Claim the next chunk inside the window.
+        size_t chunk_id;
+        {
+            std::unique_lock<std::mutex> lock(pipeline->mutex);
+            pipeline->work_cv.wait(lock, [&] { return pipeline->stop || pipeline->claimed == pipeline->chunks.size() || pipeline->claimed < pipeline->emitted + pipeline->window; });
+            if (pipeline->stop || pipeline->claimed == pipeline->chunks.size())
+            {
+                return;
+            }
+            chunk_id = pipeline->claimed++;
+        }
+        //Decompress the chunk from its checkpoint.
+        size_t chunk_size = gzip_chunk_size(index, chunk_id);
+        char* chunk = static_cast<char*>(malloc(chunk_size));
+        assert(chunk);
+        if (!gzip_inflate_chunk(map, index->points[chunk_id], index->windows.data() + chunk_id * GZIP_WINDOW, chunk, chunk_size))
+        {
+            time_error(-1, "Error happens when reading GZIP file.");
+        }
+        std::unique_lock<std::mutex> lock(pipeline->mutex);
+        pipeline->chunks[chunk_id] = chunk;
+        pipeline->completed[chunk_id] = true;
+        pipeline->emit_cv.notify_one();
+    }
+}
+
+void hmr_gzip_parse_indexed(HMR_BIN_MAP* map, GZIP_INDEX* index, HMR_BIN_QUEUE* queue, int threads)
+{
+    //Start the workers, each decompress chunks between checkpoints.
+    GZIP_PIPELINE pipeline;
+    size_t chunk_size = index->points.size();
+    pipeline.chunks.assign(chunk_size, NULL);
+    pipeline.completed.assign(chunk_size, false);
+    pipeline.claimed = 0;
+    pipeline.emitted = 0;
+    pipeline.window = threads + 1;
+    pipeline.stop = false;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i)
+    {
+        workers.push_back(std::thread(hmr_gzip_decompress, map, index, &pipeline));
+    }
+    //Send the chunks in order.
+    for (size_t i = 0; i < chunk_size && !queue->finish; ++i)
+    {
+        char* chunk;
+        {
+            std::unique_lock<std::mutex> lock(pipeline.mutex);
+            pipeline.emit_cv.wait(lock, [&] { return pipeline.completed[i]; });
+            chunk = pipeline.chunks[i];
+            pipeline.chunks[i] = NULL;
+        }
+        hmr_bin_queue_push(queue, chunk, gzip_chunk_size(index, i));
+        //Release the decompressed pages.
+        bin_map_release(map, index->points[i].in_offset, (i + 1 < chunk_size) ? index->points[i + 1].in_offset : 0);
+        std::unique_lock<std::mutex> lock(pipeline.mutex);
+        ++pipeline.emitted;
+        pipeline.work_cv.notify_all();
+    }
+    {
+        std::unique_lock<std::mutex> lock(pipeline.mutex);
+        pipeline.stop = true;
+        pipeline.work_cv.notify_all();
+    }
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    //Free the chunks which are never sent.
+    for (char* chunk : pipeline.chunks)
+    {
+        free(chunk);
+    }
+    hmr_bin_queue_finish(queue);
+    delete index;
+}
+
+HMR_GZ_HANDLER *hmr_gz_open_read(const char *filepath, int threads)
 {
     //Read the GZIP file.
     HMR_GZ_HANDLER *gz_handler = new HMR_GZ_HANDLER();
+    gz_handler->gz_file = NULL;
+    gz_handler->gz_map = HMR_BIN_MAP{ NULL, 0 };
+    //Prepare the buffer.
+    hmr_bin_buf_create(&gz_handler->buffer);
+    //Decompress in parallel when the checkpoint index is available.
+    std::string index_path = hmr_gz_path_index(filepath);
+    if (threads > 1)
+    {
+        GZIP_INDEX* index = new GZIP_INDEX();
+        if (gzip_index_load(index_path.data(), *index) && bin_map(filepath, &gz_handler->gz_map, false))
+        {
+            if (gzip_index_match(*index, gz_handler->gz_map))
+            {
+                //Chunks between checkpoints have different sizes, they are not pooled.
+                hmr_bin_queue_create(&(gz_handler->queue), hmr_bin_queue_tuning.depth);
+                gz_handler->parse_thread = std::thread(hmr_gzip_parse_indexed, &gz_handler->gz_map, index, gz_handler->queue, threads);
+                return gz_handler;
+            }
+            bin_unmap(&gz_handler->gz_map);
+        }
+        delete index;
+    }
 #ifdef _MSC_VER
     FILE *gz_file = NULL;
     fopen_s(&gz_file, filepath, "rb");
@@ -119,12 +384,10 @@ HMR_GZ_HANDLER *hmr_gz_open_read(const char *filepath)
         time_error(1, "Failed to open GZIP file %s", filepath);
     }
     gz_handler->gz_file = gz_file;
-    //Allocate the processing queue, 3 for triple buffer.
-    hmr_bin_queue_create(&(gz_handler->queue), 3);
-    //Prepare the buffer.
-    hmr_bin_buf_create(&gz_handler->buffer);
-    //Start the GZIP parsing thread.
-    gz_handler->parse_thread = std::thread(hmr_gzip_parse, gz_file, gz_handler->queue);
+    //Allocate the processing queue, a slice should hold at least one checkpoint window.
+    hmr_bin_queue_create(&(gz_handler->queue), hmr_bin_queue_tuning.depth, hMax(hmr_bin_queue_tuning.buffer_size, static_cast<size_t>(GZIP_WINDOW << 1)));
+    //Start the GZIP parsing thread, build the index for the next reading when using multiple threads.
+    gz_handler->parse_thread = std::thread(hmr_gzip_parse, gz_file, gz_handler->queue, threads > 1 ? index_path : std::string());
     //Provide the GZIP handler.
     return gz_handler;
 }
@@ -139,8 +402,16 @@ void hmr_gz_close_read(HMR_GZ_HANDLER* gz_handler)
     //Wait for parse thread to complete.
     gz_handler->parse_thread.join();
     //Free the queue and buffer.
-    hmr_bin_buf_free(gz_handler->buffer);
+    hmr_bin_buf_free(gz_handler->buffer, gz_handler->queue);
     hmr_bin_queue_free(gz_handler->queue);
     //Close the file.
-    fclose(gz_handler->gz_file);
+    if (gz_handler->gz_map.data)
+    {
+        bin_unmap(&gz_handler->gz_map);
+    }
+    else
+    {
+        fclose(gz_handler->gz_file);
+    }
+    delete gz_handler;
 }
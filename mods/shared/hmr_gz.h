@@ -2,8 +2,11 @@
 #define HMR_GZ_H
 
 #include <cstdio>
+#include <string>
 #include <thread>
 
+#include "hmr_bin_file.h"
+
 typedef struct HMR_BIN_QUEUE HMR_BIN_QUEUE;
 typedef struct HMR_BIN_DATA_BUF HMR_BIN_DATA_BUF;
 
@@ -12,10 +15,12 @@ typedef struct HMR_GZ_HANDLER
     HMR_BIN_QUEUE *queue;
     HMR_BIN_DATA_BUF *buffer;
     FILE* gz_file;
+    HMR_BIN_MAP gz_map;
     std::thread parse_thread;
 } HMR_GZ_HANDLER;
 
-HMR_GZ_HANDLER *hmr_gz_open_read(const char *filepath);
+std::string hmr_gz_path_index(const char* filepath);
+HMR_GZ_HANDLER *hmr_gz_open_read(const char *filepath, int threads = 1);
 void hmr_gz_close_read(HMR_GZ_HANDLER* gz_handler);
 
 #endif // HMR_GZ_H
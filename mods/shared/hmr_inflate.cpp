@@ -0,0 +1,123 @@
+#include <cstdlib>
+
+#if defined(HMR_INFLATE_LIBDEFLATE)
+#include <libdeflate.h>
+#elif defined(HMR_INFLATE_ZLIB_NG)
+#include <zlib-ng.h>
+#else
+#include <zlib.h>
+#endif
+
+#include "hmr_ui.h"
+
+#include "hmr_inflate.h"
+
+#if defined(HMR_INFLATE_LIBDEFLATE)
+typedef struct HMR_INFLATE
+{
+    libdeflate_decompressor* decompressor;
+} HMR_INFLATE;
+
+HMR_INFLATE* hmr_inflate_create()
+{
+    HMR_INFLATE* inflater = new HMR_INFLATE();
+    inflater->decompressor = libdeflate_alloc_decompressor();
+    if (NULL == inflater->decompressor)
+    {
+        time_error(-1, "Failed to initialize decompressor.");
+    }
+    return inflater;
+}
+
+bool hmr_inflate_raw(HMR_INFLATE* inflater, const char* cdata, size_t cdata_size, char* raw, size_t raw_size)
+{
+    //The whole block is decoded at once, output size must be exactly matched.
+    size_t actual_size = 0;
+    return LIBDEFLATE_SUCCESS == libdeflate_deflate_decompress(inflater->decompressor, cdata, cdata_size, raw, raw_size, &actual_size) &&
+        actual_size == raw_size;
+}
+
+void hmr_inflate_free(HMR_INFLATE* inflater)
+{
+    libdeflate_free_decompressor(inflater->decompressor);
+    delete inflater;
+}
+#elif defined(HMR_INFLATE_ZLIB_NG)
+typedef struct HMR_INFLATE
+{
+    zng_stream strm;
+} HMR_INFLATE;
+
+HMR_INFLATE* hmr_inflate_create()
+{
+    HMR_INFLATE* inflater = new HMR_INFLATE();
+    inflater->strm.zalloc = NULL;
+    inflater->strm.zfree = NULL;
+    inflater->strm.opaque = NULL;
+    inflater->strm.next_in = NULL;
+    inflater->strm.avail_in = 0;
+    //Raw deflate data, no header.
+    if (Z_OK != zng_inflateInit2(&inflater->strm, -15))
+    {
+        time_error(-1, "Failed to initialize decompressor stream.");
+    }
+    return inflater;
+}
+
+bool hmr_inflate_raw(HMR_INFLATE* inflater, const char* cdata, size_t cdata_size, char* raw, size_t raw_size)
+{
+    zng_stream& strm = inflater->strm;
+    //Reuse the stream state and window of the last block.
+    zng_inflateReset(&strm);
+    strm.next_in = reinterpret_cast<const uint8_t*>(cdata);
+    strm.avail_in = static_cast<uint32_t>(cdata_size);
+    strm.next_out = reinterpret_cast<uint8_t*>(raw);
+    strm.avail_out = static_cast<uint32_t>(raw_size);
+    return Z_STREAM_END == zng_inflate(&strm, Z_FINISH) && strm.avail_out == 0;
+}
+
+void hmr_inflate_free(HMR_INFLATE* inflater)
+{
+    zng_inflateEnd(&inflater->strm);
+    delete inflater;
+}
+#else
+typedef struct HMR_INFLATE
+{
+    z_stream strm;
+} HMR_INFLATE;
+
+HMR_INFLATE* hmr_inflate_create()
+{
+    HMR_INFLATE* inflater = new HMR_INFLATE();
+    inflater->strm.zalloc = Z_NULL;
+    inflater->strm.zfree = Z_NULL;
+    inflater->strm.opaque = Z_NULL;
+    inflater->strm.next_in = Z_NULL;
+    inflater->strm.avail_in = 0;
+    //Raw deflate data, no header.
+    if (Z_OK != inflateInit2(&inflater->strm, -15))
+    {
+        time_error(-1, "Failed to initialize decompressor stream.");
+    }
+    return inflater;
+}
+
+bool hmr_inflate_raw(HMR_INFLATE* inflater, const char* cdata, size_t cdata_size, char* raw, size_t raw_size)
+{
+    z_stream& strm = inflater->strm;
+    //Reuse the stream state and window of the last block.
+    inflateReset(&strm);
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(cdata));
+    strm.avail_in = static_cast<uInt>(cdata_size);
+    strm.next_out = reinterpret_cast<Bytef*>(raw);
+    strm.avail_out = static_cast<uInt>(raw_size);
+    return Z_STREAM_END == inflate(&strm, Z_FINISH) && strm.avail_out == 0;
+}
+
+void hmr_inflate_free(HMR_INFLATE* inflater)
+{
+    inflateEnd(&inflater->strm);
+    delete inflater;
+}
+#endif
@@ -0,0 +1,12 @@
+#ifndef HMR_INFLATE_H
+#define HMR_INFLATE_H
+
+#include <cstddef>
+
+typedef struct HMR_INFLATE HMR_INFLATE;
+
+HMR_INFLATE* hmr_inflate_create();
+bool hmr_inflate_raw(HMR_INFLATE* inflater, const char* cdata, size_t cdata_size, char* raw, size_t raw_size);
+void hmr_inflate_free(HMR_INFLATE* inflater);
+
+#endif // HMR_INFLATE_H
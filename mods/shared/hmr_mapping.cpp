@@ -1,10 +1,19 @@
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+#include "hmr_global.h"
 #include "hmr_path.h"
 #include "hmr_ui.h"
 #include "hmr_bam.h"
+#include "hmr_bgzf.h"
+#include "hmr_mapping_bin.h"
+#include "hmr_pairs.h"
 
 #include "hmr_mapping.h"
 
-void hmr_mapping_read(const char* filepath, MAPPING_PROC proc, void* user, int threads)
+void hmr_mapping_read(const char* filepath, MAPPING_PROC proc, void* user, int threads, const MAPPING_REF_SET* refs, HMR_BGZF_WORKERS* workers)
 {
     // Based on the suffix of the file path, decide how to load the file.
     std::string mapping_suffix = path_suffix(filepath);
@@ -12,10 +21,65 @@ void hmr_mapping_read(const char* filepath, MAPPING_PROC proc, void* user, int t
     if (mapping_suffix == ".bam")
     {
         //Read the file as bam.
-        hmr_bam_read(filepath, proc, user, threads);
+        hmr_bam_read(filepath, proc, user, threads, refs, workers);
+    }
+    else if (mapping_suffix == ".pairs" || (mapping_suffix == ".gz" && path_suffix(filepath, strlen(filepath) - 3) == ".pairs"))
+    {
+        //Read the file as 4DN pairs, the compressed file is decompressed by the text reader.
+        hmr_pairs_read(filepath, proc, user, threads, refs);
+    }
+    else if (mapping_suffix == ".hmr_mapping")
+    {
+        //Read the mapped reads saved by draft.
+        hmr_mapping_bin_read(filepath, proc, user, threads, refs);
     }
     else
     {
         time_error(-1, "Unknown mapping file suffix: %s", mapping_suffix.data());
     }
 }
+
+void hmr_mapping_read(const std::vector<char*>& filepaths, MAPPING_PROC proc, void* user, int threads, const MAPPING_REF_SET* refs)
+{
+    //Without sharding, the files could only be loaded one by one.
+    if (!proc.proc_shard_create || !proc.proc_shard_merge)
+    {
+        for (char* filepath : filepaths)
+        {
+            time_print("Loading reads from %s", filepath);
+            hmr_mapping_read(filepath, proc, user, threads, refs);
+        }
+        return;
+    }
+    //Load the files concurrently, the threads are shared by the loading files.
+    //The BAM decompress workers are shared, so the files still loading could use the workers of the finished ones.
+    //Each file only keeps the decompressed batches of its share of the workers.
+    int file_threads = hMin(static_cast<int>(filepaths.size()), hMax(threads, 1));
+    int threads_per_file = hMax(threads / hMax(file_threads, 1), 1);
+    HMR_BGZF_WORKERS* bgzf_workers = hmr_bgzf_workers_create(threads, file_threads);
+    std::atomic<size_t> file_index(0);
+    std::mutex merge_mutex;
+    auto file_worker = [&]
+    {
+        for (size_t i = file_index++; i < filepaths.size(); i = file_index++)
+        {
+            time_print("Loading reads from %s", filepaths[i]);
+            //Each file has its own user, including the contig id map.
+            void* file_user = proc.proc_shard_create(user);
+            hmr_mapping_read(filepaths[i], proc, file_user, threads_per_file, refs, bgzf_workers);
+            std::unique_lock<std::mutex> merge_lock(merge_mutex);
+            proc.proc_shard_merge(file_user, user);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int i = 1; i < file_threads; ++i)
+    {
+        workers.push_back(std::thread(file_worker));
+    }
+    file_worker();
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    hmr_bgzf_workers_free(bgzf_workers);
+}
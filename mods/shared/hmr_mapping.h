@@ -1,8 +1,13 @@
 #ifndef HMR_MAPPING_H
 #define HMR_MAPPING_H
 
+#include <vector>
+
 #include "hmr_mapping_type.h"
 
-void hmr_mapping_read(const char* filepath, MAPPING_PROC proc, void *user, int threads);
+typedef struct HMR_BGZF_WORKERS HMR_BGZF_WORKERS;
+
+void hmr_mapping_read(const char* filepath, MAPPING_PROC proc, void *user, int threads, const MAPPING_REF_SET* refs = NULL, HMR_BGZF_WORKERS* workers = NULL);
+void hmr_mapping_read(const std::vector<char*>& filepaths, MAPPING_PROC proc, void* user, int threads, const MAPPING_REF_SET* refs = NULL);
 
 #endif // HMR_MAPPING_H
\ No newline at end of file
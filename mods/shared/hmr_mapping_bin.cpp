@@ -0,0 +1,517 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+#include "hmr_bin_file.h"
+#include "hmr_global.h"
+#include "hmr_mapping_shard.h"
+#include "hmr_ui.h"
+
+#include "hmr_mapping_bin.h"
+
+#define MAPPING_DUMP_RECORDS (65536)
+#define MAPPING_BIN_CHUNK (65536)
+//Records sorted in memory at once when sorting the dump, about 272 MB.
+#define MAPPING_SORT_RUN (16777216)
+
+typedef struct MAPPING_DUMP_USER
+{
+    HMR_MAPPING_DUMP* dump;
+    void* user;
+    //Map from the reference id of the loading file to the dumped contig id.
+    std::vector<int32_t> ref_ids;
+    HMR_MAPPING_BIN_RECORD* records;
+    size_t used;
+} MAPPING_DUMP_USER;
+
+typedef struct MAPPING_SORT_RUN_READER
+{
+    //Next record to read and the end of the run.
+    uint64_t next, end;
+    HMR_MAPPING_BIN_RECORD* buffer;
+    size_t used, size;
+} MAPPING_SORT_RUN_READER;
+
+typedef struct MAPPING_BIN_SOURCE
+{
+    FILE* file;
+    HMR_BIN_MAP map;
+    HMR_MAPPING_BIN_RECORD* buffer;
+} MAPPING_BIN_SOURCE;
+
+inline void mapping_bin_seek(FILE* file, uint64_t offset)
+{
+#ifdef _MSC_VER
+    _fseeki64(file, offset, SEEK_SET);
+#else
+    fseeko(file, offset, SEEK_SET);
+#endif
+}
+
+inline uint64_t mapping_bin_record_offset(uint64_t index)
+{
+    return sizeof(HMR_MAPPING_BIN_HEADER) + index * sizeof(HMR_MAPPING_BIN_RECORD);
+}
+
+inline HMR_MAPPING_BIN_RECORD mapping_bin_record_at(MAPPING_BIN_SOURCE& source, uint64_t index)
+{
+    HMR_MAPPING_BIN_RECORD record;
+    if (source.map.data)
+    {
+        memcpy(&record, source.map.data + mapping_bin_record_offset(index), sizeof(HMR_MAPPING_BIN_RECORD));
+        return record;
+    }
+    mapping_bin_seek(source.file, mapping_bin_record_offset(index));
+    if (fread(&record, sizeof(HMR_MAPPING_BIN_RECORD), 1, source.file) != 1)
+    {
+        time_error(-1, "Mapping file is truncated.");
+    }
+    return record;
+}
+
+uint64_t mapping_bin_lower_bound(MAPPING_BIN_SOURCE& source, uint64_t n_records, int32_t refID)
+{
+    //Find the first record whose reference is not less than the reference in sorted records.
+    uint64_t low = 0, high = n_records;
+    while (low < high)
+    {
+        uint64_t mid = low + ((high - low) >> 1);
+        if (mapping_bin_record_at(source, mid).refID < refID)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+template <typename T>
+void mapping_bin_records(MAPPING_BIN_SOURCE& source, uint64_t begin, uint64_t end, T proc_read)
+{
+    //Read the records directly from the mapped file.
+    if (source.map.data)
+    {
+        const HMR_MAPPING_BIN_RECORD* records = reinterpret_cast<const HMR_MAPPING_BIN_RECORD*>(source.map.data + sizeof(HMR_MAPPING_BIN_HEADER));
+        for (uint64_t i = begin; i < end; ++i)
+        {
+            proc_read(i, records[i]);
+        }
+        return;
+    }
+    //Or else read the records in chunks.
+    mapping_bin_seek(source.file, mapping_bin_record_offset(begin));
+    while (begin < end)
+    {
+        size_t count = static_cast<size_t>(hMin(end - begin, static_cast<uint64_t>(MAPPING_BIN_CHUNK)));
+        if (fread(source.buffer, sizeof(HMR_MAPPING_BIN_RECORD), count, source.file) != count)
+        {
+            time_error(-1, "Mapping file is truncated.");
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            proc_read(begin + i, source.buffer[i]);
+        }
+        begin += count;
+    }
+}
+
+void hmr_mapping_bin_read(const char* filepath, MAPPING_PROC proc, void* user, int threads, const MAPPING_REF_SET* refs)
+{
+    MAPPING_BIN_SOURCE source;
+    if (!bin_open(filepath, &source.file, "rb"))
+    {
+        time_error(-1, "Failed to open mapping file %s", filepath);
+    }
+    HMR_MAPPING_BIN_HEADER header;
+    if (fread(&header, sizeof(HMR_MAPPING_BIN_HEADER), 1, source.file) != 1 ||
+        strncmp(header.magic, HMR_MAPPING_BIN_MAGIC, 4))
+    {
+        time_error(-1, "Invalid mapping file %s", filepath);
+    }
+    if (header.version != HMR_MAPPING_BIN_VERSION)
+    {
+        time_error(-1, "Unsupported mapping file version %d of %s", header.version, filepath);
+    }
+    if (header.contig_offset != mapping_bin_record_offset(header.n_records))
+    {
+        time_error(-1, "Invalid mapping file %s", filepath);
+    }
+    //Read the contig table after the records.
+    mapping_bin_seek(source.file, header.contig_offset);
+    proc.proc_no_of_contig(header.n_contigs, user);
+    std::vector<bool> ref_enabled(header.n_contigs, refs == NULL);
+    std::string name;
+    for (int32_t i = 0; i < header.n_contigs; ++i)
+    {
+        int32_t name_size, length;
+        if (fread(&name_size, sizeof(int32_t), 1, source.file) != 1 || name_size <= 0)
+        {
+            time_error(-1, "Invalid contig table in mapping file %s", filepath);
+        }
+        name.resize(name_size);
+        if (fread(&name[0], sizeof(char), name_size, source.file) != static_cast<size_t>(name_size) ||
+            fread(&length, sizeof(int32_t), 1, source.file) != 1)
+        {
+            time_error(-1, "Invalid contig table in mapping file %s", filepath);
+        }
+        if (refs)
+        {
+            ref_enabled[i] = refs->find(name) != refs->end();
+        }
+        proc.proc_contig(name_size, &name[0], length, user);
+    }
+    //Map the records when possible.
+    source.map.data = NULL;
+    source.buffer = NULL;
+    if (bin_map(filepath, &source.map) && source.map.size < header.contig_offset)
+    {
+        time_error(-1, "Mapping file %s is truncated.", filepath);
+    }
+    if (!source.map.data)
+    {
+        source.buffer = static_cast<HMR_MAPPING_BIN_RECORD*>(malloc(sizeof(HMR_MAPPING_BIN_RECORD) * MAPPING_BIN_CHUNK));
+        assert(source.buffer);
+    }
+    //Find the records to load, the records of a reference are continuous when sorted.
+    std::vector<std::pair<uint64_t, uint64_t> > ranges;
+    if (refs && header.sorted)
+    {
+        for (int32_t i = 0; i < header.n_contigs; ++i)
+        {
+            if (ref_enabled[i])
+            {
+                ranges.push_back(std::make_pair(mapping_bin_lower_bound(source, header.n_records, i), mapping_bin_lower_bound(source, header.n_records, i + 1)));
+            }
+        }
+    }
+    else
+    {
+        ranges.push_back(std::make_pair(static_cast<uint64_t>(0), header.n_records));
+    }
+    //Send the records to the shards, the batch process or the read process.
+    MAPPING_SINK sink;
+    hmr_mapping_sink_start(sink, proc, user, threads);
+    uint32_t n_contigs = static_cast<uint32_t>(header.n_contigs);
+    for (const auto& range : ranges)
+    {
+        mapping_bin_records(source, range.first, range.second, [&](uint64_t id, const HMR_MAPPING_BIN_RECORD& record)
+            {
+                //Skip the records of a damaged file which are out of the contig table.
+                if (static_cast<uint32_t>(record.refID) >= n_contigs || static_cast<uint32_t>(record.next_refID) >= n_contigs)
+                {
+                    return;
+                }
+                if (refs == NULL || ref_enabled[record.refID])
+                {
+                    hmr_mapping_sink_push(sink, id, MAPPING_INFO{ record.refID, record.pos, record.next_refID, record.next_pos, record.mapq });
+                }
+            });
+    }
+    hmr_mapping_sink_finish(sink);
+    if (source.map.data)
+    {
+        bin_unmap(&source.map);
+    }
+    free(source.buffer);
+    fclose(source.file);
+}
+
+MAPPING_DUMP_USER* mapping_dump_user_create(HMR_MAPPING_DUMP* dump, void* user)
+{
+    MAPPING_DUMP_USER* dump_user = new MAPPING_DUMP_USER();
+    dump_user->dump = dump;
+    dump_user->user = user;
+    dump_user->records = static_cast<HMR_MAPPING_BIN_RECORD*>(malloc(sizeof(HMR_MAPPING_BIN_RECORD) * MAPPING_DUMP_RECORDS));
+    assert(dump_user->records);
+    dump_user->used = 0;
+    return dump_user;
+}
+
+void mapping_dump_flush(MAPPING_DUMP_USER* dump_user)
+{
+    if (dump_user->used == 0)
+    {
+        return;
+    }
+    HMR_MAPPING_DUMP* dump = dump_user->dump;
+    hmr_writer_write(dump->writer, dump_user->records, sizeof(HMR_MAPPING_BIN_RECORD) * dump_user->used);
+    std::unique_lock<std::mutex> lock(dump->mutex);
+    dump->n_records += dump_user->used;
+    dump_user->used = 0;
+}
+
+void mapping_dump_user_free(MAPPING_DUMP_USER* dump_user)
+{
+    mapping_dump_flush(dump_user);
+    free(dump_user->records);
+    delete dump_user;
+}
+
+void mapping_dump_n_contig(uint32_t n_contig, void* user)
+{
+    MAPPING_DUMP_USER* dump_user = static_cast<MAPPING_DUMP_USER*>(user);
+    dump_user->ref_ids.clear();
+    dump_user->ref_ids.reserve(n_contig);
+    dump_user->dump->proc.proc_no_of_contig(n_contig, dump_user->user);
+}
+
+void mapping_dump_contig(uint32_t name_size, char* name, uint32_t length, void* user)
+{
+    MAPPING_DUMP_USER* dump_user = static_cast<MAPPING_DUMP_USER*>(user);
+    HMR_MAPPING_DUMP* dump = dump_user->dump;
+    {
+        //The files could share the contigs, find the contig in the dumped contigs.
+        std::unique_lock<std::mutex> lock(dump->mutex);
+        std::string contig_name(name, name_size);
+        auto finder = dump->contig_ids.find(contig_name);
+        int32_t contig_id;
+        if (finder == dump->contig_ids.end())
+        {
+            contig_id = static_cast<int32_t>(dump->contigs.size());
+            dump->contig_ids.insert(std::make_pair(contig_name, contig_id));
+            dump->contigs.push_back(std::make_pair(contig_name, length));
+        }
+        else
+        {
+            contig_id = finder->second;
+        }
+        dump_user->ref_ids.push_back(contig_id);
+    }
+    dump->proc.proc_contig(name_size, name, length, dump_user->user);
+}
+
+inline void mapping_dump_append(MAPPING_DUMP_USER* dump_user, int32_t refID, int32_t pos, int32_t next_refID, int32_t next_pos, uint8_t mapq)
+{
+    //Only the reads with both sides mapped are saved.
+    int32_t n_refs = static_cast<int32_t>(dump_user->ref_ids.size());
+    if (refID >= 0 && refID < n_refs && next_refID >= 0 && next_refID < n_refs && pos >= 0 && next_pos >= 0)
+    {
+        dump_user->records[dump_user->used++] = HMR_MAPPING_BIN_RECORD{ dump_user->ref_ids[refID], pos, dump_user->ref_ids[next_refID], next_pos, mapq };
+        if (dump_user->used == MAPPING_DUMP_RECORDS)
+        {
+            mapping_dump_flush(dump_user);
+        }
+    }
+}
+
+void mapping_dump_read_align(size_t id, const MAPPING_INFO& info, void* user)
+{
+    MAPPING_DUMP_USER* dump_user = static_cast<MAPPING_DUMP_USER*>(user);
+    mapping_dump_append(dump_user, info.refID, info.pos, info.next_refID, info.next_pos, info.mapq);
+    dump_user->dump->proc.proc_read_align(id, info, dump_user->user);
+}
+
+void mapping_dump_read_batch(const MAPPING_BATCH& batch, void* user)
+{
+    MAPPING_DUMP_USER* dump_user = static_cast<MAPPING_DUMP_USER*>(user);
+    for (size_t i = 0; i < batch.size; ++i)
+    {
+        mapping_dump_append(dump_user, batch.refID[i], batch.pos[i], batch.next_refID[i], batch.next_pos[i], batch.mapq[i]);
+    }
+    dump_user->dump->proc.proc_read_batch(batch, dump_user->user);
+}
+
+void* mapping_dump_shard_create(void* user)
+{
+    MAPPING_DUMP_USER* dump_user = static_cast<MAPPING_DUMP_USER*>(user);
+    HMR_MAPPING_DUMP* dump = dump_user->dump;
+    MAPPING_DUMP_USER* shard_user = mapping_dump_user_create(dump, dump->proc.proc_shard_create(dump_user->user));
+    shard_user->ref_ids = dump_user->ref_ids;
+    return shard_user;
+}
+
+void mapping_dump_shard_merge(void* shard, void* user)
+{
+    MAPPING_DUMP_USER* shard_user = static_cast<MAPPING_DUMP_USER*>(shard);
+    MAPPING_DUMP_USER* dump_user = static_cast<MAPPING_DUMP_USER*>(user);
+    void* shard_proc_user = shard_user->user;
+    mapping_dump_user_free(shard_user);
+    dump_user->dump->proc.proc_shard_merge(shard_proc_user, dump_user->user);
+}
+
+HMR_MAPPING_DUMP* hmr_mapping_dump_open(const char* filepath, MAPPING_PROC& proc, void*& user)
+{
+    FILE* dump_file;
+    if (!bin_open(filepath, &dump_file, "w+b"))
+    {
+        time_error(-1, "Failed to create mapping file %s", filepath);
+    }
+    //Leave the space of the header, it is written when closing.
+    HMR_MAPPING_BIN_HEADER header{};
+    fwrite(&header, sizeof(HMR_MAPPING_BIN_HEADER), 1, dump_file);
+    HMR_MAPPING_DUMP* dump = new HMR_MAPPING_DUMP();
+    dump->filepath = filepath;
+    dump->file = dump_file;
+    dump->writer = hmr_writer_open(dump_file);
+    dump->n_records = 0;
+    dump->proc = proc;
+    dump->user = mapping_dump_user_create(dump, user);
+    //Keep the sharding and the batch process when the process supports.
+    bool sharded = proc.proc_shard_create && proc.proc_shard_merge;
+    proc = MAPPING_PROC{ mapping_dump_n_contig, mapping_dump_contig, mapping_dump_read_align,
+        sharded ? mapping_dump_shard_create : NULL, sharded ? mapping_dump_shard_merge : NULL,
+        proc.proc_read_batch ? mapping_dump_read_batch : NULL };
+    user = dump->user;
+    return dump;
+}
+
+inline bool mapping_bin_record_less(const HMR_MAPPING_BIN_RECORD& a, const HMR_MAPPING_BIN_RECORD& b)
+{
+    if (a.refID != b.refID) { return a.refID < b.refID; }
+    if (a.pos != b.pos) { return a.pos < b.pos; }
+    if (a.next_refID != b.next_refID) { return a.next_refID < b.next_refID; }
+    return a.next_pos < b.next_pos;
+}
+
+uint64_t mapping_dump_sort_runs(FILE* file, uint64_t n_records)
+{
+    //Sort the records in runs of bounded size, each run is written back to its place.
+    size_t run_size = static_cast<size_t>(hMin(n_records, static_cast<uint64_t>(MAPPING_SORT_RUN)));
+    HMR_MAPPING_BIN_RECORD* records = static_cast<HMR_MAPPING_BIN_RECORD*>(malloc(sizeof(HMR_MAPPING_BIN_RECORD) * run_size));
+    if (!records)
+    {
+        time_error(-1, "Failed to sort the mapping dump, no enough memory.");
+    }
+    uint64_t n_runs = 0;
+    for (uint64_t begin = 0; begin < n_records; begin += run_size, ++n_runs)
+    {
+        size_t count = static_cast<size_t>(hMin(n_records - begin, static_cast<uint64_t>(run_size)));
+        mapping_bin_seek(file, mapping_bin_record_offset(begin));
+        if (fread(records, sizeof(HMR_MAPPING_BIN_RECORD), count, file) != count)
+        {
+            time_error(-1, "Failed to read back the mapping dump.");
+        }
+        std::sort(records, records + count, mapping_bin_record_less);
+        mapping_bin_seek(file, mapping_bin_record_offset(begin));
+        fwrite(records, sizeof(HMR_MAPPING_BIN_RECORD), count, file);
+    }
+    free(records);
+    return n_runs;
+}
+
+inline bool mapping_sort_run_fetch(FILE* file, MAPPING_SORT_RUN_READER& run, HMR_MAPPING_BIN_RECORD& record)
+{
+    //Refill the buffer of the run when it is used up.
+    if (run.used == run.size)
+    {
+        if (run.next == run.end)
+        {
+            return false;
+        }
+        run.size = static_cast<size_t>(hMin(run.end - run.next, static_cast<uint64_t>(MAPPING_BIN_CHUNK)));
+        mapping_bin_seek(file, mapping_bin_record_offset(run.next));
+        if (fread(run.buffer, sizeof(HMR_MAPPING_BIN_RECORD), run.size, file) != run.size)
+        {
+            time_error(-1, "Failed to read back the mapping dump.");
+        }
+        run.next += run.size;
+        run.used = 0;
+    }
+    record = run.buffer[run.used++];
+    return true;
+}
+
+void mapping_dump_merge_runs(FILE* file, uint64_t n_records, FILE* target)
+{
+    //Prepare the readers of the sorted runs.
+    std::vector<MAPPING_SORT_RUN_READER> runs;
+    for (uint64_t begin = 0; begin < n_records; begin += MAPPING_SORT_RUN)
+    {
+        HMR_MAPPING_BIN_RECORD* buffer = static_cast<HMR_MAPPING_BIN_RECORD*>(malloc(sizeof(HMR_MAPPING_BIN_RECORD) * MAPPING_BIN_CHUNK));
+        assert(buffer);
+        runs.push_back(MAPPING_SORT_RUN_READER{ begin, hMin(begin + MAPPING_SORT_RUN, n_records), buffer, 0, 0 });
+    }
+    //Merge the runs by the smallest head record.
+    typedef std::pair<HMR_MAPPING_BIN_RECORD, size_t> RUN_HEAD;
+    auto head_greater = [](const RUN_HEAD& a, const RUN_HEAD& b) { return mapping_bin_record_less(b.first, a.first); };
+    std::vector<RUN_HEAD> heads;
+    HMR_MAPPING_BIN_RECORD record;
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        if (mapping_sort_run_fetch(file, runs[i], record))
+        {
+            heads.push_back(std::make_pair(record, i));
+        }
+    }
+    std::make_heap(heads.begin(), heads.end(), head_greater);
+    HMR_MAPPING_BIN_RECORD* output = static_cast<HMR_MAPPING_BIN_RECORD*>(malloc(sizeof(HMR_MAPPING_BIN_RECORD) * MAPPING_BIN_CHUNK));
+    assert(output);
+    size_t output_used = 0;
+    HMR_WRITER* writer = hmr_writer_open(target);
+    while (!heads.empty())
+    {
+        std::pop_heap(heads.begin(), heads.end(), head_greater);
+        RUN_HEAD& head = heads.back();
+        output[output_used++] = head.first;
+        if (output_used == MAPPING_BIN_CHUNK)
+        {
+            hmr_writer_write(writer, output, sizeof(HMR_MAPPING_BIN_RECORD) * output_used);
+            output_used = 0;
+        }
+        //Replace the head with the next record of the run.
+        if (mapping_sort_run_fetch(file, runs[head.second], head.first))
+        {
+            std::push_heap(heads.begin(), heads.end(), head_greater);
+        }
+        else
+        {
+            heads.pop_back();
+        }
+    }
+    hmr_writer_write(writer, output, sizeof(HMR_MAPPING_BIN_RECORD) * output_used);
+    hmr_writer_close(writer);
+    free(output);
+    for (MAPPING_SORT_RUN_READER& run : runs)
+    {
+        free(run.buffer);
+    }
+}
+
+void hmr_mapping_dump_close(HMR_MAPPING_DUMP* dump, bool sort)
+{
+    mapping_dump_user_free(dump->user);
+    hmr_writer_close(dump->writer);
+    HMR_MAPPING_BIN_HEADER header{ {}, HMR_MAPPING_BIN_VERSION, dump->n_records, mapping_bin_record_offset(dump->n_records),
+        static_cast<int32_t>(dump->contigs.size()), sort ? 1 : 0 };
+    memcpy(header.magic, HMR_MAPPING_BIN_MAGIC, 4);
+    //The sorted runs are merged into a new file, which replaces the dump.
+    std::string sort_path;
+    if (sort && mapping_dump_sort_runs(dump->file, dump->n_records) > 1)
+    {
+        sort_path = dump->filepath + ".sort";
+        FILE* sort_file;
+        if (!bin_open(sort_path.data(), &sort_file, "wb"))
+        {
+            time_error(-1, "Failed to create mapping file %s", sort_path.data());
+        }
+        fwrite(&header, sizeof(HMR_MAPPING_BIN_HEADER), 1, sort_file);
+        mapping_dump_merge_runs(dump->file, dump->n_records, sort_file);
+        fclose(dump->file);
+        dump->file = sort_file;
+    }
+    //Write the contig table after the records.
+    mapping_bin_seek(dump->file, header.contig_offset);
+    for (const auto& contig : dump->contigs)
+    {
+        int32_t name_size = static_cast<int32_t>(contig.first.size()), length = static_cast<int32_t>(contig.second);
+        fwrite(&name_size, sizeof(int32_t), 1, dump->file);
+        fwrite(contig.first.data(), sizeof(char), name_size, dump->file);
+        fwrite(&length, sizeof(int32_t), 1, dump->file);
+    }
+    mapping_bin_seek(dump->file, 0);
+    fwrite(&header, sizeof(HMR_MAPPING_BIN_HEADER), 1, dump->file);
+    fclose(dump->file);
+    if (!sort_path.empty())
+    {
+        remove(dump->filepath.data());
+        if (rename(sort_path.data(), dump->filepath.data()))
+        {
+            time_error(-1, "Failed to save the sorted mapping file %s", dump->filepath.data());
+        }
+    }
+    delete dump;
+}
@@ -0,0 +1,62 @@
+#ifndef HMR_MAPPING_BIN_H
+#define HMR_MAPPING_BIN_H
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hmr_mapping_type.h"
+#include "hmr_writer.h"
+
+//Magic string and the layout version of the file.
+#define HMR_MAPPING_BIN_MAGIC "HMRM"
+#define HMR_MAPPING_BIN_VERSION (1)
+
+//File layout: header, records, then the contig table (name size, name, length) at contig offset.
+typedef struct HMR_MAPPING_BIN_HEADER
+{
+    char magic[4];
+    int32_t version;
+    uint64_t n_records;
+    uint64_t contig_offset;
+    int32_t n_contigs;
+    //Non-zero when the records are sorted by reference and position.
+    int32_t sorted;
+} HMR_MAPPING_BIN_HEADER;
+
+#pragma pack(push, 1)
+typedef struct HMR_MAPPING_BIN_RECORD
+{
+    int32_t refID;
+    int32_t pos;
+    int32_t next_refID;
+    int32_t next_pos;
+    uint8_t mapq;
+} HMR_MAPPING_BIN_RECORD;
+#pragma pack(pop)
+
+typedef struct MAPPING_DUMP_USER MAPPING_DUMP_USER;
+
+typedef struct HMR_MAPPING_DUMP
+{
+    std::string filepath;
+    FILE* file;
+    HMR_WRITER* writer;
+    std::mutex mutex;
+    std::unordered_map<std::string, int32_t> contig_ids;
+    std::vector<std::pair<std::string, uint32_t> > contigs;
+    uint64_t n_records;
+    MAPPING_PROC proc;
+    MAPPING_DUMP_USER* user;
+} HMR_MAPPING_DUMP;
+
+void hmr_mapping_bin_read(const char* filepath, MAPPING_PROC proc, void* user, int threads, const MAPPING_REF_SET* refs = NULL);
+
+//Replace the process and user with the ones writing the mapped reads to the file before processing.
+HMR_MAPPING_DUMP* hmr_mapping_dump_open(const char* filepath, MAPPING_PROC& proc, void*& user);
+void hmr_mapping_dump_close(HMR_MAPPING_DUMP* dump, bool sort = false);
+
+#endif // HMR_MAPPING_BIN_H
@@ -0,0 +1,254 @@
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+
+#include "hmr_bin_queue.h"
+#include "hmr_global.h"
+
+#include "hmr_mapping_shard.h"
+
+#define MAPPING_SHARD_RECORDS (4096)
+#define MAPPING_SHARD_QUEUE (8)
+
+void mapping_shard_process(MAPPING_PROC proc, void* shard_user, const MAPPING_SHARD_RECORD* records, size_t record_size, MAPPING_BATCH& batch)
+{
+    //Send the records as batches when possible.
+    if (proc.proc_read_batch)
+    {
+        for (size_t start = 0; start < record_size; start += batch.capacity)
+        {
+            size_t end = hMin(record_size, start + batch.capacity);
+            batch.size = 0;
+            for (size_t i = start; i < end; ++i)
+            {
+                hmr_mapping_batch_append(&batch, records[i].id, records[i].info, records[i].flag);
+            }
+            proc.proc_read_batch(batch, shard_user);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < record_size; ++i)
+        {
+            proc.proc_read_align(records[i].id, records[i].info, shard_user);
+        }
+    }
+}
+
+void mapping_shard_work(HMR_BIN_QUEUE* queue, MAPPING_PROC proc, void* shard_user)
+{
+    //Process the records until the dispatcher finished.
+    MAPPING_BATCH batch;
+    if (proc.proc_read_batch)
+    {
+        hmr_mapping_batch_create(&batch, MAPPING_SHARD_RECORDS);
+    }
+    HMR_BIN_SLICE slice = hmr_bin_queue_pop(queue);
+    while (slice.data)
+    {
+        mapping_shard_process(proc, shard_user, reinterpret_cast<MAPPING_SHARD_RECORD*>(slice.data), slice.data_size / sizeof(MAPPING_SHARD_RECORD), batch);
+        hmr_bin_queue_release(queue, slice.data);
+        slice = hmr_bin_queue_pop(queue);
+    }
+    if (proc.proc_read_batch)
+    {
+        hmr_mapping_batch_free(&batch);
+    }
+}
+
+void mapping_shard_ordered_work(MAPPING_SHARD* shard, MAPPING_PROC proc)
+{
+    //Process the records of the chunks in order, until all the chunks are processed.
+    MAPPING_BATCH batch;
+    if (proc.proc_read_batch)
+    {
+        hmr_mapping_batch_create(&batch, MAPPING_SHARD_RECORDS);
+    }
+    MAPPING_SHARD_RECORD_LIST records;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(shard->slot_mutex);
+            shard->slot_cv.wait(lock, [shard] { return shard->slots[shard->next_chunk % shard->slot_size].ready || shard->next_chunk == shard->chunk_total; });
+            MAPPING_SHARD_SLOT& slot = shard->slots[shard->next_chunk % shard->slot_size];
+            if (!slot.ready)
+            {
+                break;
+            }
+            //Take the records, leave the processed buffer for the parsers.
+            records.swap(slot.records);
+            slot.ready = false;
+            ++shard->next_chunk;
+            shard->slot_cv.notify_all();
+        }
+        mapping_shard_process(proc, shard->user, records.data(), records.size(), batch);
+        records.clear();
+    }
+    if (proc.proc_read_batch)
+    {
+        hmr_mapping_batch_free(&batch);
+    }
+}
+
+void hmr_mapping_shard_start(MAPPING_SHARDS& shards, MAPPING_PROC proc, void* user, int threads)
+{
+    //Prepare the shards, each shard is processed by a thread.
+    shards = MAPPING_SHARDS(threads);
+    for (MAPPING_SHARD& shard : shards)
+    {
+        shard.user = proc.proc_shard_create(user);
+        //The record blocks are recycled by the queue.
+        hmr_bin_queue_create(&shard.queue, MAPPING_SHARD_QUEUE, sizeof(MAPPING_SHARD_RECORD) * MAPPING_SHARD_RECORDS);
+        shard.records = reinterpret_cast<MAPPING_SHARD_RECORD*>(hmr_bin_queue_alloc(shard.queue));
+        shard.used = 0;
+        shard.slots = NULL;
+        shard.worker = std::thread(mapping_shard_work, shard.queue, proc, shard.user);
+    }
+}
+
+void hmr_mapping_shard_dispatch(MAPPING_SHARDS& shards, size_t id, const MAPPING_INFO& info, uint16_t flag)
+{
+    //Dispatch the records to the shards in batch.
+    MAPPING_SHARD& shard = shards[hmr_mapping_shard_index(info, shards.size())];
+    shard.records[shard.used] = MAPPING_SHARD_RECORD{ id, info, flag };
+    if (++shard.used == MAPPING_SHARD_RECORDS)
+    {
+        hmr_bin_queue_push(shard.queue, reinterpret_cast<char*>(shard.records), sizeof(MAPPING_SHARD_RECORD) * MAPPING_SHARD_RECORDS);
+        shard.records = reinterpret_cast<MAPPING_SHARD_RECORD*>(hmr_bin_queue_alloc(shard.queue));
+        shard.used = 0;
+    }
+}
+
+void hmr_mapping_shard_finish(MAPPING_SHARDS& shards, MAPPING_PROC proc, void* user)
+{
+    //Flush the rest records, and wait for the shards.
+    for (MAPPING_SHARD& shard : shards)
+    {
+        hmr_bin_queue_push(shard.queue, reinterpret_cast<char*>(shard.records), sizeof(MAPPING_SHARD_RECORD) * shard.used);
+        hmr_bin_queue_finish(shard.queue);
+    }
+    //Merge the shards in order.
+    for (MAPPING_SHARD& shard : shards)
+    {
+        shard.worker.join();
+        hmr_bin_queue_free(shard.queue);
+        proc.proc_shard_merge(shard.user, user);
+    }
+    shards.clear();
+}
+
+void hmr_mapping_shard_start_ordered(MAPPING_SHARDS& shards, MAPPING_PROC proc, void* user, int threads, size_t window)
+{
+    //Prepare the shards, each shard keeps the records of the latest chunks in the window.
+    shards = MAPPING_SHARDS(threads);
+    for (MAPPING_SHARD& shard : shards)
+    {
+        shard.user = proc.proc_shard_create(user);
+        shard.queue = NULL;
+        shard.records = NULL;
+        shard.used = 0;
+        shard.slots = new MAPPING_SHARD_SLOT[window];
+        for (size_t i = 0; i < window; ++i)
+        {
+            shard.slots[i].ready = false;
+        }
+        shard.slot_size = window;
+        shard.next_chunk = 0;
+        shard.chunk_total = SIZE_MAX;
+        shard.worker = std::thread(mapping_shard_ordered_work, &shard, proc);
+    }
+}
+
+void hmr_mapping_shard_deliver(MAPPING_SHARDS& shards, size_t chunk, std::vector<MAPPING_SHARD_RECORD_LIST>& records)
+{
+    //Send the records of the chunk to each shard, the processed buffers are given back.
+    for (size_t i = 0; i < shards.size(); ++i)
+    {
+        MAPPING_SHARD& shard = shards[i];
+        std::unique_lock<std::mutex> lock(shard.slot_mutex);
+        shard.slot_cv.wait(lock, [&shard, chunk] { return chunk < shard.next_chunk + shard.slot_size; });
+        MAPPING_SHARD_SLOT& slot = shard.slots[chunk % shard.slot_size];
+        slot.records.swap(records[i]);
+        slot.ready = true;
+        shard.slot_cv.notify_all();
+    }
+}
+
+void hmr_mapping_shard_finish_ordered(MAPPING_SHARDS& shards, MAPPING_PROC proc, void* user, size_t chunk_total)
+{
+    //All the chunks are delivered, wait for the shards.
+    for (MAPPING_SHARD& shard : shards)
+    {
+        std::unique_lock<std::mutex> lock(shard.slot_mutex);
+        shard.chunk_total = chunk_total;
+        shard.slot_cv.notify_all();
+    }
+    //Merge the shards in order.
+    for (MAPPING_SHARD& shard : shards)
+    {
+        shard.worker.join();
+        delete[] shard.slots;
+        proc.proc_shard_merge(shard.user, user);
+    }
+    shards.clear();
+}
+
+void hmr_mapping_batch_create(MAPPING_BATCH* batch, size_t capacity)
+{
+    //Each column is a separated array.
+    batch->size = 0;
+    batch->capacity = capacity;
+    batch->id = static_cast<size_t*>(malloc(sizeof(size_t) * capacity));
+    batch->refID = static_cast<int32_t*>(malloc(sizeof(int32_t) * capacity));
+    batch->pos = static_cast<int32_t*>(malloc(sizeof(int32_t) * capacity));
+    batch->next_refID = static_cast<int32_t*>(malloc(sizeof(int32_t) * capacity));
+    batch->next_pos = static_cast<int32_t*>(malloc(sizeof(int32_t) * capacity));
+    batch->mapq = static_cast<uint8_t*>(malloc(sizeof(uint8_t) * capacity));
+    batch->flag = static_cast<uint16_t*>(malloc(sizeof(uint16_t) * capacity));
+    assert(batch->id && batch->refID && batch->pos && batch->next_refID && batch->next_pos && batch->mapq && batch->flag);
+}
+
+void hmr_mapping_batch_free(MAPPING_BATCH* batch)
+{
+    free(batch->id);
+    free(batch->refID);
+    free(batch->pos);
+    free(batch->next_refID);
+    free(batch->next_pos);
+    free(batch->mapq);
+    free(batch->flag);
+    batch->size = 0;
+    batch->capacity = 0;
+}
+
+void hmr_mapping_sink_start(MAPPING_SINK& sink, MAPPING_PROC proc, void* user, int threads)
+{
+    sink.proc = proc;
+    sink.user = user;
+    sink.sharded = threads > 1 && proc.proc_shard_create && proc.proc_shard_merge;
+    if (sink.sharded)
+    {
+        hmr_mapping_shard_start(sink.shards, proc, user, threads);
+    }
+    else if (proc.proc_read_batch)
+    {
+        hmr_mapping_batch_create(&sink.batch, MAPPING_SHARD_RECORDS);
+    }
+}
+
+void hmr_mapping_sink_finish(MAPPING_SINK& sink)
+{
+    if (sink.sharded)
+    {
+        hmr_mapping_shard_finish(sink.shards, sink.proc, sink.user);
+    }
+    else if (sink.proc.proc_read_batch)
+    {
+        //Send the rest of the batch.
+        if (sink.batch.size > 0)
+        {
+            sink.proc.proc_read_batch(sink.batch, sink.user);
+        }
+        hmr_mapping_batch_free(&sink.batch);
+    }
+}
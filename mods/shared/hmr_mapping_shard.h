@@ -0,0 +1,113 @@
+#ifndef HMR_MAPPING_SHARD_H
+#define HMR_MAPPING_SHARD_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "hmr_global.h"
+#include "hmr_mapping_type.h"
+
+typedef struct HMR_BIN_QUEUE HMR_BIN_QUEUE;
+
+typedef struct MAPPING_SHARD_RECORD
+{
+    size_t id;
+    MAPPING_INFO info;
+    uint16_t flag;
+} MAPPING_SHARD_RECORD;
+
+typedef std::vector<MAPPING_SHARD_RECORD> MAPPING_SHARD_RECORD_LIST;
+
+//Records of a chunk sent to a shard, the buffers are swapped between the parsers and the shard.
+typedef struct MAPPING_SHARD_SLOT
+{
+    MAPPING_SHARD_RECORD_LIST records;
+    bool ready;
+} MAPPING_SHARD_SLOT;
+
+typedef struct MAPPING_SHARD
+{
+    void* user;
+    HMR_BIN_QUEUE* queue;
+    MAPPING_SHARD_RECORD* records;
+    size_t used;
+    std::thread worker;
+    //Records from the chunk parsers, processed in the order of the chunks.
+    MAPPING_SHARD_SLOT* slots;
+    size_t slot_size, next_chunk, chunk_total;
+    std::mutex slot_mutex;
+    std::condition_variable slot_cv;
+} MAPPING_SHARD;
+
+typedef std::vector<MAPPING_SHARD> MAPPING_SHARDS;
+
+inline size_t hmr_mapping_shard_index(const MAPPING_INFO& info, size_t shards)
+{
+    //Hash the unordered positions of the pair, so both reads have the same shard.
+    uint64_t a = (static_cast<uint64_t>(static_cast<uint32_t>(info.refID)) << 32) | static_cast<uint32_t>(info.pos),
+        b = (static_cast<uint64_t>(static_cast<uint32_t>(info.next_refID)) << 32) | static_cast<uint32_t>(info.next_pos);
+    uint64_t h = (hMin(a, b) * 0x9E3779B97F4A7C15ULL) ^ hMax(a, b);
+    h ^= h >> 31;
+    h *= 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 29;
+    return h % shards;
+}
+
+//Sends the reads to the shards, the batch process or the read process.
+typedef struct MAPPING_SINK
+{
+    MAPPING_PROC proc;
+    void* user;
+    bool sharded;
+    MAPPING_SHARDS shards;
+    MAPPING_BATCH batch;
+} MAPPING_SINK;
+
+void hmr_mapping_shard_start(MAPPING_SHARDS& shards, MAPPING_PROC proc, void* user, int threads);
+void hmr_mapping_shard_dispatch(MAPPING_SHARDS& shards, size_t id, const MAPPING_INFO& info, uint16_t flag = 0);
+void hmr_mapping_shard_finish(MAPPING_SHARDS& shards, MAPPING_PROC proc, void* user);
+
+void hmr_mapping_shard_start_ordered(MAPPING_SHARDS& shards, MAPPING_PROC proc, void* user, int threads, size_t window);
+void hmr_mapping_shard_deliver(MAPPING_SHARDS& shards, size_t chunk, std::vector<MAPPING_SHARD_RECORD_LIST>& records);
+void hmr_mapping_shard_finish_ordered(MAPPING_SHARDS& shards, MAPPING_PROC proc, void* user, size_t chunk_total);
+
+void hmr_mapping_batch_create(MAPPING_BATCH* batch, size_t capacity);
+void hmr_mapping_batch_free(MAPPING_BATCH* batch);
+inline void hmr_mapping_batch_append(MAPPING_BATCH* batch, size_t id, const MAPPING_INFO& info, uint16_t flag)
+{
+    size_t i = batch->size++;
+    batch->id[i] = id;
+    batch->refID[i] = info.refID;
+    batch->pos[i] = info.pos;
+    batch->next_refID[i] = info.next_refID;
+    batch->next_pos[i] = info.next_pos;
+    batch->mapq[i] = info.mapq;
+    batch->flag[i] = flag;
+}
+
+void hmr_mapping_sink_start(MAPPING_SINK& sink, MAPPING_PROC proc, void* user, int threads);
+inline void hmr_mapping_sink_push(MAPPING_SINK& sink, size_t id, const MAPPING_INFO& info, uint16_t flag = 0)
+{
+    if (sink.sharded)
+    {
+        hmr_mapping_shard_dispatch(sink.shards, id, info, flag);
+    }
+    else if (sink.proc.proc_read_batch)
+    {
+        hmr_mapping_batch_append(&sink.batch, id, info, flag);
+        if (sink.batch.size == sink.batch.capacity)
+        {
+            sink.proc.proc_read_batch(sink.batch, sink.user);
+            sink.batch.size = 0;
+        }
+    }
+    else
+    {
+        sink.proc.proc_read_align(id, info, sink.user);
+    }
+}
+void hmr_mapping_sink_finish(MAPPING_SINK& sink);
+
+#endif // HMR_MAPPING_SHARD_H
@@ -2,6 +2,8 @@
 #define HMR_MAPPING_TYPE_H
 
 #include <cstdint>
+#include <string>
+#include <unordered_set>
 
 typedef struct MAPPING_INFO
 {
@@ -12,15 +14,36 @@ typedef struct MAPPING_INFO
     uint8_t mapq;
 } MAPPING_INFO;
 
+//Names of the references to load, the reads of other references are skipped.
+typedef std::unordered_set<std::string> MAPPING_REF_SET;
+
 typedef void (*MAPPING_N_CONTIG)(uint32_t, void*);
 typedef void (*MAPPING_CONTIG)(uint32_t, char*, uint32_t, void*);
 typedef void (*MAPPING_READ_ALIGN)(size_t, const MAPPING_INFO &, void*);
+//Optional batch process: the columns of the reads are delivered together.
+typedef struct MAPPING_BATCH
+{
+    size_t size, capacity;
+    size_t* id;
+    int32_t *refID, *pos, *next_refID, *next_pos;
+    uint8_t* mapq;
+    uint16_t* flag;
+} MAPPING_BATCH;
+typedef void (*MAPPING_READ_BATCH)(const MAPPING_BATCH &, void*);
+//Optional sharding: create a user context for a parser thread from the user,
+//and merge the shard user back to the user when all the reads are parsed.
+//Both reads of a pair are always sent to the same shard.
+typedef void* (*MAPPING_SHARD_CREATE)(void*);
+typedef void (*MAPPING_SHARD_MERGE)(void*, void*);
 
 typedef struct MAPPING_PROC
 {
     MAPPING_N_CONTIG proc_no_of_contig;
     MAPPING_CONTIG proc_contig;
     MAPPING_READ_ALIGN proc_read_align;
+    MAPPING_SHARD_CREATE proc_shard_create;
+    MAPPING_SHARD_MERGE proc_shard_merge;
+    MAPPING_READ_BATCH proc_read_batch;
 } MAPPING_PROC;
 
 #endif // HMR_MAPPING_TYPE_H
\ No newline at end of file
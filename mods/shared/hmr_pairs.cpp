@@ -0,0 +1,443 @@
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hmr_global.h"
+#include "hmr_mapping_shard.h"
+#include "hmr_text_file.h"
+#include "hmr_ui.h"
+
+#include "hmr_pairs.h"
+
+#define PAIRS_BATCH_SIZE (4194304)
+#define PAIRS_MAX_COLUMNS (64)
+//Map quality of the pairs without the mapq columns.
+#define PAIRS_DEFAULT_MAPQ (60)
+
+typedef struct PAIRS_COLUMNS
+{
+    int chrom1, pos1, chrom2, pos2, mapq1, mapq2;
+    //Number of the columns required to parse a line.
+    int used;
+} PAIRS_COLUMNS;
+
+typedef struct PAIRS_PARSER
+{
+    PAIRS_COLUMNS columns;
+    std::unordered_map<std::string, int32_t> ref_ids;
+    std::vector<bool> ref_enabled;
+    const MAPPING_REF_SET* refs;
+} PAIRS_PARSER;
+
+typedef struct PAIRS_BATCH
+{
+    char* text;
+    size_t text_size, text_reserve;
+    std::vector<MAPPING_INFO> records;
+    bool parsed;
+} PAIRS_BATCH;
+
+typedef struct PAIRS_PIPELINE
+{
+    const PAIRS_PARSER* parser;
+    PAIRS_BATCH* batches;
+    size_t window;
+    //Batch index (not wrapped) of the oldest unsent batch, the next batch to parse and the next batch to fill.
+    size_t head, claimed, tail;
+    bool reader_done;
+    std::mutex mutex;
+    std::condition_variable work_cv, emit_cv;
+} PAIRS_PIPELINE;
+
+inline const char* pairs_next_token(const char* text, const char* end, size_t& size)
+{
+    //Find the next word separated by spaces.
+    while (text < end && is_space(*text))
+    {
+        ++text;
+    }
+    const char* token_end = text;
+    while (token_end < end && !is_space(*token_end))
+    {
+        ++token_end;
+    }
+    size = token_end - text;
+    return text;
+}
+
+inline bool pairs_parse_int(const char* text, size_t size, int64_t& value)
+{
+    if (size == 0 || size > 18)
+    {
+        return false;
+    }
+    value = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        if (text[i] < '0' || text[i] > '9')
+        {
+            return false;
+        }
+        value = value * 10 + (text[i] - '0');
+    }
+    return true;
+}
+
+inline bool pairs_header_is(const char* line, size_t size, const char* key)
+{
+    size_t key_size = strlen(key);
+    return size >= key_size && memcmp(line, key, key_size) == 0;
+}
+
+void pairs_parse_header(const char* line, size_t size, PAIRS_PARSER& parser, std::vector<std::pair<std::string, uint32_t> >& chroms)
+{
+    const char* end = line + size;
+    size_t token_size;
+    if (pairs_header_is(line, size, "#chromsize:"))
+    {
+        //Format: #chromsize: <name> <length>
+        const char* name = pairs_next_token(line + 11, end, token_size);
+        std::string chrom_name(name, token_size);
+        const char* length = pairs_next_token(name + token_size, end, token_size);
+        int64_t chrom_length = 0;
+        if (chrom_name.empty() || !pairs_parse_int(length, token_size, chrom_length))
+        {
+            time_error(-1, "Invalid chromsize header: %.*s", static_cast<int>(size), line);
+        }
+        chroms.push_back(std::make_pair(chrom_name, static_cast<uint32_t>(chrom_length)));
+    }
+    else if (pairs_header_is(line, size, "#columns:"))
+    {
+        //Find the columns of the positions and map qualities.
+        PAIRS_COLUMNS& columns = parser.columns;
+        columns = PAIRS_COLUMNS{ -1, -1, -1, -1, -1, -1, 0 };
+        const char* token = pairs_next_token(line + 9, end, token_size);
+        for (int index = 0; token_size > 0; ++index)
+        {
+            std::string column(token, token_size);
+            if (column == "chr1" || column == "chrom1") { columns.chrom1 = index; }
+            else if (column == "pos1") { columns.pos1 = index; }
+            else if (column == "chr2" || column == "chrom2") { columns.chrom2 = index; }
+            else if (column == "pos2") { columns.pos2 = index; }
+            else if (column == "mapq1") { columns.mapq1 = index; }
+            else if (column == "mapq2") { columns.mapq2 = index; }
+            else if (column == "mapq") { columns.mapq1 = index; columns.mapq2 = index; }
+            token = pairs_next_token(token + token_size, end, token_size);
+        }
+        if (columns.chrom1 < 0 || columns.pos1 < 0 || columns.chrom2 < 0 || columns.pos2 < 0)
+        {
+            time_error(-1, "Pairs columns must contain chr1, pos1, chr2 and pos2.");
+        }
+        columns.used = hMax(hMax(hMax(columns.chrom1, columns.pos1), hMax(columns.chrom2, columns.pos2)), hMax(columns.mapq1, columns.mapq2)) + 1;
+        if (columns.used > PAIRS_MAX_COLUMNS)
+        {
+            time_error(-1, "Too many columns before the required pairs columns.");
+        }
+    }
+}
+
+inline int32_t pairs_ref_id(const PAIRS_PARSER& parser, const char* name, size_t size)
+{
+    auto finder = parser.ref_ids.find(std::string(name, size));
+    return finder == parser.ref_ids.end() ? -1 : finder->second;
+}
+
+inline uint8_t pairs_mapq(const char* text, size_t size)
+{
+    //Like the BAM, 255 means the map quality is not available.
+    int64_t mapq;
+    if (!pairs_parse_int(text, size, mapq))
+    {
+        return 255;
+    }
+    return static_cast<uint8_t>(hMin(mapq, static_cast<int64_t>(255)));
+}
+
+void pairs_parse_line(const PAIRS_PARSER& parser, const char* line, size_t size, std::vector<MAPPING_INFO>& records)
+{
+    //Split the tab separated columns.
+    const char* fields[PAIRS_MAX_COLUMNS];
+    size_t field_sizes[PAIRS_MAX_COLUMNS];
+    const PAIRS_COLUMNS& columns = parser.columns;
+    const char* end = line + size;
+    int used = 0;
+    while (used < columns.used)
+    {
+        const char* field_end = static_cast<const char*>(memchr(line, '\t', end - line));
+        if (!field_end)
+        {
+            field_end = end;
+        }
+        fields[used] = line;
+        field_sizes[used] = field_end - line;
+        ++used;
+        if (field_end == end)
+        {
+            break;
+        }
+        line = field_end + 1;
+    }
+    if (used < columns.used)
+    {
+        return;
+    }
+    //Unmapped ("!") and unknown chromosomes are skipped.
+    int32_t ref1 = pairs_ref_id(parser, fields[columns.chrom1], field_sizes[columns.chrom1]),
+        ref2 = pairs_ref_id(parser, fields[columns.chrom2], field_sizes[columns.chrom2]);
+    int64_t pos1, pos2;
+    if (ref1 == -1 || ref2 == -1 ||
+        !pairs_parse_int(fields[columns.pos1], field_sizes[columns.pos1], pos1) || pos1 == 0 ||
+        !pairs_parse_int(fields[columns.pos2], field_sizes[columns.pos2], pos2) || pos2 == 0)
+    {
+        return;
+    }
+    uint8_t mapq1 = columns.mapq1 < 0 ? PAIRS_DEFAULT_MAPQ : pairs_mapq(fields[columns.mapq1], field_sizes[columns.mapq1]),
+        mapq2 = columns.mapq2 < 0 ? PAIRS_DEFAULT_MAPQ : pairs_mapq(fields[columns.mapq2], field_sizes[columns.mapq2]);
+    //A line is a pair, yield a record for each side like the BAM, positions are 1-based.
+    int32_t p1 = static_cast<int32_t>(pos1 - 1), p2 = static_cast<int32_t>(pos2 - 1);
+    if (parser.refs == NULL || parser.ref_enabled[ref1])
+    {
+        records.push_back(MAPPING_INFO{ ref1, p1, ref2, p2, mapq1 });
+    }
+    if (parser.refs == NULL || parser.ref_enabled[ref2])
+    {
+        records.push_back(MAPPING_INFO{ ref2, p2, ref1, p1, mapq2 });
+    }
+}
+
+void pairs_parse_batch(const PAIRS_PARSER& parser, PAIRS_BATCH& batch)
+{
+    //Parse all the lines in the batch text.
+    batch.records.clear();
+    char* line = batch.text;
+    char* end = batch.text + batch.text_size;
+    while (line < end)
+    {
+        char* line_end = static_cast<char*>(memchr(line, '\n', end - line));
+        pairs_parse_line(parser, line, line_end - line, batch.records);
+        line = line_end + 1;
+    }
+}
+
+void pairs_parse_work(PAIRS_PIPELINE* pipeline)
+{
+    std::unique_lock<std::mutex> lock(pipeline->mutex);
+    while (true)
+    {
+        //Wait for a filled batch.
+        pipeline->work_cv.wait(lock, [pipeline] { return pipeline->claimed < pipeline->tail || pipeline->reader_done; });
+        if (pipeline->claimed == pipeline->tail)
+        {
+            break;
+        }
+        PAIRS_BATCH& batch = pipeline->batches[pipeline->claimed % pipeline->window];
+        ++pipeline->claimed;
+        lock.unlock();
+        pairs_parse_batch(*pipeline->parser, batch);
+        lock.lock();
+        batch.parsed = true;
+        pipeline->emit_cv.notify_all();
+    }
+}
+
+template <typename T>
+void pairs_emit_head(PAIRS_PIPELINE& pipeline, T proc_read)
+{
+    //Wait for the oldest batch, yield its records in the order of the file.
+    PAIRS_BATCH* batch = pipeline.batches + (pipeline.head % pipeline.window);
+    {
+        std::unique_lock<std::mutex> lock(pipeline.mutex);
+        pipeline.emit_cv.wait(lock, [batch] { return batch->parsed; });
+    }
+    for (const MAPPING_INFO& info : batch->records)
+    {
+        proc_read(info);
+    }
+    std::unique_lock<std::mutex> lock(pipeline.mutex);
+    batch->parsed = false;
+    ++pipeline.head;
+}
+
+template <typename T>
+void pairs_read_parallel(TEXT_LINE_HANDLE& handle, char* line, size_t line_size, const PAIRS_PARSER& parser, int threads, T proc_read)
+{
+    //The lines are collected in batches, parsed by the workers and yielded in order.
+    PAIRS_PIPELINE pipeline;
+    pipeline.parser = &parser;
+    pipeline.window = threads << 1;
+    pipeline.batches = new PAIRS_BATCH[pipeline.window];
+    for (size_t i = 0; i < pipeline.window; ++i)
+    {
+        PAIRS_BATCH& batch = pipeline.batches[i];
+        batch.text_reserve = PAIRS_BATCH_SIZE;
+        batch.text = static_cast<char*>(malloc(batch.text_reserve));
+        assert(batch.text);
+        batch.text_size = 0;
+        batch.parsed = false;
+    }
+    pipeline.head = 0;
+    pipeline.claimed = 0;
+    pipeline.tail = 0;
+    pipeline.reader_done = false;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; ++i)
+    {
+        workers.push_back(std::thread(pairs_parse_work, &pipeline));
+    }
+    PAIRS_BATCH* batch = NULL;
+    ssize_t line_len;
+    while (line)
+    {
+        if (!batch)
+        {
+            //Yield the oldest batch when the window is full.
+            if (pipeline.tail - pipeline.head == pipeline.window)
+            {
+                pairs_emit_head(pipeline, proc_read);
+            }
+            batch = pipeline.batches + (pipeline.tail % pipeline.window);
+            batch->text_size = 0;
+        }
+        //Append the line to the batch.
+        if (batch->text_size + line_size + 1 > batch->text_reserve)
+        {
+            batch->text_reserve = batch->text_size + line_size + 1;
+            batch->text = static_cast<char*>(realloc(batch->text, batch->text_reserve));
+            assert(batch->text);
+        }
+        memcpy(batch->text + batch->text_size, line, line_size);
+        batch->text_size += line_size;
+        batch->text[batch->text_size++] = '\n';
+        if (batch->text_size >= PAIRS_BATCH_SIZE)
+        {
+            std::unique_lock<std::mutex> lock(pipeline.mutex);
+            ++pipeline.tail;
+            pipeline.work_cv.notify_one();
+            batch = NULL;
+        }
+        //Fetch the next line.
+        line = NULL;
+        if ((line_len = handle.parser(&line, &line_size, &handle.buf, handle.file_handle)) != -1)
+        {
+            line_size = line_len;
+            trimmed_right(line, line_size);
+        }
+        else
+        {
+            line = NULL;
+        }
+    }
+    {
+        std::unique_lock<std::mutex> lock(pipeline.mutex);
+        if (batch)
+        {
+            ++pipeline.tail;
+        }
+        pipeline.reader_done = true;
+        pipeline.work_cv.notify_all();
+    }
+    while (pipeline.head < pipeline.tail)
+    {
+        pairs_emit_head(pipeline, proc_read);
+    }
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+    for (size_t i = 0; i < pipeline.window; ++i)
+    {
+        free(pipeline.batches[i].text);
+    }
+    delete[] pipeline.batches;
+}
+
+void hmr_pairs_read(const char* filepath, MAPPING_PROC proc, void* user, int threads, const MAPPING_REF_SET* refs)
+{
+    TEXT_LINE_HANDLE handle;
+    if (!text_open_read_line(filepath, &handle, threads))
+    {
+        time_error(-1, "Failed to open pairs file %s", filepath);
+    }
+    //Default columns: readID chr1 pos1 chr2 pos2 strand1 strand2.
+    PAIRS_PARSER parser;
+    parser.columns = PAIRS_COLUMNS{ 1, 2, 3, 4, -1, -1, 5 };
+    parser.refs = refs;
+    //Read the header until the first pair line.
+    std::vector<std::pair<std::string, uint32_t> > chroms;
+    char* line = NULL;
+    size_t line_size = 0;
+    ssize_t line_len;
+    while ((line_len = handle.parser(&line, &line_size, &handle.buf, handle.file_handle)) != -1)
+    {
+        line_size = line_len;
+        trimmed_right(line, line_size);
+        if (line_size > 0 && line[0] != '#')
+        {
+            break;
+        }
+        pairs_parse_header(line, line_size, parser, chroms);
+    }
+    if (line_len == -1)
+    {
+        line = NULL;
+    }
+    if (chroms.empty())
+    {
+        time_error(-1, "No #chromsize header found in pairs file %s", filepath);
+    }
+    //The chromosomes in the header are the references.
+    proc.proc_no_of_contig(static_cast<uint32_t>(chroms.size()), user);
+    parser.ref_enabled.assign(chroms.size(), refs == NULL);
+    for (size_t i = 0; i < chroms.size(); ++i)
+    {
+        std::string& name = chroms[i].first;
+        parser.ref_ids.insert(std::make_pair(name, static_cast<int32_t>(i)));
+        if (refs)
+        {
+            parser.ref_enabled[i] = refs->find(name) != refs->end();
+        }
+        proc.proc_contig(static_cast<uint32_t>(name.size()), &name[0], chroms[i].second, user);
+    }
+    //Process the pairs, the records are sent to the shards, the batch process or the read process.
+    MAPPING_SINK sink;
+    hmr_mapping_sink_start(sink, proc, user, threads);
+    size_t record_id = 0;
+    if (threads > 1)
+    {
+        pairs_read_parallel(handle, line, line_size, parser, threads, [&](const MAPPING_INFO& info)
+            {
+                hmr_mapping_sink_push(sink, record_id++, info);
+            });
+    }
+    else
+    {
+        std::vector<MAPPING_INFO> records;
+        while (line)
+        {
+            records.clear();
+            pairs_parse_line(parser, line, line_size, records);
+            for (const MAPPING_INFO& info : records)
+            {
+                hmr_mapping_sink_push(sink, record_id++, info);
+            }
+            if ((line_len = handle.parser(&line, &line_size, &handle.buf, handle.file_handle)) != -1)
+            {
+                line_size = line_len;
+                trimmed_right(line, line_size);
+            }
+            else
+            {
+                line = NULL;
+            }
+        }
+    }
+    hmr_mapping_sink_finish(sink);
+    text_close_read_line(&handle);
+}
@@ -0,0 +1,8 @@
+#ifndef HMR_PAIRS_H
+#define HMR_PAIRS_H
+
+#include "hmr_mapping_type.h"
+
+void hmr_pairs_read(const char* filepath, MAPPING_PROC proc, void* user, int threads, const MAPPING_REF_SET* refs = NULL);
+
+#endif // HMR_PAIRS_H
@@ -0,0 +1,365 @@
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+#ifndef _MSC_VER
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "hmr_global.h"
+#include "hmr_ui.h"
+
+#include "hmr_read_ahead.h"
+
+size_t read_ahead_fetch(HMR_READ_AHEAD* reader, size_t offset, char* data, size_t size)
+{
+    //Fill the block until the file ends, the file position is only moved when seeking.
+#ifdef _MSC_VER
+    return fread(data, 1, size, reader->file);
+#else
+    int fd = fileno(reader->file);
+    size_t filled = 0;
+    while (filled < size)
+    {
+        ssize_t bytes = reader->seekable ? pread(fd, data + filled, size - filled, offset + filled) : read(fd, data + filled, size - filled);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            time_error(-1, "Failed to read input file, error code %d.", errno);
+        }
+        if (bytes == 0)
+        {
+            break;
+        }
+        filled += bytes;
+    }
+    return filled;
+#endif
+}
+
+inline bool read_ahead_can_issue(HMR_READ_AHEAD* reader)
+{
+    return !reader->stream_end && reader->issued - reader->head < static_cast<size_t>(reader->depth) &&
+        (!reader->seekable || reader->base + reader->issued * reader->block_size < reader->file_size);
+}
+
+inline bool read_ahead_finished(HMR_READ_AHEAD* reader)
+{
+    return reader->head == reader->issued && !reader->busy && !read_ahead_can_issue(reader);
+}
+
+void read_ahead_work(HMR_READ_AHEAD* reader)
+{
+    std::unique_lock<std::mutex> lock(reader->mutex);
+    while (true)
+    {
+        //Wait for a free block in the window.
+        reader->read_cv.wait(lock, [reader] { return reader->stop || read_ahead_can_issue(reader); });
+        if (reader->stop)
+        {
+            break;
+        }
+        size_t index = reader->issued;
+        HMR_READ_AHEAD_BLOCK& block = reader->blocks[index % reader->depth];
+        size_t offset = reader->base + index * reader->block_size;
+        reader->busy = true;
+        lock.unlock();
+        size_t size = read_ahead_fetch(reader, offset, block.data, reader->block_size);
+        lock.lock();
+        reader->busy = false;
+        //A short read is the end of the file.
+        block.size = size;
+        block.ready = true;
+        ++reader->issued;
+        if (size < reader->block_size)
+        {
+            reader->stream_end = true;
+        }
+        reader->ready_cv.notify_all();
+    }
+}
+
+#ifdef HMR_READ_AHEAD_URING
+void read_ahead_uring_issue(HMR_READ_AHEAD* reader)
+{
+    //Keep the window full of reads.
+    bool submitted = false;
+    while (read_ahead_can_issue(reader))
+    {
+        struct io_uring_sqe* sqe = io_uring_get_sqe(&reader->ring);
+        if (!sqe)
+        {
+            break;
+        }
+        size_t index = reader->issued;
+        io_uring_prep_read(sqe, fileno(reader->file), reader->blocks[index % reader->depth].data,
+            static_cast<unsigned>(reader->block_size), reader->base + index * reader->block_size);
+        io_uring_sqe_set_data(sqe, reinterpret_cast<void*>(static_cast<uintptr_t>(index)));
+        ++reader->issued;
+        ++reader->inflight;
+        submitted = true;
+    }
+    if (submitted)
+    {
+        io_uring_submit(&reader->ring);
+    }
+}
+
+void read_ahead_uring_complete(HMR_READ_AHEAD* reader)
+{
+    //Wait for one read to complete.
+    struct io_uring_cqe* cqe;
+    if (io_uring_wait_cqe(&reader->ring, &cqe) < 0)
+    {
+        time_error(-1, "Failed to wait for the input reading.");
+    }
+    size_t index = static_cast<size_t>(reinterpret_cast<uintptr_t>(io_uring_cqe_get_data(cqe)));
+    if (cqe->res < 0)
+    {
+        time_error(-1, "Failed to read input file, error code %d.", -cqe->res);
+    }
+    HMR_READ_AHEAD_BLOCK& block = reader->blocks[index % reader->depth];
+    block.size = cqe->res;
+    io_uring_cqe_seen(&reader->ring, cqe);
+    --reader->inflight;
+    //Complete the short read inside the file.
+    size_t offset = reader->base + index * reader->block_size;
+    size_t expected = hMin(reader->block_size, reader->file_size - offset);
+    if (block.size < expected)
+    {
+        block.size += read_ahead_fetch(reader, offset + block.size, block.data + block.size, expected - block.size);
+    }
+    block.ready = true;
+}
+#endif
+
+bool read_ahead_wait(HMR_READ_AHEAD* reader)
+{
+    //Check whether the block of the consumer is read, false when the file ends.
+#ifdef HMR_READ_AHEAD_URING
+    if (reader->uring)
+    {
+        read_ahead_uring_issue(reader);
+        while (reader->head < reader->issued && !reader->blocks[reader->head % reader->depth].ready)
+        {
+            read_ahead_uring_complete(reader);
+        }
+        return reader->head < reader->issued;
+    }
+#endif
+    std::unique_lock<std::mutex> lock(reader->mutex);
+    reader->ready_cv.wait(lock, [reader] { return reader->blocks[reader->head % reader->depth].ready || read_ahead_finished(reader); });
+    return reader->blocks[reader->head % reader->depth].ready;
+}
+
+void read_ahead_release(HMR_READ_AHEAD* reader)
+{
+    //Give the consumed block back to the reading.
+#ifdef HMR_READ_AHEAD_URING
+    if (reader->uring)
+    {
+        reader->blocks[reader->head % reader->depth].ready = false;
+        ++reader->head;
+        reader->head_offset = 0;
+        reader->head_ready = false;
+        return;
+    }
+#endif
+    std::unique_lock<std::mutex> lock(reader->mutex);
+    reader->blocks[reader->head % reader->depth].ready = false;
+    ++reader->head;
+    reader->head_offset = 0;
+    reader->head_ready = false;
+    reader->read_cv.notify_one();
+}
+
+bool read_ahead_available(HMR_READ_AHEAD* reader)
+{
+    //Move to the block which still has data.
+    while (true)
+    {
+        if (!reader->head_ready)
+        {
+            if (!read_ahead_wait(reader))
+            {
+                return false;
+            }
+            reader->head_ready = true;
+        }
+        if (reader->head_offset < reader->blocks[reader->head % reader->depth].size)
+        {
+            return true;
+        }
+        read_ahead_release(reader);
+    }
+}
+
+size_t read_ahead_consume(HMR_READ_AHEAD* reader, char* data, size_t size)
+{
+    size_t filled = 0;
+    while (filled < size && read_ahead_available(reader))
+    {
+        //Copy the data from the current block, skip the data when target is NULL.
+        HMR_READ_AHEAD_BLOCK& block = reader->blocks[reader->head % reader->depth];
+        size_t part = hMin(block.size - reader->head_offset, size - filled);
+        if (data)
+        {
+            memcpy(data + filled, block.data + reader->head_offset, part);
+        }
+        reader->head_offset += part;
+        filled += part;
+    }
+    return filled;
+}
+
+void read_ahead_reset(HMR_READ_AHEAD* reader, size_t offset)
+{
+    //Drop all the blocks, restart reading from the offset.
+#ifdef HMR_READ_AHEAD_URING
+    if (reader->uring)
+    {
+        while (reader->inflight > 0)
+        {
+            read_ahead_uring_complete(reader);
+        }
+    }
+#endif
+    std::unique_lock<std::mutex> lock(reader->mutex);
+    reader->ready_cv.wait(lock, [reader] { return !reader->busy; });
+#ifdef _MSC_VER
+    _fseeki64(reader->file, offset, SEEK_SET);
+#endif
+    for (int i = 0; i < reader->depth; ++i)
+    {
+        reader->blocks[i].ready = false;
+    }
+    reader->base = offset;
+    reader->head = 0;
+    reader->issued = 0;
+    reader->head_offset = 0;
+    reader->head_ready = false;
+    reader->stream_end = false;
+    reader->read_cv.notify_one();
+}
+
+HMR_READ_AHEAD* hmr_read_ahead_open(FILE* file, size_t offset, size_t block_size, int depth)
+{
+    HMR_READ_AHEAD* reader = new HMR_READ_AHEAD();
+    reader->file = file;
+    //Only the regular file could be read at any position.
+#ifdef _MSC_VER
+    reader->seekable = _fseeki64(file, 0, SEEK_END) == 0;
+    reader->file_size = reader->seekable ? _ftelli64(file) : 0;
+    if (reader->seekable)
+    {
+        _fseeki64(file, offset, SEEK_SET);
+    }
+#else
+    struct stat file_stat;
+    reader->seekable = fstat(fileno(file), &file_stat) == 0 && S_ISREG(file_stat.st_mode);
+    reader->file_size = reader->seekable ? file_stat.st_size : 0;
+#endif
+    reader->block_size = block_size;
+    reader->depth = depth;
+    reader->blocks = new HMR_READ_AHEAD_BLOCK[depth];
+    for (int i = 0; i < depth; ++i)
+    {
+        reader->blocks[i].data = static_cast<char*>(malloc(block_size));
+        if (!reader->blocks[i].data)
+        {
+            time_error(-1, "Failed to allocate read-ahead buffer, no enough memory.");
+        }
+        reader->blocks[i].size = 0;
+        reader->blocks[i].ready = false;
+    }
+    reader->head = 0;
+    reader->issued = 0;
+    reader->base = reader->seekable ? offset : 0;
+    reader->head_offset = 0;
+    reader->head_ready = false;
+    reader->stream_end = false;
+    reader->busy = false;
+    reader->stop = false;
+    //Prefer io_uring on the kernel supports it, or else read in a thread.
+#ifdef HMR_READ_AHEAD_URING
+    reader->inflight = 0;
+    reader->uring = reader->seekable && io_uring_queue_init(depth, &reader->ring, 0) == 0;
+    if (reader->uring)
+    {
+        return reader;
+    }
+#endif
+    reader->worker = std::thread(read_ahead_work, reader);
+    return reader;
+}
+
+size_t hmr_read_ahead_read(HMR_READ_AHEAD* reader, void* data, size_t size)
+{
+    return read_ahead_consume(reader, static_cast<char*>(data), size);
+}
+
+size_t hmr_read_ahead_next(HMR_READ_AHEAD* reader, char** data)
+{
+    //Provide the rest of the current block, valid until the next reading.
+    if (!read_ahead_available(reader))
+    {
+        return 0;
+    }
+    HMR_READ_AHEAD_BLOCK& block = reader->blocks[reader->head % reader->depth];
+    size_t size = block.size - reader->head_offset;
+    *data = block.data + reader->head_offset;
+    reader->head_offset = block.size;
+    return size;
+}
+
+void hmr_read_ahead_seek(HMR_READ_AHEAD* reader, size_t offset)
+{
+    //Skip the data when the offset is inside the read window.
+    size_t position = reader->base + reader->head * reader->block_size + reader->head_offset;
+    if (offset >= position && (!reader->seekable || offset - position <= reader->block_size * reader->depth))
+    {
+        read_ahead_consume(reader, NULL, offset - position);
+        return;
+    }
+    if (!reader->seekable)
+    {
+        time_error(-1, "Failed to seek in a non-seekable input.");
+    }
+    read_ahead_reset(reader, offset);
+}
+
+void hmr_read_ahead_close(HMR_READ_AHEAD* reader)
+{
+#ifdef HMR_READ_AHEAD_URING
+    if (reader->uring)
+    {
+        while (reader->inflight > 0)
+        {
+            read_ahead_uring_complete(reader);
+        }
+        io_uring_queue_exit(&reader->ring);
+    }
+#endif
+    //Stop the reading thread.
+    if (reader->worker.joinable())
+    {
+        {
+            std::unique_lock<std::mutex> lock(reader->mutex);
+            reader->stop = true;
+            reader->read_cv.notify_one();
+        }
+        reader->worker.join();
+    }
+    for (int i = 0; i < reader->depth; ++i)
+    {
+        free(reader->blocks[i].data);
+    }
+    delete[] reader->blocks;
+    delete reader;
+}
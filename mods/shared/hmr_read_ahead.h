@@ -0,0 +1,51 @@
+#ifndef HMR_READ_AHEAD_H
+#define HMR_READ_AHEAD_H
+
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifdef HMR_READ_AHEAD_URING
+#include <liburing.h>
+#endif
+
+// Default read size and number of reads in flight.
+#define HMR_READ_AHEAD_BLOCK_SIZE (4194304)
+#define HMR_READ_AHEAD_DEPTH (4)
+
+typedef struct HMR_READ_AHEAD_BLOCK
+{
+    char* data;
+    size_t size;
+    bool ready;
+} HMR_READ_AHEAD_BLOCK;
+
+typedef struct HMR_READ_AHEAD
+{
+    FILE* file;
+    //File size is only known for the seekable files.
+    bool seekable;
+    size_t file_size, block_size;
+    int depth;
+    HMR_READ_AHEAD_BLOCK* blocks;
+    //Block index (not wrapped) of the consumer and the next block to read, file offset of block 0.
+    size_t head, issued, base, head_offset;
+    bool head_ready, stream_end, busy, stop;
+    std::mutex mutex;
+    std::condition_variable read_cv, ready_cv;
+    std::thread worker;
+#ifdef HMR_READ_AHEAD_URING
+    bool uring;
+    size_t inflight;
+    struct io_uring ring;
+#endif
+} HMR_READ_AHEAD;
+
+HMR_READ_AHEAD* hmr_read_ahead_open(FILE* file, size_t offset = 0, size_t block_size = HMR_READ_AHEAD_BLOCK_SIZE, int depth = HMR_READ_AHEAD_DEPTH);
+size_t hmr_read_ahead_read(HMR_READ_AHEAD* reader, void* data, size_t size);
+size_t hmr_read_ahead_next(HMR_READ_AHEAD* reader, char** data);
+void hmr_read_ahead_seek(HMR_READ_AHEAD* reader, size_t offset);
+void hmr_read_ahead_close(HMR_READ_AHEAD* reader);
+
+#endif // HMR_READ_AHEAD_H
@@ -0,0 +1,185 @@
+#include <cstring>
+
+#include "hmr_global.h"
+#include "hmr_ui.h"
+
+#include "hmr_seq_pack.h"
+
+typedef struct SEQ_PACK_TABLE
+{
+    //Packed code, base in upper case, whether the base is packable and soft-masked.
+    uint8_t code[256];
+    char upper[256];
+    bool packable[256], masked[256];
+} SEQ_PACK_TABLE;
+
+static SEQ_PACK_TABLE seq_pack_table_build()
+{
+    SEQ_PACK_TABLE table;
+    for (int i = 0; i < 256; ++i)
+    {
+        char c = static_cast<char>(i);
+        table.masked[i] = c >= 'a' && c <= 'z';
+        table.upper[i] = table.masked[i] ? static_cast<char>(c - 'a' + 'A') : c;
+        int code = hmr_seq_base_code(table.upper[i]);
+        table.packable[i] = code != -1;
+        table.code[i] = static_cast<uint8_t>(code == -1 ? 0 : code);
+    }
+    return table;
+}
+
+static const SEQ_PACK_TABLE seq_pack_table = seq_pack_table_build();
+
+inline void seq_pack_run(HMR_SEQ_RUN* runs, size_t& run_size, size_t pos, char base)
+{
+    //Extend the last run when the base continues it.
+    if (run_size > 0)
+    {
+        HMR_SEQ_RUN& last = runs[run_size - 1];
+        if (last.start + last.length == pos && last.base == base)
+        {
+            ++last.length;
+            return;
+        }
+    }
+    runs[run_size++] = HMR_SEQ_RUN{ pos, 1, base };
+}
+
+inline void seq_pack_count(size_t& run_size, bool& in_run, char& run_base, bool is_run, char base)
+{
+    //Count the runs without the table.
+    if (is_run && (!in_run || run_base != base))
+    {
+        ++run_size;
+    }
+    in_run = is_run;
+    run_base = base;
+}
+
+HMR_PACKED_SEQ* hmr_seq_pack_lines(const char* text, size_t length, size_t line_bases, size_t line_width)
+{
+    const SEQ_PACK_TABLE& table = seq_pack_table;
+    //Count the runs to allocate the block.
+    size_t n_run_size = 0, mask_run_size = 0;
+    bool in_n = false, in_mask = false;
+    char n_base = 0, mask_base = 0;
+    for (size_t filled = 0, line = 0; filled < length; filled += line_bases, line += line_width)
+    {
+        const uint8_t* bases = reinterpret_cast<const uint8_t*>(text + line);
+        size_t line_size = hMin(line_bases, length - filled);
+        for (size_t i = 0; i < line_size; ++i)
+        {
+            uint8_t c = bases[i];
+            seq_pack_count(n_run_size, in_n, n_base, !table.packable[c], table.upper[c]);
+            seq_pack_count(mask_run_size, in_mask, mask_base, table.masked[c], 'a');
+        }
+    }
+    size_t word_size = (length + HMR_SEQ_PACK_BASES - 1) / HMR_SEQ_PACK_BASES;
+    char* block = static_cast<char*>(malloc(sizeof(HMR_PACKED_SEQ) + sizeof(uint64_t) * word_size + sizeof(HMR_SEQ_RUN) * (n_run_size + mask_run_size)));
+    if (!block)
+    {
+        time_error(-1, "No enough memory for packed sequence allocation.");
+    }
+    HMR_PACKED_SEQ* packed = reinterpret_cast<HMR_PACKED_SEQ*>(block);
+    packed->length = length;
+    packed->words = reinterpret_cast<uint64_t*>(block + sizeof(HMR_PACKED_SEQ));
+    packed->n_runs = reinterpret_cast<HMR_SEQ_RUN*>(packed->words + word_size);
+    packed->mask_runs = packed->n_runs + n_run_size;
+    packed->n_run_size = 0;
+    packed->mask_run_size = 0;
+    //Pack the bases and fill the runs.
+    if (word_size > 0)
+    {
+        memset(packed->words, 0, sizeof(uint64_t) * word_size);
+    }
+    size_t pos = 0;
+    for (size_t line = 0; pos < length; line += line_width)
+    {
+        const uint8_t* bases = reinterpret_cast<const uint8_t*>(text + line);
+        size_t line_end = pos + hMin(line_bases, length - pos);
+        for (; pos < line_end; ++pos, ++bases)
+        {
+            uint8_t c = *bases;
+            packed->words[pos / HMR_SEQ_PACK_BASES] |= static_cast<uint64_t>(table.code[c]) << ((pos % HMR_SEQ_PACK_BASES) << 1);
+            if (!table.packable[c])
+            {
+                seq_pack_run(packed->n_runs, packed->n_run_size, pos, table.upper[c]);
+            }
+            if (table.masked[c])
+            {
+                seq_pack_run(packed->mask_runs, packed->mask_run_size, pos, 'a');
+            }
+        }
+    }
+    return packed;
+}
+
+HMR_PACKED_SEQ* hmr_seq_pack(const char* seq, size_t seq_size)
+{
+    return hmr_seq_pack_lines(seq, seq_size, hMax(seq_size, static_cast<size_t>(1)), seq_size);
+}
+
+inline const HMR_SEQ_RUN* seq_pack_run_find(const HMR_SEQ_RUN* runs, size_t run_size, size_t pos)
+{
+    //Find the first run which ends after the position.
+    size_t left = 0, right = run_size;
+    while (left < right)
+    {
+        size_t mid = (left + right) >> 1;
+        if (runs[mid].start + runs[mid].length <= pos)
+        {
+            left = mid + 1;
+        }
+        else
+        {
+            right = mid;
+        }
+    }
+    return runs + left;
+}
+
+bool hmr_seq_pack_masked(const HMR_PACKED_SEQ* packed, size_t start, size_t size)
+{
+    //Check whether any base in the range is not a packed upper case base.
+    size_t end = start + size;
+    const HMR_SEQ_RUN* n_run = seq_pack_run_find(packed->n_runs, packed->n_run_size, start);
+    if (n_run != packed->n_runs + packed->n_run_size && n_run->start < end)
+    {
+        return true;
+    }
+    const HMR_SEQ_RUN* mask_run = seq_pack_run_find(packed->mask_runs, packed->mask_run_size, start);
+    return mask_run != packed->mask_runs + packed->mask_run_size && mask_run->start < end;
+}
+
+void hmr_seq_unpack(const HMR_PACKED_SEQ* packed, size_t start, size_t size, char* seq)
+{
+    static const char bases[4] = { 'A', 'C', 'G', 'T' };
+    size_t end = start + size;
+    for (size_t pos = start; pos < end; ++pos)
+    {
+        *seq++ = bases[(packed->words[pos / HMR_SEQ_PACK_BASES] >> ((pos % HMR_SEQ_PACK_BASES) << 1)) & 3];
+    }
+    seq -= size;
+    //Recover the bases which are not packed, then the soft-masked bases.
+    const HMR_SEQ_RUN* run_end = packed->n_runs + packed->n_run_size;
+    for (const HMR_SEQ_RUN* run = seq_pack_run_find(packed->n_runs, packed->n_run_size, start); run != run_end && run->start < end; ++run)
+    {
+        size_t run_start = hMax(run->start, start), run_stop = hMin(run->start + run->length, end);
+        memset(seq + run_start - start, run->base, run_stop - run_start);
+    }
+    run_end = packed->mask_runs + packed->mask_run_size;
+    for (const HMR_SEQ_RUN* run = seq_pack_run_find(packed->mask_runs, packed->mask_run_size, start); run != run_end && run->start < end; ++run)
+    {
+        size_t run_start = hMax(run->start, start), run_stop = hMin(run->start + run->length, end);
+        for (size_t pos = run_start; pos < run_stop; ++pos)
+        {
+            char& c = seq[pos - start];
+            c = static_cast<char>(c - 'A' + 'a');
+        }
+    }
+}
+
+void hmr_seq_pack_free(HMR_PACKED_SEQ* packed)
+{
+    free(packed);
+}
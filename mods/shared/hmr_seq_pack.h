@@ -0,0 +1,62 @@
+#ifndef HMR_SEQ_PACK_H
+#define HMR_SEQ_PACK_H
+
+#include <cstdint>
+#include <cstdlib>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//Bases are packed in 2 bits (A=0, C=1, G=2, T=3) from the low bits of the words.
+#define HMR_SEQ_PACK_BASES (32)
+
+//Run of the same base which cannot be packed (N and the other codes are packed as A),
+//or run of the soft-masked (lower case) bases.
+typedef struct HMR_SEQ_RUN
+{
+    size_t start, length;
+    char base;
+} HMR_SEQ_RUN;
+
+//The header, words and runs are allocated in one block.
+typedef struct HMR_PACKED_SEQ
+{
+    size_t length;
+    uint64_t* words;
+    HMR_SEQ_RUN* n_runs;
+    HMR_SEQ_RUN* mask_runs;
+    size_t n_run_size, mask_run_size;
+} HMR_PACKED_SEQ;
+
+inline int hmr_seq_ctz(uint64_t bits)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return static_cast<int>(index);
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
+
+inline int hmr_seq_base_code(char base)
+{
+    //Code of the packable upper case base, or -1.
+    switch (base)
+    {
+    case 'A': return 0;
+    case 'C': return 1;
+    case 'G': return 2;
+    case 'T': return 3;
+    default: return -1;
+    }
+}
+
+HMR_PACKED_SEQ* hmr_seq_pack(const char* seq, size_t seq_size);
+HMR_PACKED_SEQ* hmr_seq_pack_lines(const char* text, size_t length, size_t line_bases, size_t line_width);
+bool hmr_seq_pack_masked(const HMR_PACKED_SEQ* packed, size_t start, size_t size);
+void hmr_seq_unpack(const HMR_PACKED_SEQ* packed, size_t start, size_t size, char* seq);
+void hmr_seq_pack_free(HMR_PACKED_SEQ* packed);
+
+#endif // HMR_SEQ_PACK_H
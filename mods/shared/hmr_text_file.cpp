@@ -6,7 +6,9 @@
 
 #include "hmr_path.h"
 #include "hmr_gz.h"
+#include "hmr_bgzf.h"
 #include "hmr_bin_queue.h"
+#include "hmr_read_ahead.h"
 #include "hmr_ui.h"
 
 #include "hmr_text_file.h"
@@ -39,12 +41,12 @@ ssize_t text_getline_file(char** line, size_t* line_size, TEXT_LINE_BUF* line_bu
         line_buf->offset = 0;
     }
     //Need to fetch the data.
-    FILE* fp = static_cast<FILE*>(file_handle);
+    HMR_READ_AHEAD* reader = static_cast<HMR_READ_AHEAD*>(file_handle);
     char* target = line_buf->buf + line_buf->buf_size;
     for(;;)
     {
         //Fill the buffer.
-        size_t inc_size = fread(target, 1, line_buf->reserved - line_buf->buf_size, fp);
+        size_t inc_size = hmr_read_ahead_read(reader, target, line_buf->reserved - line_buf->buf_size);
         if (inc_size == 0)
         {
             break;
@@ -82,7 +84,22 @@ ssize_t text_getline_file(char** line, size_t* line_size, TEXT_LINE_BUF* line_bu
     return -1;
 }
 
-ssize_t text_getline_gz(char** line, size_t* line_size, TEXT_LINE_BUF* line_buf, void* file_handle)
+void text_line_buf_release(TEXT_LINE_BUF* line_buf, HMR_BIN_QUEUE* queue)
+{
+    //Reserved is 0 when the buffer is a slice owned by the queue.
+    if (line_buf->reserved == 0)
+    {
+        hmr_bin_queue_release(queue, line_buf->buf);
+    }
+    else
+    {
+        free(line_buf->buf);
+    }
+    line_buf->buf = NULL;
+    line_buf->reserved = 0;
+}
+
+ssize_t text_getline_queue(char** line, size_t* line_size, TEXT_LINE_BUF* line_buf, HMR_BIN_QUEUE* queue)
 {
     //Check whether the buffer has and data rest.
     if (line_buf->buf_size > line_buf->offset)
@@ -102,7 +119,7 @@ ssize_t text_getline_gz(char** line, size_t* line_size, TEXT_LINE_BUF* line_buf,
             return *line_size;
         }
         //Move the residual data to the front of the buffer.
-        memcpy(line_buf->buf, buf, residual);
+        memmove(line_buf->buf, buf, residual);
         //Reset the offset and buffer size.
         line_buf->buf_size = residual;
         line_buf->offset = 0;
@@ -110,14 +127,13 @@ ssize_t text_getline_gz(char** line, size_t* line_size, TEXT_LINE_BUF* line_buf,
     else
     {
         //Free the line buffer.
-        free(line_buf->buf);
-        line_buf->buf = NULL;
+        if (line_buf->buf)
+        {
+            text_line_buf_release(line_buf, queue);
+        }
         line_buf->buf_size = 0;
         line_buf->offset = 0;
     }
-    //Get the GZ handler.
-    HMR_GZ_HANDLER* gz_handle = reinterpret_cast<HMR_GZ_HANDLER*>(file_handle);
-    auto queue = gz_handle->queue;
     //Fetch the data from the queue.
     char* target;
     for (;;)
@@ -134,13 +150,24 @@ ssize_t text_getline_gz(char** line, size_t* line_size, TEXT_LINE_BUF* line_buf,
             //Directly assign the slice data as buffer.
             line_buf->buf = bin_slice.data;
             line_buf->buf_size = bin_slice.data_size;
+            line_buf->reserved = 0;
             target = line_buf->buf;
         }
         else
         {
             //Extend the size of the current buf.
             size_t expected_size = line_buf->buf_size + bin_slice.data_size;
-            if (line_buf->reserved < expected_size)
+            if (line_buf->reserved == 0)
+            {
+                //Move the data out of the queue slice.
+                char* needed = static_cast<char*>(malloc(expected_size));
+                assert(needed);
+                memcpy(needed, line_buf->buf, line_buf->buf_size);
+                hmr_bin_queue_release(queue, line_buf->buf);
+                line_buf->buf = needed;
+                line_buf->reserved = expected_size;
+            }
+            else if (line_buf->reserved < expected_size)
             {
                 char* needed = static_cast<char*>(realloc(line_buf->buf, expected_size));
                 assert(needed);
@@ -154,7 +181,7 @@ ssize_t text_getline_gz(char** line, size_t* line_size, TEXT_LINE_BUF* line_buf,
             //Update the buffer size.
             line_buf->buf_size = expected_size;
             //Free the data slice.
-            free(bin_slice.data);
+            hmr_bin_queue_release(queue, bin_slice.data);
         }
         //Search for '\n'.
         char* pos = static_cast<char*>(memchr(target, '\n', bin_slice.data_size));
@@ -179,14 +206,30 @@ ssize_t text_getline_gz(char** line, size_t* line_size, TEXT_LINE_BUF* line_buf,
     return -1;
 }
 
-std::string text_open_read(const char *filepath, void **handle)
+ssize_t text_getline_gz(char** line, size_t* line_size, TEXT_LINE_BUF* line_buf, void* file_handle)
+{
+    return text_getline_queue(line, line_size, line_buf, reinterpret_cast<HMR_GZ_HANDLER*>(file_handle)->queue);
+}
+
+ssize_t text_getline_bgzf(char** line, size_t* line_size, TEXT_LINE_BUF* line_buf, void* file_handle)
+{
+    return text_getline_queue(line, line_size, line_buf, reinterpret_cast<HMR_BGZF_HANDLER*>(file_handle)->queue);
+}
+
+std::string text_open_read(const char *filepath, void **handle, int threads)
 {
     //Check the arguments.
     std::string suffix = path_suffix(filepath);
-    if (suffix == ".gz")
+    if (suffix == ".gz" || suffix == ".bgz")
     {
+        //BGZF file could be decompressed by blocks in parallel.
+        if (hmr_bgzf_detect(filepath))
+        {
+            *handle = hmr_bgzf_open(filepath, threads);
+            return "bgzf";
+        }
         //Use gzip module to open the file.
-        *handle = hmr_gz_open_read(filepath);
+        *handle = hmr_gz_open_read(filepath, threads);
         return "gz";
     }
     //Open as a normal text file.
@@ -203,11 +246,12 @@ std::string text_open_read(const char *filepath, void **handle)
         return "";
     }
 #endif
-    *handle = text_file;
+    //Keep the reads in flight ahead of the line parsing.
+    *handle = hmr_read_ahead_open(text_file);
     return "txt";
 }
 
-bool text_open_read_line(const char* filepath, TEXT_LINE_HANDLE* handle)
+bool text_open_read_line(const char* filepath, TEXT_LINE_HANDLE* handle, int threads)
 {
     //Initial the buffer status.
     TEXT_LINE_BUF& buf = handle->buf;
@@ -215,7 +259,16 @@ bool text_open_read_line(const char* filepath, TEXT_LINE_HANDLE* handle)
     buf.offset = 0;
     buf.buf_size = 0;
     //Check the arguments.
-    std::string mode = text_open_read(filepath, &(handle->file_handle));
+    std::string mode = text_open_read(filepath, &(handle->file_handle), threads);
+    if (mode == "bgzf")
+    {
+        //BGZF data slices are read in the same way as gzip.
+        handle->parser = text_getline_bgzf;
+        buf.buf = NULL;
+        buf.buf_size = 0;
+        buf.reserved = 0;
+        return true;
+    }
     if (mode == "gz")
     {
         //Use gzip readline to read the file.
@@ -242,19 +295,34 @@ void text_close_read_line(TEXT_LINE_HANDLE *handle)
 {
     //Recover the buffer.
     TEXT_LINE_BUF& buf = handle->buf;
-    if (buf.buf)
-    {
-        free(buf.buf);
-    }
     //Close the file handle.
     if(text_getline_file == handle->parser)
     {
-        fclose(static_cast<FILE *>(handle->file_handle));
+        free(buf.buf);
+        HMR_READ_AHEAD* reader = static_cast<HMR_READ_AHEAD*>(handle->file_handle);
+        FILE* text_file = reader->file;
+        hmr_read_ahead_close(reader);
+        fclose(text_file);
         return;
     }
     if (text_getline_gz == handle->parser)
     {
-        hmr_gz_close_read(static_cast<HMR_GZ_HANDLER*>(handle->file_handle));
+        HMR_GZ_HANDLER* gz_handler = static_cast<HMR_GZ_HANDLER*>(handle->file_handle);
+        if (buf.buf)
+        {
+            text_line_buf_release(&buf, gz_handler->queue);
+        }
+        hmr_gz_close_read(gz_handler);
+        return;
+    }
+    if (text_getline_bgzf == handle->parser)
+    {
+        HMR_BGZF_HANDLER* bgzf_handler = static_cast<HMR_BGZF_HANDLER*>(handle->file_handle);
+        if (buf.buf)
+        {
+            text_line_buf_release(&buf, bgzf_handler->queue);
+        }
+        hmr_bgzf_close(bgzf_handler);
         return;
     }
     time_error(-1, "Unknown text getline handler to close.");
@@ -279,3 +347,84 @@ bool text_open_write(const char* filepath, FILE** handle)
     * handle = text_file;
     return true;
 }
+
+bool text_open_read_block(const char* filepath, TEXT_BLOCK_HANDLE* handle, int threads)
+{
+    handle->map.data = NULL;
+    handle->map.size = 0;
+    handle->block = NULL;
+    handle->file_handle = NULL;
+    //A plain text file is read directly from the mapping when possible.
+    std::string suffix = path_suffix(filepath);
+    if (suffix != ".gz" && suffix != ".bgz" && bin_map(filepath, &handle->map))
+    {
+        handle->mode = "map";
+        return true;
+    }
+    handle->mode = text_open_read(filepath, &handle->file_handle, threads);
+    return !handle->mode.empty();
+}
+
+size_t text_read_block(TEXT_BLOCK_HANDLE* handle, char** data)
+{
+    if (handle->mode == "map")
+    {
+        //Provide the entire mapping once.
+        if (handle->block)
+        {
+            return 0;
+        }
+        handle->block = handle->map.data;
+        *data = handle->map.data;
+        return handle->map.size;
+    }
+    if (handle->mode == "txt")
+    {
+        return hmr_read_ahead_next(static_cast<HMR_READ_AHEAD*>(handle->file_handle), data);
+    }
+    //Give the last slice back to the queue, and take the next one.
+    HMR_BIN_QUEUE* queue = handle->mode == "gz" ? static_cast<HMR_GZ_HANDLER*>(handle->file_handle)->queue :
+        static_cast<HMR_BGZF_HANDLER*>(handle->file_handle)->queue;
+    if (handle->block)
+    {
+        hmr_bin_queue_release(queue, handle->block);
+        handle->block = NULL;
+    }
+    HMR_BIN_SLICE slice = hmr_bin_queue_pop(queue);
+    handle->block = slice.data;
+    *data = slice.data;
+    return slice.data ? slice.data_size : 0;
+}
+
+void text_close_read_block(TEXT_BLOCK_HANDLE* handle)
+{
+    if (handle->mode == "map")
+    {
+        bin_unmap(&handle->map);
+        return;
+    }
+    if (handle->mode == "txt")
+    {
+        HMR_READ_AHEAD* reader = static_cast<HMR_READ_AHEAD*>(handle->file_handle);
+        FILE* text_file = reader->file;
+        hmr_read_ahead_close(reader);
+        fclose(text_file);
+        return;
+    }
+    if (handle->mode == "gz")
+    {
+        HMR_GZ_HANDLER* gz_handler = static_cast<HMR_GZ_HANDLER*>(handle->file_handle);
+        if (handle->block)
+        {
+            hmr_bin_queue_release(gz_handler->queue, handle->block);
+        }
+        hmr_gz_close_read(gz_handler);
+        return;
+    }
+    HMR_BGZF_HANDLER* bgzf_handler = static_cast<HMR_BGZF_HANDLER*>(handle->file_handle);
+    if (handle->block)
+    {
+        hmr_bin_queue_release(bgzf_handler->queue, handle->block);
+    }
+    hmr_bgzf_close(bgzf_handler);
+}
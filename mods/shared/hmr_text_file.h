@@ -3,6 +3,8 @@
 
 #include <string>
 
+#include "hmr_bin_file.h"
+
 inline int is_space(char c)
 {
     return c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r' || c == ' ';
@@ -36,10 +38,24 @@ typedef struct TEXT_LINE_HANDLE
     TEXT_LINE_BUF buf;
 } TEXT_LINE_HANDLE;
 
-std::string text_open_read(const char *filepath, void** handle);
-bool text_open_read_line(const char* filepath, TEXT_LINE_HANDLE *handle);
+std::string text_open_read(const char *filepath, void** handle, int threads = 1);
+bool text_open_read_line(const char* filepath, TEXT_LINE_HANDLE *handle, int threads = 1);
 void text_close_read_line(TEXT_LINE_HANDLE* handle);
 
+//Reads the text in blocks, a mapped file is a single block which stays valid until closing,
+//other blocks are only valid until the next reading.
+typedef struct TEXT_BLOCK_HANDLE
+{
+    std::string mode;
+    void* file_handle;
+    HMR_BIN_MAP map;
+    char* block;
+} TEXT_BLOCK_HANDLE;
+
+bool text_open_read_block(const char* filepath, TEXT_BLOCK_HANDLE* handle, int threads = 1);
+size_t text_read_block(TEXT_BLOCK_HANDLE* handle, char** data);
+void text_close_read_block(TEXT_BLOCK_HANDLE* handle);
+
 bool text_open_write(const char* filepath, FILE** handle);
 
 #endif // HMR_TEXT_FILE_H
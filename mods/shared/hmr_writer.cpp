@@ -0,0 +1,241 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "hmr_bgzf.h"
+#include "hmr_deflate.h"
+#include "hmr_global.h"
+#include "hmr_path.h"
+#include "hmr_ui.h"
+
+#include "hmr_writer.h"
+
+void writer_work(HMR_WRITER* writer)
+{
+    std::unique_lock<std::mutex> lock(writer->mutex);
+    while (true)
+    {
+        //Wait for the next block in order to be ready.
+        writer->write_cv.wait(lock, [writer] { return writer->stop || (writer->written < writer->head && writer->blocks[writer->written % writer->depth].ready); });
+        if (writer->written == writer->head)
+        {
+            break;
+        }
+        HMR_WRITER_BLOCK& block = writer->blocks[writer->written % writer->depth];
+        lock.unlock();
+        const char* data = writer->compress ? block.cdata : block.data;
+        size_t size = writer->compress ? block.cdata_size : block.size;
+        if (fwrite(data, 1, size, writer->file) != size)
+        {
+            time_error(-1, "Failed to write output file.");
+        }
+        lock.lock();
+        block.ready = false;
+        ++writer->written;
+        writer->free_cv.notify_all();
+    }
+}
+
+void writer_compress(HMR_WRITER* writer)
+{
+    HMR_DEFLATE* deflater = hmr_deflate_create();
+    std::unique_lock<std::mutex> lock(writer->mutex);
+    while (true)
+    {
+        //Claim the oldest filled block, the blocks could be compressed out of order.
+        writer->compress_cv.wait(lock, [writer] { return writer->stop || writer->compressing < writer->head; });
+        if (writer->compressing == writer->head)
+        {
+            break;
+        }
+        HMR_WRITER_BLOCK& block = writer->blocks[writer->compressing % writer->depth];
+        ++writer->compressing;
+        lock.unlock();
+        //Split the data into BGZF blocks.
+        block.cdata_size = 0;
+        for (size_t offset = 0; offset < block.size; offset += BGZF_BLOCK_DATA)
+        {
+            block.cdata_size += hmr_bgzf_compress(deflater, block.data + offset, hMin(block.size - offset, static_cast<size_t>(BGZF_BLOCK_DATA)), block.cdata + block.cdata_size);
+        }
+        lock.lock();
+        block.ready = true;
+        writer->write_cv.notify_one();
+    }
+    hmr_deflate_free(deflater);
+}
+
+void writer_submit(HMR_WRITER* writer)
+{
+    //Give the filling block to the threads, and wait for the next block to be free.
+    std::unique_lock<std::mutex> lock(writer->mutex);
+    if (writer->compress)
+    {
+        ++writer->head;
+        writer->compress_cv.notify_one();
+    }
+    else
+    {
+        writer->blocks[writer->head % writer->depth].ready = true;
+        ++writer->head;
+        writer->write_cv.notify_one();
+    }
+    writer->free_cv.wait(lock, [writer] { return writer->head - writer->written < static_cast<size_t>(writer->depth); });
+    writer->blocks[writer->head % writer->depth].size = 0;
+}
+
+void writer_put(HMR_WRITER* writer, const char* data, size_t size)
+{
+    //Only called with the append mutex locked.
+    while (size > 0)
+    {
+        HMR_WRITER_BLOCK& block = writer->blocks[writer->head % writer->depth];
+        size_t part = hMin(writer->block_size - block.size, size);
+        memcpy(block.data + block.size, data, part);
+        block.size += part;
+        data += part;
+        size -= part;
+        if (block.size == writer->block_size)
+        {
+            writer_submit(writer);
+        }
+    }
+}
+
+bool hmr_writer_compressed(const char* filepath)
+{
+    //The output is compressed in BGZF when the path ends with .gz.
+    return path_suffix(filepath) == ".gz";
+}
+
+HMR_WRITER* hmr_writer_open(FILE* file, size_t line_width, int compress_threads, size_t block_size, int depth)
+{
+    HMR_WRITER* writer = new HMR_WRITER();
+    writer->file = file;
+    writer->compress = compress_threads > 0;
+    size_t cdata_capacity = 0;
+    if (writer->compress)
+    {
+        //Fill the BGZF blocks fully, keep a block for each worker besides the filling and writing blocks.
+        block_size = hMax(block_size / BGZF_BLOCK_DATA, static_cast<size_t>(1)) * BGZF_BLOCK_DATA;
+        cdata_capacity = block_size / BGZF_BLOCK_DATA * BGZF_MAX_BLOCK;
+        depth = hMax(depth, compress_threads + 2);
+    }
+    writer->block_size = block_size;
+    writer->depth = depth;
+    writer->blocks = new HMR_WRITER_BLOCK[depth];
+    for (int i = 0; i < depth; ++i)
+    {
+        writer->blocks[i].data = static_cast<char*>(malloc(block_size));
+        writer->blocks[i].cdata = writer->compress ? static_cast<char*>(malloc(cdata_capacity)) : NULL;
+        if (!writer->blocks[i].data || (writer->compress && !writer->blocks[i].cdata))
+        {
+            time_error(-1, "Failed to allocate output buffer, no enough memory.");
+        }
+        writer->blocks[i].size = 0;
+        writer->blocks[i].cdata_size = 0;
+        writer->blocks[i].ready = false;
+    }
+    writer->head = 0;
+    writer->compressing = 0;
+    writer->written = 0;
+    writer->stop = false;
+    writer->line_width = line_width;
+    writer->line_bases = 0;
+    writer->worker = std::thread(writer_work, writer);
+    for (int i = 0; i < compress_threads; ++i)
+    {
+        writer->compressors.push_back(std::thread(writer_compress, writer));
+    }
+    return writer;
+}
+
+void hmr_writer_write(HMR_WRITER* writer, const void* data, size_t size)
+{
+    //Append the raw data, the data from different threads are never mixed.
+    std::unique_lock<std::mutex> lock(writer->append_mutex);
+    writer_put(writer, static_cast<const char*>(data), size);
+}
+
+void hmr_writer_seq(HMR_WRITER* writer, const char* seq, size_t size)
+{
+    std::unique_lock<std::mutex> lock(writer->append_mutex);
+    if (writer->line_width == 0)
+    {
+        writer_put(writer, seq, size);
+        return;
+    }
+    //Wrap the bases into lines, continue the current line.
+    while (size > 0)
+    {
+        size_t part = hMin(writer->line_width - writer->line_bases, size);
+        writer_put(writer, seq, part);
+        seq += part;
+        size -= part;
+        writer->line_bases += part;
+        if (writer->line_bases == writer->line_width)
+        {
+            writer_put(writer, "\n", 1);
+            writer->line_bases = 0;
+        }
+    }
+}
+
+void hmr_writer_seq_end(HMR_WRITER* writer)
+{
+    //End the last line of the sequence when it is not ended by wrapping.
+    std::unique_lock<std::mutex> lock(writer->append_mutex);
+    if (writer->line_width == 0 || writer->line_bases > 0)
+    {
+        writer_put(writer, "\n", 1);
+    }
+    writer->line_bases = 0;
+}
+
+void hmr_writer_flush(HMR_WRITER* writer)
+{
+    //Write all the data to the file.
+    std::unique_lock<std::mutex> append_lock(writer->append_mutex);
+    if (writer->blocks[writer->head % writer->depth].size > 0)
+    {
+        writer_submit(writer);
+    }
+    std::unique_lock<std::mutex> lock(writer->mutex);
+    writer->free_cv.wait(lock, [writer] { return writer->written == writer->head; });
+    fflush(writer->file);
+}
+
+void hmr_writer_close(HMR_WRITER* writer)
+{
+    hmr_writer_flush(writer);
+    //Stop the threads.
+    {
+        std::unique_lock<std::mutex> lock(writer->mutex);
+        writer->stop = true;
+        writer->write_cv.notify_one();
+        writer->compress_cv.notify_all();
+    }
+    writer->worker.join();
+    for (auto& compressor : writer->compressors)
+    {
+        compressor.join();
+    }
+    if (writer->compress)
+    {
+        //End the BGZF file with an empty block.
+        char eof_block[BGZF_MAX_BLOCK];
+        HMR_DEFLATE* deflater = hmr_deflate_create();
+        size_t eof_size = hmr_bgzf_compress(deflater, NULL, 0, eof_block);
+        hmr_deflate_free(deflater);
+        if (fwrite(eof_block, 1, eof_size, writer->file) != eof_size)
+        {
+            time_error(-1, "Failed to write output file.");
+        }
+        fflush(writer->file);
+    }
+    for (int i = 0; i < writer->depth; ++i)
+    {
+        free(writer->blocks[i].data);
+        free(writer->blocks[i].cdata);
+    }
+    delete[] writer->blocks;
+    delete writer;
+}
@@ -0,0 +1,51 @@
+#ifndef HMR_WRITER_H
+#define HMR_WRITER_H
+
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+// Default block size and number of blocks.
+#define HMR_WRITER_BLOCK_SIZE (4194304)
+#define HMR_WRITER_DEPTH (2)
+
+typedef struct HMR_WRITER_BLOCK
+{
+    char* data;
+    size_t size;
+    //BGZF blocks of the data when compressing.
+    char* cdata;
+    size_t cdata_size;
+    bool ready;
+} HMR_WRITER_BLOCK;
+
+//The blocks are filled by the callers, compressed by the workers when needed, and written to the file in order by a thread.
+typedef struct HMR_WRITER
+{
+    FILE* file;
+    size_t block_size;
+    int depth;
+    HMR_WRITER_BLOCK* blocks;
+    //Block index (not wrapped) of the filling block, the next block to compress and the next block to write.
+    size_t head, compressing, written;
+    bool compress, stop;
+    //The callers fill the block in turns, the state is shared with the threads.
+    std::mutex append_mutex, mutex;
+    std::condition_variable write_cv, compress_cv, free_cv;
+    std::thread worker;
+    std::vector<std::thread> compressors;
+    //Bases per line of the sequence (0 for no wrapping), and bases in the current line.
+    size_t line_width, line_bases;
+} HMR_WRITER;
+
+bool hmr_writer_compressed(const char* filepath);
+HMR_WRITER* hmr_writer_open(FILE* file, size_t line_width = 0, int compress_threads = 0, size_t block_size = HMR_WRITER_BLOCK_SIZE, int depth = HMR_WRITER_DEPTH);
+void hmr_writer_write(HMR_WRITER* writer, const void* data, size_t size);
+void hmr_writer_seq(HMR_WRITER* writer, const char* seq, size_t size);
+void hmr_writer_seq_end(HMR_WRITER* writer);
+void hmr_writer_flush(HMR_WRITER* writer);
+void hmr_writer_close(HMR_WRITER* writer);
+
+#endif // HMR_WRITER_H